@@ -0,0 +1,20 @@
+#pragma once
+
+#include <stdint.h>
+
+// Host stand-in for the tinyh264 software decoder behind the esp_h264 interface.
+// Every access unit containing a slice produces one picture. The picture size comes from the
+// last SPS seen, or from h264_stub_set_size() until the stream carries one. Picture contents are
+// a fixed test pattern with a STUB_BOX_SIZE box moving over it, a small changed region per picture
+// like a map position arrow. Only the fixed-function stages around the decoder are meaningful.
+// A real host decoder can replace h264_stub.c by implementing the same esp_h264 entry points.
+
+#define STUB_BOX_SIZE 24
+
+void h264_stub_set_size(uint32_t width, uint32_t height);
+
+// the last picture output, NULL before the first
+const uint8_t *h264_stub_last_picture(uint32_t *width, uint32_t *height);
+
+// visible part of the last picture by the SPS frame cropping, all of it without
+void h264_stub_last_crop(uint32_t *x, uint32_t *y, uint32_t *width, uint32_t *height);
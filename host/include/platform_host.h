@@ -0,0 +1,14 @@
+#pragma once
+
+#include <stdint.h>
+
+// Host only additions to platform.h.
+
+// heap allocations made by the process so far, malloc/calloc/realloc and platform_alloc
+uint32_t platform_alloc_count(void);
+
+// moves platform_time_us() forward to time, for replays on a simulated clock
+void platform_host_advance_time(int64_t time);
+
+// framebuffer of the last display_submit(), NULL before the first one
+const uint16_t *display_host_last_frame(void);
@@ -0,0 +1,35 @@
+#pragma once
+
+// Host build configuration, mirrors the Kconfig defaults of main/Kconfig.projbuild.
+// Choices can be switched from cmake, e.g. -DMOTOCAST_SCALE=BILINEAR, -DMOTOCAST_COLOR=LUT or
+// -DMOTOCAST_YUV_SCANOUT=ON (see CMakeLists.txt).
+
+#define CONFIG_MOTOCAST_MAX_AU_SIZE         65536
+#define CONFIG_MOTOCAST_PACKET_POOL_SIZE    2
+#define CONFIG_MOTOCAST_RING_SIZE           32768
+#define CONFIG_MOTOCAST_DROP_LAG_MS         150
+#define CONFIG_MOTOCAST_DROP_BACKLOG        16384
+#define CONFIG_MOTOCAST_DROP_SKIP_CONVERT   1
+#if CONFIG_MOTOCAST_YUV_SCANOUT
+#define CONFIG_MOTOCAST_YUV_SCANOUT_MAX_PIXELS 131072
+#else
+#define CONFIG_MOTOCAST_DIRTY_TILES         1
+#define CONFIG_MOTOCAST_DIRTY_REFRESH       150
+#define CONFIG_MOTOCAST_CONVERT_SPLIT       1
+#endif
+
+#define CONFIG_MOTOCAST_COLOR_MATRIX_AUTO   1
+#if CONFIG_MOTOCAST_COLOR_LUT
+#define CONFIG_MOTOCAST_COLOR_DITHER        1
+#define CONFIG_MOTOCAST_COLOR_GAMMA         100
+#else
+#define CONFIG_MOTOCAST_COLOR_SELFTEST      1
+#endif
+
+#if !CONFIG_MOTOCAST_PRESENT_DOUBLE
+#define CONFIG_MOTOCAST_PRESENT_TRIPLE      1
+#endif
+
+// stage and transport timing is what the host build is for
+#define CONFIG_MOTOCAST_PIPELINE_BENCHMARK  1
+#define CONFIG_MOTOCAST_TRANSPORT_COMPARE   1
@@ -0,0 +1,116 @@
+#include "display.h"
+#include "board.h"
+#include "platform.h"
+#include "platform_host.h"
+#include "scanout.h"
+#include <stdlib.h>
+#include <string.h>
+
+// Host display: plain framebuffers, every submitted frame counts as presented immediately.
+// With YUV scan-out the last frame is put together from bounce buffer refills when asked for.
+
+static void *fbs[BOARD_LCD_NUM_FBS];
+static unsigned next;
+static void *last;
+static struct display_stats stats;
+static uint32_t submitted;
+#define FLIP_LOG 64
+static int64_t flip_time[FLIP_LOG];
+
+#if CONFIG_MOTOCAST_YUV_SCANOUT
+#define BUFFER_SIZE (CONFIG_MOTOCAST_YUV_SCANOUT_MAX_PIXELS * 3 / 2)
+static struct scaler geometry;
+static struct scaler_lines refill_lines;
+static uint16_t *scanout_frame;
+#else
+#define BUFFER_SIZE (BOARD_LCD_H_RES * BOARD_LCD_V_RES * sizeof(uint16_t))
+#endif
+
+void display_init(void) {
+    for(unsigned i = 0; i != BOARD_LCD_NUM_FBS; ++i) {
+        fbs[i] = platform_alloc(BUFFER_SIZE, PLATFORM_MEM_EXTERNAL);
+        if (!fbs[i])
+            abort();
+    }
+#if CONFIG_MOTOCAST_YUV_SCANOUT
+    scanout_frame = platform_alloc(BOARD_LCD_H_RES * BOARD_LCD_V_RES * sizeof(uint16_t), PLATFORM_MEM_EXTERNAL);
+    if (!scanout_frame)
+        abort();
+    refill_lines.portable = true;
+#endif
+}
+
+static void *display_acquire_buffer(void) {
+    void *fb = fbs[next];
+    next = (next + 1) % BOARD_LCD_NUM_FBS;
+    return fb;
+}
+
+static uint32_t display_submit_buffer(void *fb) {
+    last = fb;
+    ++stats.presented;
+    flip_time[++submitted % FLIP_LOG] = platform_time_us();
+    return submitted;
+}
+
+uint16_t *display_acquire(void) {
+    return display_acquire_buffer();
+}
+
+uint32_t display_submit(uint16_t *fb) {
+    return display_submit_buffer(fb);
+}
+
+#if CONFIG_MOTOCAST_YUV_SCANOUT
+
+bool display_yuv_configure(struct scaler *s, const uint8_t *yuv) {
+    last = NULL;
+    if (s->pic_w * s->pic_h > CONFIG_MOTOCAST_YUV_SCANOUT_MAX_PIXELS)
+        return false;
+    bool portable = s->work.portable;
+    s->work.portable = true;
+    uint32_t slowest = scanout_measure(s, &s->work, yuv, scanout_frame);
+    s->work.portable = portable;
+    uint32_t allowed = scanout_budget_us() * SCANOUT_BUDGET_PERCENT / 100;
+    PLATFORM_LOGI("display", "%lux%lu refills take up to %lu us of %lu us", (unsigned long)s->src_w,
+        (unsigned long)s->src_h, (unsigned long)slowest, (unsigned long)allowed);
+    if (slowest > stats.refill_max_us)
+        stats.refill_max_us = slowest;
+    if (slowest > allowed)
+        return false;
+    geometry = *s;
+    return true;
+}
+
+uint8_t *display_acquire_yuv(void) {
+    return display_acquire_buffer();
+}
+
+uint32_t display_submit_yuv(uint8_t *yuv) {
+    return display_submit_buffer(yuv);
+}
+
+#endif
+
+int64_t display_flip_time(uint32_t frame) {
+    if ((int32_t)(submitted - frame) < 0)
+        return 0;
+    return submitted - frame < FLIP_LOG? flip_time[frame % FLIP_LOG]: -1;
+}
+
+void display_get_stats(struct display_stats *out) {
+    *out = stats;
+}
+
+const uint16_t *display_host_last_frame(void) {
+#if CONFIG_MOTOCAST_YUV_SCANOUT
+    if (!last)
+        return NULL;
+    for(uint32_t row = 0; row < BOARD_LCD_V_RES; row += BOARD_LCD_BOUNCE_ROWS)
+        scaler_run_lines(&geometry, &refill_lines, last, scanout_frame + row * BOARD_LCD_H_RES, row,
+            BOARD_LCD_BOUNCE_ROWS);
+    return scanout_frame;
+#else
+    return last;
+#endif
+}
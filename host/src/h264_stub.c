@@ -0,0 +1,216 @@
+#include "h264_stub.h"
+#include "esp_h264_dec_sw.h"
+#include "h264_nal.h"
+#include "platform.h"
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+
+// Like tinyh264, every esp_h264_dec_process() call consumes a single NAL unit.
+
+struct h264_stub {
+    esp_h264_dec_t base;
+    esp_h264_dec_param_t param;
+    uint32_t width, height;
+    uint32_t crop_x, crop_y, crop_w, crop_h;    // frame cropping of the SPS
+    uint8_t *picture;
+    uint32_t picture_size;
+    uint32_t box_x, box_y;      // where the box is drawn in picture
+    uint32_t frames;
+};
+
+static uint32_t default_width = 320, default_height = 240;
+static struct h264_stub *last_stub;
+
+void h264_stub_set_size(uint32_t width, uint32_t height) {
+    default_width = width;
+    default_height = height;
+}
+
+// length of the NAL unit starting at data (after its start code), up to the next start code
+static uint32_t nal_length(const uint8_t *data, uint32_t len) {
+    for(uint32_t i = 0; i + 2 < len; ++i)
+        if (data[i] == 0 && data[i + 1] == 0 && data[i + 2] == 1)
+            return (i && data[i - 1] == 0)? i - 1: i;
+    return len;
+}
+
+// fills the area of the box at x, y with the box or with the background gradient
+static void stub_draw_box(struct h264_stub *stub, uint32_t x0, uint32_t y0, bool box) {
+    const uint32_t w = stub->width, h = stub->height, cw = w / 2;
+    uint8_t *U = stub->picture + w * h, *V = U + cw * (h / 2);
+    for(uint32_t y = y0; y != y0 + STUB_BOX_SIZE; ++y)
+        for(uint32_t x = x0; x != x0 + STUB_BOX_SIZE; ++x)
+            stub->picture[y * w + x] = box? 235: (uint8_t)(16 + (x + y) * 219 / (w + h));
+    for(uint32_t y = y0 / 2; y != (y0 + STUB_BOX_SIZE) / 2; ++y) {
+        memset(U + y * cw + x0 / 2, box? 200: 96, STUB_BOX_SIZE / 2);
+        memset(V + y * cw + x0 / 2, box? 60: 160, STUB_BOX_SIZE / 2);
+    }
+}
+
+static void stub_fill_picture(struct h264_stub *stub) {
+    uint32_t luma = stub->width * stub->height;
+    for(uint32_t y = 0; y != stub->height; ++y)
+        for(uint32_t x = 0; x != stub->width; ++x)
+            stub->picture[y * stub->width + x] = (uint8_t)(16 + (x + y) * 219 / (stub->width + stub->height));
+    memset(stub->picture + luma, 96, luma / 4);
+    memset(stub->picture + luma + luma / 4, 160, luma / 4);
+    stub->box_x = stub->box_y = 0;
+    stub->frames = 0;
+}
+
+// moves the box along for the next picture
+static void stub_next_picture(struct h264_stub *stub) {
+    if (stub->width < 2 * STUB_BOX_SIZE || stub->height < 2 * STUB_BOX_SIZE)
+        return;
+    if (stub->frames++)
+        stub_draw_box(stub, stub->box_x, stub->box_y, false);
+    // even positions keep the box aligned with the chroma planes
+    stub->box_x = (stub->frames * 6 % (stub->width - STUB_BOX_SIZE)) & ~1u;
+    stub->box_y = (stub->frames * 2 % (stub->height - STUB_BOX_SIZE)) & ~1u;
+    stub_draw_box(stub, stub->box_x, stub->box_y, true);
+}
+
+static esp_h264_err_t stub_resize(struct h264_stub *stub, uint32_t width, uint32_t height) {
+    stub->crop_x = stub->crop_y = 0;
+    stub->crop_w = width;
+    stub->crop_h = height;
+    if (width == stub->width && height == stub->height && stub->picture)
+        return ESP_H264_ERR_OK;
+    platform_free(stub->picture);
+    stub->width = width;
+    stub->height = height;
+    stub->picture_size = width * height * 3 / 2;
+    stub->picture = platform_alloc(stub->picture_size, PLATFORM_MEM_EXTERNAL);
+    if (!stub->picture)
+        return ESP_H264_ERR_MEM;
+    stub_fill_picture(stub);
+    return ESP_H264_ERR_OK;
+}
+
+static esp_h264_err_t stub_process(esp_h264_dec_handle_t dec, esp_h264_dec_in_frame_t *in_frame, esp_h264_dec_out_frame_t *out_frame) {
+    struct h264_stub *stub = (struct h264_stub *)dec;
+    const uint8_t *data = in_frame->raw_data.buffer;
+    uint32_t len = in_frame->raw_data.len;
+    out_frame->out_size = 0;
+
+    uint32_t start = 0;
+    while(start + 2 < len && !(data[start] == 0 && data[start + 1] == 0 && data[start + 2] == 1))
+        ++start;
+    if (start + 2 >= len) {
+        in_frame->consume = len;
+        return ESP_H264_ERR_OK;
+    }
+    start += 3;
+    uint32_t nal_len = nal_length(data + start, len - start);
+    in_frame->consume = start + nal_len;
+    if (!nal_len)
+        return ESP_H264_ERR_OK;
+
+    const uint8_t *nal = data + start;
+    unsigned type = nal[0] & 0x1f;
+    if (type == H264_NAL_SPS) {
+        // picture size in macroblock units as tinyh264 reports it, without cropping
+        struct h264_sps sps;
+        if (!h264_parse_sps(nal, nal_len, &sps))
+            return ESP_H264_ERR_FAIL;
+        esp_h264_err_t ret = stub_resize(stub, sps.width, sps.height);
+        stub->crop_x = sps.crop_x;
+        stub->crop_y = sps.crop_y;
+        stub->crop_w = sps.crop_w;
+        stub->crop_h = sps.crop_h;
+        return ret;
+    }
+    // a slice starting at macroblock 0 begins a new picture
+    if ((type == 1 || type == 5) && nal_len > 1 && (nal[1] & 0x80)) {
+        if (!stub->picture && stub_resize(stub, default_width, default_height) != ESP_H264_ERR_OK)
+            return ESP_H264_ERR_MEM;
+        stub_next_picture(stub);
+        last_stub = stub;
+        out_frame->outbuf = stub->picture;
+        out_frame->out_size = stub->picture_size;
+    }
+    return ESP_H264_ERR_OK;
+}
+
+static esp_h264_err_t stub_get_res(esp_h264_dec_param_handle_t handle, esp_h264_resolution_t *res) {
+    struct h264_stub *stub = (struct h264_stub *)((uint8_t *)handle - offsetof(struct h264_stub, param));
+    res->width = stub->width;
+    res->height = stub->height;
+    return ESP_H264_ERR_OK;
+}
+
+static esp_h264_err_t stub_open(esp_h264_dec_handle_t dec) {
+    return ESP_H264_ERR_OK;
+}
+
+static esp_h264_err_t stub_del(esp_h264_dec_handle_t dec) {
+    struct h264_stub *stub = (struct h264_stub *)dec;
+    if (last_stub == stub)
+        last_stub = NULL;
+    platform_free(stub->picture);
+    free(stub);
+    return ESP_H264_ERR_OK;
+}
+
+const uint8_t *h264_stub_last_picture(uint32_t *width, uint32_t *height) {
+    if (!last_stub)
+        return NULL;
+    *width = last_stub->width;
+    *height = last_stub->height;
+    return last_stub->picture;
+}
+
+void h264_stub_last_crop(uint32_t *x, uint32_t *y, uint32_t *width, uint32_t *height) {
+    *x = last_stub? last_stub->crop_x: 0;
+    *y = last_stub? last_stub->crop_y: 0;
+    *width = last_stub? last_stub->crop_w: 0;
+    *height = last_stub? last_stub->crop_h: 0;
+}
+
+esp_h264_err_t esp_h264_dec_sw_new(const esp_h264_dec_cfg_sw_t *cfg, esp_h264_dec_handle_t *out_dec) {
+    if (!cfg || !out_dec || cfg->pic_type != ESP_H264_RAW_FMT_I420)
+        return ESP_H264_ERR_ARG;
+    struct h264_stub *stub = calloc(1, sizeof(*stub));
+    if (!stub)
+        return ESP_H264_ERR_MEM;
+    stub->base.open = stub_open;
+    stub->base.process = stub_process;
+    stub->base.close = stub_open;
+    stub->base.del = stub_del;
+    stub->param.get_res = stub_get_res;
+    *out_dec = &stub->base;
+    return ESP_H264_ERR_OK;
+}
+
+esp_h264_err_t esp_h264_dec_sw_get_param_hd(esp_h264_dec_handle_t dec, esp_h264_dec_param_sw_handle_t *out_param) {
+    if (!dec || !out_param)
+        return ESP_H264_ERR_ARG;
+    *out_param = &((struct h264_stub *)dec)->param;
+    return ESP_H264_ERR_OK;
+}
+
+// the esp_h264 interface layer, which on the device comes from the component
+esp_h264_err_t esp_h264_dec_open(esp_h264_dec_handle_t dec) {
+    return dec? dec->open(dec): ESP_H264_ERR_ARG;
+}
+
+esp_h264_err_t esp_h264_dec_process(esp_h264_dec_handle_t dec, esp_h264_dec_in_frame_t *in_frame, esp_h264_dec_out_frame_t *out_frame) {
+    if (!dec || !in_frame || !out_frame || !in_frame->raw_data.buffer)
+        return ESP_H264_ERR_ARG;
+    return dec->process(dec, in_frame, out_frame);
+}
+
+esp_h264_err_t esp_h264_dec_close(esp_h264_dec_handle_t dec) {
+    return dec? dec->close(dec): ESP_H264_ERR_ARG;
+}
+
+esp_h264_err_t esp_h264_dec_del(esp_h264_dec_handle_t dec) {
+    return dec? dec->del(dec): ESP_H264_ERR_ARG;
+}
+
+esp_h264_err_t esp_h264_dec_get_resolution(esp_h264_dec_param_handle_t handle, esp_h264_resolution_t *out_res) {
+    if (!handle || !out_res)
+        return ESP_H264_ERR_ARG;
+    return handle->get_res(handle, out_res);
+}
@@ -0,0 +1,91 @@
+#include "pipeline.h"
+#include <pthread.h>
+#include <semaphore.h>
+#include <stdbool.h>
+#include <stdlib.h>
+
+// Host pipeline_parallel(): the helper is a thread, started on first use. Same hand-out as on the
+// device, see pipeline.c.
+
+#if CONFIG_MOTOCAST_CONVERT_SPLIT
+
+static struct {
+    pipeline_slice_fn fn;
+    void *arg;
+    uint32_t count, next, completed;
+    uint32_t helper;
+} job;
+static pthread_mutex_t job_lock = PTHREAD_MUTEX_INITIALIZER;
+static sem_t helper_start, helper_done;
+static bool helper_running;
+
+static uint32_t pipeline_work(unsigned worker) {
+    uint32_t done = 0;
+    for(;;) {
+        pthread_mutex_lock(&job_lock);
+        if (done)
+            ++job.completed;
+        uint32_t index = job.next < job.count? job.next++: UINT32_MAX;
+        if (index != UINT32_MAX && worker)
+            ++job.helper;
+        pipeline_slice_fn fn = job.fn;
+        void *arg = job.arg;
+        pthread_mutex_unlock(&job_lock);
+        if (index == UINT32_MAX)
+            return done;
+        fn(arg, index, worker);
+        ++done;
+    }
+}
+
+static void *pipeline_helper(void *arg) {
+    for(;;) {
+        sem_wait(&helper_start);
+        if (pipeline_work(1))
+            sem_post(&helper_done);
+    }
+    return NULL;
+}
+
+uint32_t pipeline_parallel(uint32_t count, pipeline_slice_fn fn, void *arg) {
+    if (!helper_running) {
+        pthread_t thread;
+        sem_init(&helper_start, 0, 0);
+        sem_init(&helper_done, 0, 0);
+        if (pthread_create(&thread, NULL, pipeline_helper, NULL))
+            abort();
+        pthread_detach(thread);
+        helper_running = true;
+    }
+    pthread_mutex_lock(&job_lock);
+    job.fn = fn;
+    job.arg = arg;
+    job.count = count;
+    job.next = job.completed = job.helper = 0;
+    pthread_mutex_unlock(&job_lock);
+    // binary like the device's semaphore
+    int pending;
+    if (!sem_getvalue(&helper_start, &pending) && !pending)
+        sem_post(&helper_start);
+
+    pipeline_work(0);
+    for(;;) {
+        pthread_mutex_lock(&job_lock);
+        bool finished = job.completed == count;
+        uint32_t helper = job.helper;
+        pthread_mutex_unlock(&job_lock);
+        if (finished)
+            return helper;
+        sem_wait(&helper_done);
+    }
+}
+
+#else
+
+uint32_t pipeline_parallel(uint32_t count, pipeline_slice_fn fn, void *arg) {
+    for(uint32_t i = 0; i != count; ++i)
+        fn(arg, i, 0);
+    return 0;
+}
+
+#endif
@@ -0,0 +1,66 @@
+#include "platform.h"
+#include "platform_host.h"
+#include <stdatomic.h>
+#include <stdlib.h>
+#include <time.h>
+
+static atomic_uint alloc_count;
+static int64_t time_offset;
+
+#ifdef __GLIBC__
+
+// count libc heap allocations too by interposing the allocator
+extern void *__libc_malloc(size_t size);
+extern void *__libc_calloc(size_t n, size_t size);
+extern void *__libc_realloc(void *ptr, size_t size);
+
+void *malloc(size_t size) {
+    ++alloc_count;
+    return __libc_malloc(size);
+}
+
+void *calloc(size_t n, size_t size) {
+    ++alloc_count;
+    return __libc_calloc(n, size);
+}
+
+void *realloc(void *ptr, size_t size) {
+    ++alloc_count;
+    return __libc_realloc(ptr, size);
+}
+
+#endif
+
+// heap_caps_malloc() on the device only guarantees 4 byte alignment. Host allocations are placed
+// HOST_ALLOC_OFFSET bytes past a 16 byte boundary, so the paths for unaligned buffers run here too.
+#ifndef HOST_ALLOC_OFFSET
+#define HOST_ALLOC_OFFSET 4
+#endif
+_Static_assert(HOST_ALLOC_OFFSET % 4 == 0 && HOST_ALLOC_OFFSET < 16, "offset has to keep the device's 4 byte alignment");
+
+void *platform_alloc(size_t size, enum platform_mem mem) {
+    ++alloc_count;
+    uint8_t *p = aligned_alloc(16, (size + HOST_ALLOC_OFFSET + 15) & ~(size_t)15);
+    return p? p + HOST_ALLOC_OFFSET: NULL;
+}
+
+void platform_free(void *ptr) {
+    if (ptr)
+        free((uint8_t *)ptr - HOST_ALLOC_OFFSET);
+}
+
+uint32_t platform_alloc_count(void) {
+    return alloc_count;
+}
+
+int64_t platform_time_us(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (int64_t)ts.tv_sec * 1000000 + ts.tv_nsec / 1000 + time_offset;
+}
+
+void platform_host_advance_time(int64_t time) {
+    int64_t now = platform_time_us();
+    if (time > now)
+        time_offset += time - now;
+}
@@ -0,0 +1,710 @@
+#include "board.h"
+#include "capture.h"
+#include "color_convert.h"
+#include "crc32.h"
+#include "display.h"
+#include "glass.h"
+#include "h264_nal.h"
+#include "h264_stub.h"
+#include "latency.h"
+#include "packet_pool.h"
+#include "pipeline.h"
+#include "platform.h"
+#include "platform_host.h"
+#include "ring.h"
+#include "scaler.h"
+#include "timesync.h"
+#include "transport.h"
+#include "video_packet.h"
+#include "video_stream.h"
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+// Replays a BLE byte stream through the video pipeline the way the decode task does: writes go into
+// the ingest ring, the ring is drained through video_decode(). The stream is either a raw byte
+// stream cut into fixed size writes, a generated one, or a capture (see capture.h) which keeps the
+// original writes, as a file or as the console log of a recorder dump.
+
+static const char *TAG = "replay";
+
+struct pipeline_stage_time pipeline_stages[PIPELINE_STAGE_COUNT];
+
+static const char *const stage_names[PIPELINE_STAGE_COUNT] = {"ingest", "parse", "decode", "convert"};
+static const char *const latency_names[LATENCY_COUNT] = {"arrival", "decode", "convert", "flip", "glass"};
+
+static struct ring ring;
+static uint64_t bytes_written;
+static struct video_frame_tracker tracker;
+static uint32_t ingest_writes, completing_writes;
+static enum transport transport = TRANSPORT_GATT;
+
+// arrival time of recent writes, keyed by the ring position of their first byte as batches are in
+// video.c, every write is a batch of its own here
+#define ARRIVALS 64
+static struct {
+    uint32_t start;
+    int64_t time;
+} arrivals[ARRIVALS];
+static uint32_t arrivals_head, arrivals_tail;
+
+// Glass-to-glass simulation: generated frames carry capture times of a sender whose clock is
+// SENDER_OFFSET ahead and skew_ppm faster than ours. Frames are captured every FRAME_US and written
+// TRANSIT_US later, platform_time_us() jumps ahead to match. Once a second there's a ping/pong
+// exchange with random BLE delays. The offsets echoed once the estimate had time to settle, a full
+// window of samples to measure the drift over, are checked against the real one, which takes at
+// least GLASS_MIN_FRAMES.
+#define SENDER_OFFSET       5000000000LL
+#define FRAME_US            33333
+#define TRANSIT_US          20000
+#define GLASS_TOLERANCE_US  1000
+#define GLASS_SETTLE_US     (TIMESYNC_SAMPLES * 1000000LL)
+#define GLASS_MIN_FRAMES    ((uint32_t)((GLASS_SETTLE_US + 1000000) / FRAME_US + 1))
+
+static bool glass_mode;
+static unsigned vui_matrix;     // matrix_coefficients of the generated SPS, 0 for no VUI
+static bool vui_full_range;
+static int32_t skew_ppm;
+static int64_t glass_start, next_ping;
+static uint32_t glass_seed = 1;
+static uint32_t glass_echoes, glass_synced; // echoes, those checked
+static int64_t glass_max_error, glass_total_error;
+
+static void usage(const char *name) {
+    fprintf(stderr,
+        "usage: %s [-c chunk] [-l] [-s WxH] [-g frames] [-b bytes] [-n loops] [-o frame.ppm] [-k ppm] [-m matrix] [-p] [stream]\n"
+        "  -c chunk   bytes per BLE write of a raw stream, default 244, at most the ingest ring's\n"
+        "             %d; writes of several access units queue frames up and make the\n"
+        "             pipeline catch up\n"
+        "  -l         account writes to the long write transport instead of plain GATT writes,\n"
+        "             each -c sized write one executed round of at most %d bytes\n"
+        "  -s WxH     picture size until the stream carries an SPS, default 320x240; the SPS of a\n"
+        "             generated stream crops sizes that aren't whole macroblocks\n"
+        "  -g frames  replay a generated stream of that many frames instead of a file\n"
+        "  -b bytes   access unit size of the generated stream, default 4000\n"
+        "  -n loops   replay the stream that many times, default 1; sequence numbers restart,\n"
+        "             which the parser takes if the stream begins with an IDR\n"
+        "  -o file    write the last presented frame as PPM\n"
+        "  -k ppm     timestamp the generated frames and simulate glass-to-glass measurement\n"
+        "             against a sender clock running that many ppm fast, up to +-%d; needs\n"
+        "             -g %u or more, the clock estimate is checked once it settled\n"
+        "  -m matrix  colour description of the generated SPS: 601, 709, 601f or 709f for full\n"
+        "             range, default none\n"
+        "  -p         parse only: framing and CRC checks of the stream in -c sized writes, without\n"
+        "             ring or decoder, and their throughput in MB/s, then the cost per write of\n"
+        "             the ingest ring copy and of the producer side frame tracking\n", name, CONFIG_MOTOCAST_RING_SIZE, TRANSPORT_LONG_WRITE_MAX, TIMESYNC_MAX_DRIFT_PPB / 1000, GLASS_MIN_FRAMES);
+    exit(1);
+}
+
+static uint8_t *read_file(const char *path, uint32_t *len) {
+    FILE *f = fopen(path, "rb");
+    if (!f) {
+        perror(path);
+        exit(1);
+    }
+    fseek(f, 0, SEEK_END);
+    long size = ftell(f);
+    fseek(f, 0, SEEK_SET);
+    uint8_t *data = malloc(size? size: 1);
+    if (!data || fread(data, 1, size, f) != (size_t)size) {
+        fprintf(stderr, "%s: read failed\n", path);
+        exit(1);
+    }
+    fclose(f);
+    *len = size;
+    return data;
+}
+
+// extracts the "MCAP <hex>" lines of a recorder dump, returns the decoded length or 0
+static uint32_t decode_capture_log(uint8_t *data, uint32_t len) {
+    uint32_t out = 0;
+    for(uint32_t pos = 0; pos < len; ) {
+        const uint8_t *line = data + pos;
+        const uint8_t *eol = memchr(line, '\n', len - pos);
+        uint32_t line_len = eol? (uint32_t)(eol - line): len - pos;
+        pos += line_len + 1;
+        if (line_len < 5 || memcmp(line, "MCAP ", 5) || (line_len >= 8 && !memcmp(line + 5, "end", 3)))
+            continue;
+        for(uint32_t i = 5; i + 1 < line_len; i += 2) {
+            unsigned byte;
+            if (sscanf((const char *)line + i, "%2x", &byte) != 1)
+                break;
+            // output never overtakes input: two hex digits per byte
+            data[out++] = byte;
+        }
+    }
+    return out;
+}
+
+struct bit_writer {
+    uint8_t *data;
+    uint32_t bits;
+};
+
+static void put_bits(struct bit_writer *w, uint32_t value, unsigned n) {
+    while(n--) {
+        if ((value >> n) & 1)
+            w->data[w->bits >> 3] |= 0x80 >> (w->bits & 7);
+        ++w->bits;
+    }
+}
+
+static void put_ue(struct bit_writer *w, uint32_t value) {
+    unsigned n = 0;
+    while((value + 1) >> (n + 1))
+        ++n;
+    put_bits(w, 0, n);
+    put_bits(w, value + 1, n + 1);
+}
+
+// baseline SPS for a width x height picture, start code included
+static uint32_t write_sps(uint8_t *dst, uint32_t width, uint32_t height) {
+    uint8_t rbsp[32] = {};
+    struct bit_writer w = {rbsp, 0};
+    put_bits(&w, 66, 8);        // profile_idc
+    put_bits(&w, 0xc0, 8);      // constraint flags
+    put_bits(&w, 30, 8);        // level_idc
+    put_ue(&w, 0);              // seq_parameter_set_id
+    put_ue(&w, 0);              // log2_max_frame_num_minus4
+    put_ue(&w, 2);              // pic_order_cnt_type
+    put_ue(&w, 1);              // max_num_ref_frames
+    put_bits(&w, 0, 1);
+    put_ue(&w, (width + 15) / 16 - 1);
+    put_ue(&w, (height + 15) / 16 - 1);
+    put_bits(&w, 1, 1);         // frame_mbs_only_flag
+    put_bits(&w, 1, 1);         // direct_8x8_inference_flag
+    // frame cropping down to sizes which aren't whole macroblocks, in 2 pixel units
+    uint32_t crop_right = ((width + 15) / 16 * 16 - width) / 2;
+    uint32_t crop_bottom = ((height + 15) / 16 * 16 - height) / 2;
+    put_bits(&w, crop_right || crop_bottom, 1);
+    if (crop_right || crop_bottom) {
+        put_ue(&w, 0);
+        put_ue(&w, crop_right);
+        put_ue(&w, 0);
+        put_ue(&w, crop_bottom);
+    }
+    put_bits(&w, vui_matrix != 0, 1);
+    if (vui_matrix) {
+        put_bits(&w, 0, 2);     // no aspect ratio or overscan info
+        put_bits(&w, 1, 1);     // video_signal_type_present_flag
+        put_bits(&w, 5, 3);     // video_format unspecified
+        put_bits(&w, vui_full_range, 1);
+        put_bits(&w, 1, 1);     // colour_description_present_flag
+        put_bits(&w, vui_matrix, 8);    // colour_primaries, transfer_characteristics and
+        put_bits(&w, vui_matrix, 8);    // matrix_coefficients share their codes
+        put_bits(&w, vui_matrix, 8);
+        put_bits(&w, 0, 5);     // no timing, HRD or bitstream restriction info
+    }
+    put_bits(&w, 1, 1);         // rbsp_stop_one_bit
+
+    uint32_t len = 0;
+    dst[len++] = 0; dst[len++] = 0; dst[len++] = 1;
+    dst[len++] = 0x67;
+    unsigned zeros = 0;
+    for(uint32_t i = 0; i != (w.bits + 7) / 8; ++i) {
+        if (zeros >= 2 && rbsp[i] <= 3) {
+            dst[len++] = 3;
+            zeros = 0;
+        }
+        zeros = rbsp[i]? 0: zeros + 1;
+        dst[len++] = rbsp[i];
+    }
+    return len;
+}
+
+static uint32_t write_frame(uint8_t *dst, uint16_t seq, uint8_t flags, const uint8_t *payload, uint32_t len) {
+    uint8_t *h = dst;
+    h[0] = VIDEO_FRAME_SYNC0;
+    h[1] = VIDEO_FRAME_SYNC1;
+    h[2] = VIDEO_FRAME_VERSION;
+    h[3] = flags;
+    h[4] = seq; h[5] = seq >> 8;
+    h[6] = h[7] = 0;
+    h[8] = len; h[9] = len >> 8; h[10] = len >> 16; h[11] = len >> 24;
+    memcpy(dst + VIDEO_FRAME_HEADER_SIZE, payload, len);
+    uint32_t crc = crc32_update(crc32_update(0, h, VIDEO_FRAME_CRC_OFFSET), payload, len);
+    h[12] = crc; h[13] = crc >> 8; h[14] = crc >> 16; h[15] = crc >> 24;
+    return VIDEO_FRAME_HEADER_SIZE + len;
+}
+
+static void write_le64(uint8_t *dst, uint64_t value) {
+    for(unsigned i = 0; i != 8; ++i)
+        dst[i] = value >> (i * 8);
+}
+
+static uint64_t read_le64(const uint8_t *src) {
+    uint64_t value = 0;
+    for(unsigned i = 0; i != 8; ++i)
+        value |= (uint64_t)src[i] << (i * 8);
+    return value;
+}
+
+static int64_t sender_time(int64_t local) {
+    return local + SENDER_OFFSET + (local - glass_start) * skew_ppm / 1000000;
+}
+
+static int64_t sender_to_local(int64_t sender) {
+    return glass_start + (int64_t)((sender - SENDER_OFFSET - glass_start) * 1e6 / (1e6 + skew_ppm));
+}
+
+// framed stream of frames access units, an IDR with SPS every 30 frames, slices of random filler
+static uint8_t *generate_stream(uint32_t frames, uint32_t au_size, uint32_t width, uint32_t height, uint32_t *len) {
+    if (au_size < 64)
+        au_size = 64;
+    uint32_t ts = glass_mode? VIDEO_FRAME_TIMESTAMP_SIZE: 0;
+    uint8_t *payload = malloc(ts + au_size);
+    uint8_t *au = payload + ts;
+    uint8_t *stream = malloc((size_t)frames * (VIDEO_FRAME_HEADER_SIZE + ts + au_size));
+    if (!payload || !stream)
+        abort();
+    uint32_t seed = 1, pos = 0;
+    for(uint32_t i = 0; i != frames; ++i) {
+        bool idr = i % 30 == 0;
+        uint32_t n = idr? write_sps(au, width, height): 0;
+        au[n++] = 0; au[n++] = 0; au[n++] = 1;
+        // every other P picture is a non-reference one, droppable when decoding falls behind
+        au[n++] = idr? 0x65: i % 2? 0x01: 0x41;
+        au[n++] = 0x88;     // first_mb_in_slice = 0
+        for(; n != au_size; ++n) {
+            seed = seed * 1103515245 + 12345;
+            // no zero bytes, so the filler never forms a start code
+            au[n] = (uint8_t)(seed >> 16) | 1;
+        }
+        uint8_t flags = idr? VIDEO_FRAME_FLAG_IDR | VIDEO_FRAME_FLAG_CONFIG: 0;
+        if (glass_mode) {
+            write_le64(payload, sender_time(glass_start + (int64_t)i * FRAME_US));
+            flags |= VIDEO_FRAME_FLAG_TIMESTAMP;
+        }
+        pos += write_frame(stream + pos, (uint16_t)i, flags, payload, ts + au_size);
+    }
+    free(payload);
+    *len = pos;
+    return stream;
+}
+
+static void write_ppm(const char *path, const uint16_t *fb) {
+    FILE *f = fopen(path, "wb");
+    if (!f) {
+        perror(path);
+        return;
+    }
+    fprintf(f, "P6\n%d %d\n255\n", BOARD_LCD_H_RES, BOARD_LCD_V_RES);
+    for(uint32_t i = 0; i != BOARD_LCD_H_RES * BOARD_LCD_V_RES; ++i) {
+        uint16_t p = fb[i];
+        uint8_t rgb[3] = {(uint8_t)((p >> 11) << 3), (uint8_t)(((p >> 5) & 63) << 2), (uint8_t)((p & 31) << 3)};
+        fwrite(rgb, 1, 3, f);
+    }
+    fclose(f);
+}
+
+static int64_t replay_arrival(uint32_t offset) {
+    while(arrivals_head - arrivals_tail > 1 && (int32_t)(arrivals[(arrivals_tail + 1) % ARRIVALS].start - offset) < 0)
+        ++arrivals_tail;
+    return arrivals_tail != arrivals_head && (int32_t)(arrivals[arrivals_tail % ARRIVALS].start - offset) < 0?
+        arrivals[arrivals_tail % ARRIVALS].time: 0;
+}
+
+static uint32_t replay_backlog(void) {
+    return ring_used(&ring);
+}
+
+// transport sink, the part video_write() does on the device
+static void replay_ingest(const uint8_t *buffer, uint32_t len) {
+    int64_t t = pipeline_begin();
+    uint32_t offset = ring.head;
+    if (ring_write(&ring, buffer, len)) {
+        if (arrivals_head - arrivals_tail != ARRIVALS) {
+            arrivals[arrivals_head % ARRIVALS].start = offset;
+            arrivals[arrivals_head % ARRIVALS].time = t;
+            ++arrivals_head;
+        }
+        // the writes that wake the decode task early on the device
+        completing_writes += video_frame_track(&tracker, buffer, len);
+    }
+    ++ingest_writes;
+    pipeline_end(PIPELINE_INGEST, t);
+    bytes_written += len;
+}
+
+static void replay_write(const uint8_t *buffer, uint32_t len) {
+    transport_write(transport, buffer, len);
+
+    const uint8_t *data;
+    uint32_t n;
+    while((n = ring_peek(&ring, &data)) != 0) {
+        video_decode(data, n);
+        ring_consume(&ring, n);
+    }
+}
+
+static void replay_record(void *ctx, uint32_t delta_us, const uint8_t *data, uint32_t len) {
+    replay_write(data, len);
+}
+
+static struct video_packet parse_pkt;
+static uint64_t parse_bytes;
+
+static void parse_feed(const uint8_t *data, uint32_t len) {
+    parse_bytes += len;
+    for(uint32_t done = 0; done < len; ) {
+        done += video_packet_process(&parse_pkt, data + done, len - done);
+        if (video_packet_finished(&parse_pkt))
+            video_packet_free(&parse_pkt);
+    }
+}
+
+static void parse_record(void *ctx, uint32_t delta_us, const uint8_t *data, uint32_t len) {
+    parse_feed(data, len);
+}
+
+// Producer side cost of every write: the ring copy video_write() always does, and the frame
+// tracking that closes batches on completed packets, each alone over the whole stream.
+#define INGEST_COST_PASSES 20
+
+static struct ring cost_ring;
+static struct video_frame_tracker cost_tracker;
+static uint32_t cost_writes, cost_completing;
+
+static void cost_copy(const uint8_t *data, uint32_t len) {
+    ++cost_writes;
+    ring_write(&cost_ring, data, len);
+    ring_consume(&cost_ring, ring_used(&cost_ring));
+}
+
+static void cost_track(const uint8_t *data, uint32_t len) {
+    ++cost_writes;
+    cost_completing += video_frame_track(&cost_tracker, data, len);
+}
+
+static void cost_copy_record(void *ctx, uint32_t delta_us, const uint8_t *data, uint32_t len) {
+    cost_copy(data, len);
+}
+
+static void cost_track_record(void *ctx, uint32_t delta_us, const uint8_t *data, uint32_t len) {
+    cost_track(data, len);
+}
+
+// ns per write of one of the above
+static double ingest_cost(const uint8_t *stream, uint32_t len, uint32_t chunk, bool capture, bool track) {
+    cost_writes = 0;
+    int64_t start = platform_time_us();
+    for(uint32_t pass = 0; pass != INGEST_COST_PASSES; ++pass) {
+        if (capture) {
+            capture_parse(stream, len, track? cost_track_record: cost_copy_record, NULL);
+            continue;
+        }
+        for(uint32_t pos = 0; pos < len; pos += chunk)
+            (track? cost_track: cost_copy)(stream + pos, len - pos < chunk? len - pos: chunk);
+    }
+    int64_t elapsed = platform_time_us() - start;
+    return cost_writes? elapsed * 1000.0 / cost_writes: 0.0;
+}
+
+// -p: framing and CRC checks alone, writes straight into the parser without ring or decoder
+static int parse_only(const uint8_t *stream, uint32_t len, uint32_t chunk, uint32_t loops, bool capture) {
+    struct packet_pool pool;
+    uint8_t *pool_data = platform_alloc(CONFIG_MOTOCAST_MAX_AU_SIZE * CONFIG_MOTOCAST_PACKET_POOL_SIZE, PLATFORM_MEM_EXTERNAL);
+    if (!pool_data)
+        abort();
+    packet_pool_init(&pool, pool_data, CONFIG_MOTOCAST_MAX_AU_SIZE, CONFIG_MOTOCAST_PACKET_POOL_SIZE);
+    video_packet_init(&parse_pkt, &pool);
+
+    int64_t start = platform_time_us();
+    for(uint32_t loop = 0; loop != loops; ++loop) {
+        if (capture) {
+            capture_parse(stream, len, parse_record, NULL);
+            continue;
+        }
+        for(uint32_t pos = 0; pos < len; pos += chunk)
+            parse_feed(stream + pos, len - pos < chunk? len - pos: chunk);
+    }
+    int64_t elapsed = platform_time_us() - start;
+
+    const struct video_packet_stats *stats = &parse_pkt.stats;
+    PLATFORM_LOGI(TAG, "parse only: %llu bytes in %.3f ms, %.1f MB/s, %.2f us per write",
+        (unsigned long long)parse_bytes, elapsed / 1000.0, elapsed? (double)parse_bytes / elapsed: 0.0,
+        parse_bytes? elapsed * (double)chunk / parse_bytes: 0.0);
+    PLATFORM_LOGI(TAG, "parse only: %lu frames, %lu lost, %lu corrupt, %lu bad headers, in-place %lu/%lu",
+        (unsigned long)stats->frames, (unsigned long)stats->lost, (unsigned long)stats->corrupt,
+        (unsigned long)stats->bad_headers, (unsigned long)stats->fast_path,
+        (unsigned long)(stats->fast_path + stats->slow_path));
+
+    uint8_t *ring_data = platform_alloc(CONFIG_MOTOCAST_RING_SIZE, PLATFORM_MEM_INTERNAL);
+    if (!ring_data)
+        abort();
+    ring_init(&cost_ring, ring_data, CONFIG_MOTOCAST_RING_SIZE);
+    video_frame_tracker_init(&cost_tracker, CONFIG_MOTOCAST_MAX_AU_SIZE);
+    double copy_ns = ingest_cost(stream, len, chunk, capture, false);
+    double track_ns = ingest_cost(stream, len, chunk, capture, true);
+    PLATFORM_LOGI(TAG, "ingest: ring copy %.1f ns per write, frame tracking %.1f ns per write (+%.1f%%), "
+        "%.1f%% of writes complete a packet", copy_ns, track_ns, copy_ns? track_ns * 100.0 / copy_ns: 0.0,
+        cost_writes? cost_completing * 100.0 / cost_writes: 0.0);
+    platform_free(ring_data);
+    return stats->frames? 0: 1;
+}
+
+// one way BLE delay: one to four 7.5 ms connection intervals and up to 2 ms in the stacks
+static uint32_t glass_delay(void) {
+    glass_seed = glass_seed * 1103515245 + 12345;
+    return 7500 * (1 + (glass_seed >> 16) % 4) + (glass_seed >> 4) % 2000;
+}
+
+// checks the echoes as the sender would read them
+static void glass_collect(void) {
+    uint8_t msg[512];
+    uint32_t len;
+    while((len = glass_echo(msg, sizeof(msg))) != 0) {
+        // the offset holds at the last scan-out of the echo
+        int64_t offset = (int64_t)read_le64(msg + 4);
+        int64_t flipped = (int64_t)read_le64(msg + GLASS_ECHO_HEADER_SIZE + (msg[1] - 1) * GLASS_ECHO_SIZE + 20);
+        int64_t error = llabs(offset - (sender_time(flipped) - flipped));
+        for(uint32_t i = 0; i != msg[1]; ++i) {
+            int64_t captured = (int64_t)read_le64(msg + GLASS_ECHO_HEADER_SIZE + i * GLASS_ECHO_SIZE + 4);
+            ++glass_echoes;
+            if (!msg[2] || sender_to_local(captured) - glass_start < GLASS_SETTLE_US)
+                continue;
+            ++glass_synced;
+            glass_total_error += error;
+            if (error > glass_max_error)
+                glass_max_error = error;
+        }
+    }
+}
+
+// moves the clock to the arrival of the frame, answers a ping once a second
+static void glass_step(uint32_t frame) {
+    platform_host_advance_time(glass_start + (int64_t)frame * FRAME_US + TRANSIT_US);
+    int64_t now = platform_time_us();
+    if (now < next_ping)
+        return;
+    next_ping = now + 1000000;
+
+    uint8_t ping[GLASS_PING_SIZE], pong[GLASS_PONG_SIZE] = {GLASS_PONG};
+    glass_ping(ping, now);
+    uint32_t up = glass_delay(), down = glass_delay();
+    int64_t received = sender_time(now + up);
+    memcpy(pong + 4, ping + 4, 8);
+    write_le64(pong + 12, received);
+    write_le64(pong + 20, received + 300);
+    glass_receive(pong, sizeof(pong), now + up + 300 + down);
+    glass_collect();
+}
+
+// scaler for the visible part of the last picture
+static int check_scaler_init(struct scaler *scaler, uint32_t width, uint32_t height, enum scaler_filter filter,
+    enum scaler_fit fit) {
+    uint32_t x, y, w, h;
+    h264_stub_last_crop(&x, &y, &w, &h);
+    return scaler_init(scaler, w, h, BOARD_LCD_H_RES, BOARD_LCD_V_RES, filter, fit) &&
+        scaler_set_crop(scaler, width, height, x, y);
+}
+
+// the output of a full conversion of the last picture, which partial updates have to add up to
+static bool check_last_frame(void) {
+    static struct scaler scaler;
+    static uint16_t fb[BOARD_LCD_H_RES * BOARD_LCD_V_RES];
+#if CONFIG_MOTOCAST_SCALE_NEAREST
+    const enum scaler_filter filter = SCALER_NEAREST;
+#elif CONFIG_MOTOCAST_SCALE_BILINEAR
+    const enum scaler_filter filter = SCALER_BILINEAR;
+#else
+    const enum scaler_filter filter = SCALER_INTEGER;
+#endif
+#if CONFIG_MOTOCAST_SCALE_FILL
+    const enum scaler_fit fit = SCALER_FILL;
+#else
+    const enum scaler_fit fit = SCALER_LETTERBOX;
+#endif
+    uint32_t width, height;
+    const uint8_t *picture = h264_stub_last_picture(&width, &height);
+    const uint16_t *shown = display_host_last_frame();
+    if (!picture || !shown || !check_scaler_init(&scaler, width, height, filter, fit))
+        return true;
+    memset(fb, 0, sizeof(fb));
+    scaler_run(&scaler, picture, fb, BOARD_LCD_H_RES);
+    for(uint32_t i = 0; i != BOARD_LCD_H_RES * BOARD_LCD_V_RES; ++i) {
+        if (fb[i] != shown[i]) {
+            PLATFORM_LOGE(TAG, "last frame differs from a full conversion at %lu,%lu",
+                (unsigned long)(i % BOARD_LCD_H_RES), (unsigned long)(i / BOARD_LCD_H_RES));
+            return false;
+        }
+    }
+    return true;
+}
+
+static bool is_capture(const uint8_t *data, uint32_t len) {
+    return len >= CAPTURE_HEADER_SIZE && !memcmp(data, CAPTURE_MAGIC, 4) && data[4] == CAPTURE_VERSION;
+}
+
+int main(int argc, char **argv) {
+    uint32_t chunk = 244, width = 320, height = 240, frames = 0, au_size = 4000, loops = 1;
+    const char *ppm = NULL;
+    bool parse = false;
+    int opt;
+    while((opt = getopt(argc, argv, "c:ls:g:b:n:o:k:m:p")) != -1) {
+        switch(opt) {
+        case 'c': chunk = strtoul(optarg, NULL, 0); break;
+        case 'l': transport = TRANSPORT_GATT_LONG; break;
+        case 's':
+            if (sscanf(optarg, "%ux%u", &width, &height) != 2)
+                usage(argv[0]);
+            break;
+        case 'g': frames = strtoul(optarg, NULL, 0); break;
+        case 'b': au_size = strtoul(optarg, NULL, 0); break;
+        case 'n': loops = strtoul(optarg, NULL, 0); break;
+        case 'o': ppm = optarg; break;
+        case 'k':
+            glass_mode = true;
+            skew_ppm = strtol(optarg, NULL, 0);
+            break;
+        case 'p': parse = true; break;
+        case 'm':
+            vui_matrix = !strncmp(optarg, "601", 3)? H264_MATRIX_SMPTE170M: !strncmp(optarg, "709", 3)? H264_MATRIX_BT709: 0;
+            vui_full_range = optarg[3] == 'f';
+            if (!vui_matrix)
+                usage(argv[0]);
+            break;
+        default: usage(argv[0]);
+        }
+    }
+    if (!chunk || (!frames && optind != argc - 1) || (glass_mode && !frames))
+        usage(argv[0]);
+    if (glass_mode && (abs(skew_ppm) > TIMESYNC_MAX_DRIFT_PPB / 1000 || frames < GLASS_MIN_FRAMES)) {
+        fprintf(stderr, "-k needs a skew within +-%d ppm and -g %u or more frames to check the settled clock estimate\n",
+            TIMESYNC_MAX_DRIFT_PPB / 1000, GLASS_MIN_FRAMES);
+        return 1;
+    }
+
+    uint32_t stream_len;
+    glass_start = platform_time_us();
+    uint8_t *stream = frames? generate_stream(frames, au_size, width, height, &stream_len): read_file(argv[optind], &stream_len);
+    h264_stub_set_size(width, height);
+    if (!frames && !is_capture(stream, stream_len)) {
+        uint32_t decoded = decode_capture_log(stream, stream_len);
+        if (is_capture(stream, decoded))
+            stream_len = decoded;
+    }
+    bool capture = !frames && is_capture(stream, stream_len);
+    if (parse)
+        return parse_only(stream, stream_len, chunk, loops, capture);
+    // an executed long write carries at most one attribute value
+    if (transport == TRANSPORT_GATT_LONG && chunk > TRANSPORT_LONG_WRITE_MAX) {
+        PLATFORM_LOGI(TAG, "-c %lu is larger than a long write, writing %d bytes per round",
+            (unsigned long)chunk, TRANSPORT_LONG_WRITE_MAX);
+        chunk = TRANSPORT_LONG_WRITE_MAX;
+    }
+    // the ring takes a write whole or drops it
+    if (chunk > CONFIG_MOTOCAST_RING_SIZE) {
+        PLATFORM_LOGI(TAG, "-c %lu is larger than the ingest ring, writing %d bytes at a time",
+            (unsigned long)chunk, CONFIG_MOTOCAST_RING_SIZE);
+        chunk = CONFIG_MOTOCAST_RING_SIZE;
+    }
+
+    uint32_t allocs_start = platform_alloc_count();
+    display_init();
+    struct packet_pool pool;
+    uint8_t *ring_data = platform_alloc(CONFIG_MOTOCAST_RING_SIZE, PLATFORM_MEM_INTERNAL);
+    uint8_t *pool_data = platform_alloc(CONFIG_MOTOCAST_MAX_AU_SIZE * CONFIG_MOTOCAST_PACKET_POOL_SIZE, PLATFORM_MEM_EXTERNAL);
+    if (!ring_data || !pool_data)
+        abort();
+    ring_init(&ring, ring_data, CONFIG_MOTOCAST_RING_SIZE);
+    packet_pool_init(&pool, pool_data, CONFIG_MOTOCAST_MAX_AU_SIZE, CONFIG_MOTOCAST_PACKET_POOL_SIZE);
+    video_stream_init(&pool, replay_arrival, replay_backlog);
+    video_frame_tracker_init(&tracker, CONFIG_MOTOCAST_MAX_AU_SIZE);
+    transport_init(replay_ingest);
+    uint32_t allocs_replay = platform_alloc_count();
+
+    int64_t start = platform_time_us();
+    for(uint32_t loop = 0; loop != loops; ++loop) {
+        if (capture) {
+            if (!capture_parse(stream, stream_len, replay_record, NULL))
+                PLATFORM_LOGE(TAG, "capture is truncated");
+            continue;
+        }
+        for(uint32_t pos = 0; pos < stream_len; pos += chunk) {
+            if (glass_mode)
+                glass_step(loop * frames + pos / (stream_len / frames));
+            replay_write(stream + pos, stream_len - pos < chunk? stream_len - pos: chunk);
+        }
+    }
+    int64_t elapsed = platform_time_us() - start;
+    uint32_t allocs_end = platform_alloc_count();
+
+    struct video_stats stats = {};
+    video_stream_get_stats(&stats);
+    struct display_stats display;
+    display_get_stats(&display);
+
+    PLATFORM_LOGI(TAG, "%llu bytes in %.3f ms, %lu frames presented, %.1f frames/s, %.1f MB/s",
+        (unsigned long long)bytes_written, elapsed / 1000.0, (unsigned long)display.presented,
+        elapsed? display.presented * 1e6 / elapsed: 0.0, elapsed? (double)bytes_written / elapsed: 0.0);
+    PLATFORM_LOGI(TAG, "catching up: %lu pictures dropped, %lu not shown",
+        (unsigned long)stats.late_dropped, (unsigned long)stats.late_skipped);
+    PLATFORM_LOGI(TAG, "decoder: %lu pictures, %lu errors, %lu keyframes, keyframe wanted: %s",
+        (unsigned long)stats.pictures, (unsigned long)stats.decode_errors, (unsigned long)stats.keyframes,
+        stats.keyframe_reason? "yes": "no");
+    PLATFORM_LOGI(TAG, "stream %lux%lu, packets: %lu ok, %lu lost, %lu corrupt, %lu rejected, in-place %lu/%lu",
+        (unsigned long)stats.width, (unsigned long)stats.height,
+        (unsigned long)stats.packets.frames, (unsigned long)stats.packets.lost,
+        (unsigned long)stats.packets.corrupt, (unsigned long)stats.packets.rejected,
+        (unsigned long)stats.packets.fast_path,
+        (unsigned long)(stats.packets.fast_path + stats.packets.slow_path));
+    PLATFORM_LOGI(TAG, "ingest: %lu writes, %lu complete a packet",
+        (unsigned long)ingest_writes, (unsigned long)completing_writes);
+    for(unsigned i = 0; i != PIPELINE_STAGE_COUNT; ++i) {
+        uint32_t count = pipeline_stages[i].count;
+        PLATFORM_LOGI(TAG, "%-8s %9.3f ms total, %8lu calls, avg %7.2f us", stage_names[i],
+            pipeline_stages[i].busy_us / 1000.0, (unsigned long)count,
+            count? (double)pipeline_stages[i].busy_us / count: 0.0);
+    }
+    for(unsigned i = 0; i != TRANSPORT_COUNT; ++i) {
+        struct transport_stats t;
+        transport_get_stats(i, &t);
+        if (t.writes)
+            PLATFORM_LOGI(TAG, "%-9s %8lu writes, avg %5lu bytes, %9.3f ms in the sink, avg %5.2f us", transport_names[i],
+                (unsigned long)t.writes, (unsigned long)(t.bytes / t.writes), t.sink_us / 1000.0,
+                (double)t.sink_us / t.writes);
+    }
+    for(unsigned i = 0; i != LATENCY_COUNT; ++i) {
+        uint32_t counts[LATENCY_BUCKETS];
+        latency_take(i, counts);
+        if (latency_percentile(counts, 100))
+            PLATFORM_LOGI(TAG, "%-8s latency p50 < %lu us, p99 < %lu us", latency_names[i],
+                (unsigned long)latency_percentile(counts, 50), (unsigned long)latency_percentile(counts, 99));
+    }
+    uint32_t converted = stats.convert_full + stats.convert_partial;
+    if (converted) {
+        double full_avg = stats.convert_full? (double)stats.convert_full_us / stats.convert_full: 0.0;
+        PLATFORM_LOGI(TAG, "dirty tiles: %.1f%% of pixels skipped, %lu full conversions avg %.1f us, "
+            "%lu partial avg %.1f us, %.1f us saved per frame",
+            stats.pixels_total? 100.0 - stats.pixels_drawn * 100.0 / stats.pixels_total: 0.0,
+            (unsigned long)stats.convert_full, full_avg, (unsigned long)stats.convert_partial,
+            stats.convert_partial? (double)stats.convert_partial_us / stats.convert_partial: 0.0,
+            stats.convert_full? full_avg - (double)(stats.convert_full_us + stats.convert_partial_us) / converted: 0.0);
+        PLATFORM_LOGI(TAG, "slices: %lu of %u rows, %.1f%% on the helper",
+            (unsigned long)stats.convert_slices, SCALER_SLICE_ROWS,
+            stats.convert_slices? stats.convert_helper_slices * 100.0 / stats.convert_slices: 0.0);
+    }
+    PLATFORM_LOGI(TAG, "allocations: %lu during setup, %lu during replay",
+        (unsigned long)(allocs_replay - allocs_start), (unsigned long)(allocs_end - allocs_replay));
+    if (ring.dropped_writes)
+        PLATFORM_LOGE(TAG, "ingest ring full: %lu writes, %lu bytes dropped",
+            (unsigned long)ring.dropped_writes, (unsigned long)ring.dropped_bytes);
+
+    bool glass_ok = true;
+    if (glass_mode) {
+        glass_collect();
+        glass_ok = glass_synced && glass_max_error <= GLASS_TOLERANCE_US;
+        PLATFORM_LOGI(TAG, "glass: %lu echoes, %lu after settling, offset error avg %lld us, max %lld us, %s",
+            (unsigned long)glass_echoes, (unsigned long)glass_synced,
+            glass_synced? (long long)(glass_total_error / glass_synced): 0LL, (long long)glass_max_error,
+            glass_ok? "ok": "FAILED");
+    }
+
+    bool frame_ok = check_last_frame();
+    if (ppm && display_host_last_frame())
+        write_ppm(ppm, display_host_last_frame());
+    return glass_ok && frame_ok? 0: 1;
+}
@@ -0,0 +1,75 @@
+// Scaler benchmark: every filter with letterbox and fill, from the usual stream sizes to the
+// panel, in one run and on the same pictures, so the modes compare directly. Times full
+// conversions with scaler_run(), the cost of an IDR or a refresh without dirty tiles.
+//   scaler_bench [frames]      default 200 per size and mode
+#include "board.h"
+#include "color_convert.h"
+#include "platform.h"
+#include "scaler.h"
+#include <stdlib.h>
+
+static const char *TAG = "bench";
+
+static const char *const filter_names[] = {"nearest", "integer", "bilinear"};
+static const char *const fit_names[] = {"letterbox", "fill"};
+
+static const struct {
+    uint32_t w, h;
+} sizes[] = {
+    {320, 240},
+    {176, 144},
+    {400, 240},
+    {480, 272},
+};
+
+static struct scaler scaler;
+
+// a grey ramp under a hue sweep, like color_convert_benchmark()
+static void fill_picture(uint8_t *yuv, uint32_t w, uint32_t h) {
+    uint8_t *u = yuv + w * h, *v = u + (w / 2) * (h / 2);
+    for(uint32_t y = 0; y != h; ++y)
+        for(uint32_t x = 0; x != w; ++x)
+            yuv[y * w + x] = (x + y) * 255 / (w + h - 2);
+    for(uint32_t y = 0; y != h / 2; ++y) {
+        for(uint32_t x = 0; x != w / 2; ++x) {
+            u[y * (w / 2) + x] = x * 255 / (w / 2 - 1);
+            v[y * (w / 2) + x] = 255 - y * 255 / (h / 2 - 1);
+        }
+    }
+}
+
+int main(int argc, char **argv) {
+    uint32_t frames = argc > 1? strtoul(argv[1], NULL, 0): 200;
+    if (!frames) {
+        fprintf(stderr, "usage: %s [frames]\n", argv[0]);
+        return 1;
+    }
+    color_convert_init();
+    // framebuffers are in PSRAM on the device
+    uint16_t *fb = platform_alloc(BOARD_LCD_H_RES * BOARD_LCD_V_RES * sizeof(uint16_t), PLATFORM_MEM_EXTERNAL);
+    uint8_t *yuv = platform_alloc(SCALER_MAX_WIDTH * BOARD_LCD_V_RES * 3 / 2, PLATFORM_MEM_EXTERNAL);
+    if (!fb || !yuv)
+        return 1;
+
+    PLATFORM_LOGI(TAG, "%lu frames each to %ux%u", (unsigned long)frames, BOARD_LCD_H_RES, BOARD_LCD_V_RES);
+    for(unsigned s = 0; s != sizeof(sizes) / sizeof(sizes[0]); ++s) {
+        fill_picture(yuv, sizes[s].w, sizes[s].h);
+        for(unsigned filter = SCALER_NEAREST; filter <= SCALER_BILINEAR; ++filter) {
+            for(unsigned fit = SCALER_LETTERBOX; fit <= SCALER_FILL; ++fit) {
+                if (!scaler_init(&scaler, sizes[s].w, sizes[s].h, BOARD_LCD_H_RES, BOARD_LCD_V_RES, filter, fit))
+                    continue;
+                scaler_run(&scaler, yuv, fb, BOARD_LCD_H_RES);
+                int64_t start = platform_time_us();
+                for(uint32_t i = 0; i != frames; ++i)
+                    scaler_run(&scaler, yuv, fb, BOARD_LCD_H_RES);
+                int64_t elapsed = platform_time_us() - start;
+                PLATFORM_LOGI(TAG, "%3lux%-3lu %-8s %-9s -> %3lux%-3lu %7.3f ms per frame",
+                    (unsigned long)sizes[s].w, (unsigned long)sizes[s].h, filter_names[filter], fit_names[fit],
+                    (unsigned long)scaler.dst_w, (unsigned long)scaler.dst_h, elapsed / 1000.0 / frames);
+            }
+        }
+    }
+    platform_free(yuv);
+    platform_free(fb);
+    return 0;
+}
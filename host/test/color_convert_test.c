@@ -0,0 +1,140 @@
+// Bit-exactness of the PIE conversion kernel's arithmetic: a lane by lane C model of
+// color_convert.S runs every Y, U, V triple and has to match the BT.601 limited range formula
+// kernel, without any intermediate leaving s16. The model is transcribed from the asm by hand, so
+// this checks the fixed-point scheme, not the instructions: MOTOCAST_COLOR_SELFTEST runs the
+// kernel itself against the formula on the device. The LUT engine is checked against the formula
+// of every matrix as well.
+#include "color_convert.h"
+#include <stdio.h>
+#include <string.h>
+
+static unsigned failures;
+static unsigned long overflows;
+
+#define CHECK(cond, ...) do { \
+    if (!(cond)) { \
+        if (failures++ < 10) { \
+            printf("%s:%d: ", __FILE__, __LINE__); \
+            printf(__VA_ARGS__); \
+            printf("\n"); \
+        } \
+    } \
+} while (0)
+
+// s16 lane results: the saturating ops clamp, ee.vmul keeps the low 16 bits of the shifted
+// product. Either way the kernel relies on never getting there.
+static int lane(int x) {
+    if (x < INT16_MIN || x > INT16_MAX)
+        ++overflows;
+    return x;
+}
+
+static int vadds(int a, int b) {
+    return lane(a + b);
+}
+
+static int vsubs(int a, int b) {
+    return lane(a - b);
+}
+
+// ee.vmul.s16 with ssai sar, arithmetic shift of the 32-bit product
+static int vmul(int a, int b, int sar) {
+    return lane((a * b) >> sar);
+}
+
+static int vmax(int a, int b) {
+    return a > b? a: b;
+}
+
+static int vmin(int a, int b) {
+    return a < b? a: b;
+}
+
+// one pixel through the instruction sequence of i420_to_rgb565_row2_esp32s3
+static uint16_t pie_model(int Y, int U, int V) {
+    // chroma terms of .Lloop
+    int u = vsubs(U, 128);
+    int v = vsubs(V, 128);
+    int t_r = vadds(vmul(v, 153, 0), 128);
+    int t_g = vadds(vadds(vmul(v, 48, 0), vmul(u, -100, 0)), 128);
+    int t_b = vadds(vmul(u, 4, 0), 128);
+    int c_r = v;
+    int c_g = vsubs(0, v);
+    int c_b = vadds(u, u);
+
+    // pixels8
+    int ty = vmax(vsubs(Y, 16), 0);
+    int t42 = vmul(ty, 42, 0);
+    int r = vmul(vadds(t_r, t42), 1, 8);
+    int g = vmul(vadds(t_g, t42), 1, 8);
+    int b = vmul(vadds(t_b, t42), 1, 8);
+    r = vadds(vadds(r, ty), c_r);
+    g = vadds(vadds(g, ty), c_g);
+    b = vadds(vadds(b, ty), c_b);
+    r = vmin(vmax(r, 0), 255);
+    g = vmin(vmax(g, 0), 255);
+    b = vmin(vmax(b, 0), 255);
+    return (r >> 3) * 2048 | (g >> 2) * 32 | (b >> 3);
+}
+
+// Without gamma the LUT engine rounds and dithers where the formula truncates, neither may be a
+// step off from it for any Y, U and V of any matrix. Catches sums outside the tables' range as well.
+static void check_lut(void) {
+#if !CONFIG_MOTOCAST_COLOR_LUT || CONFIG_MOTOCAST_COLOR_GAMMA == 100
+    static uint8_t y[256], u[128], v[128];
+    static uint16_t formula[256], lut[256];
+    for(unsigned i = 0; i != 256; ++i)
+        y[i] = i;
+    for(unsigned m = 0; m != COLOR_MATRIX_COUNT; ++m) {
+        color_convert_set_matrix(m);
+        for(unsigned cu = 0; cu != 256; ++cu) {
+            for(unsigned cv = 0; cv != 256; ++cv) {
+                memset(u, cu, sizeof(u));
+                memset(v, cv, sizeof(v));
+                i420_to_rgb565_formula(m)(y, y, u, v, formula, formula, 256, 0, cu);
+                i420_to_rgb565_row2_lut(y, y, u, v, lut, lut, 256, 0, cu);
+                for(unsigned i = 0; i != 256; ++i) {
+                    int dr = (lut[i] >> 11) - (formula[i] >> 11);
+                    int dg = ((lut[i] >> 5) & 63) - ((formula[i] >> 5) & 63);
+                    int db = (lut[i] & 31) - (formula[i] & 31);
+                    CHECK(dr >= -1 && dr <= 1 && dg >= -1 && dg <= 1 && db >= -1 && db <= 1,
+                        "%s: LUT conversion of %u,%u,%u is %04x, the formula's %04x",
+                        color_matrix_name(m), i, cu, cv, lut[i], formula[i]);
+                }
+            }
+        }
+    }
+#endif
+}
+
+int main(void) {
+    i420_to_rgb565_row2_t formula = i420_to_rgb565_formula(COLOR_BT601_LIMITED);
+    uint8_t y[256];
+    uint16_t ref[256];
+    for(int i = 0; i < 256; i++)
+        y[i] = i;
+
+    // the formula kernel takes one U, V per pixel pair, a row of 2 pixels at a time
+    for(int U = 0; U < 256; U++) {
+        for(int V = 0; V < 256; V++) {
+            uint8_t u = U, v = V;
+            for(int i = 0; i < 256; i += 2)
+                formula(y + i, y + i, &u, &v, ref + i, ref + i, 2, i, 0);
+            for(int Y = 0; Y < 256; Y++) {
+                uint16_t got = pie_model(Y, U, V);
+                CHECK(got == ref[Y], "Y %d U %d V %d: PIE %04x, formula %04x", Y, U, V, got, ref[Y]);
+            }
+        }
+    }
+    CHECK(overflows == 0, "%lu intermediates outside s16", overflows);
+
+    color_convert_init();
+    check_lut();
+
+    if (failures) {
+        printf("%u failures\n", failures);
+        return 1;
+    }
+    printf("all 2^24 Y/U/V triples match, LUT within a step of every matrix\n");
+    return 0;
+}
@@ -0,0 +1,74 @@
+// Dirty tiles: a changed tile is found, one whose change is crafted to keep the FNV hash is not,
+// and a refresh stamps it along with every other tile.
+#include "dirty.h"
+#include <stdio.h>
+#include <string.h>
+
+#define WIDTH   64
+#define HEIGHT  48
+
+static unsigned failures;
+
+#define CHECK(cond, ...) do { \
+    if (!(cond)) { \
+        printf("%s:%d: ", __FILE__, __LINE__); \
+        printf(__VA_ARGS__); \
+        printf("\n"); \
+        ++failures; \
+    } \
+} while (0)
+
+static uint8_t yuv[WIDTH * HEIGHT * 3 / 2];
+static struct dirty_map dirty;
+static struct scaler_span spans[SCALER_MAX_BANDS];
+
+static uint32_t get_le32(const uint8_t *p) {
+    return p[0] | p[1] << 8 | p[2] << 16 | (uint32_t)p[3] << 24;
+}
+
+static void put_le32(uint8_t *p, uint32_t v) {
+    for(unsigned i = 0; i != 4; ++i)
+        p[i] = v >> (i * 8);
+}
+
+// hash state of dirty.c's FNV-1a after the first word of the tile at row, col
+static uint32_t hash_after_first_word(uint32_t row, uint32_t col) {
+    return (2166136261u ^ get_le32(yuv + row * SCALER_TILE * WIDTH + col * SCALER_TILE)) * 16777619u;
+}
+
+int main(void) {
+    for(uint32_t i = 0; i != sizeof(yuv); ++i)
+        yuv[i] = i * 7;
+    CHECK(dirty_init(&dirty, WIDTH, HEIGHT), "dirty_init failed");
+    uint32_t tiles = dirty.cols * dirty.rows;
+    uint32_t first = dirty_update(&dirty, yuv, false);
+    CHECK(dirty_spans(&dirty, 0, spans) == tiles, "first picture not all changed");
+
+    // one changed pixel
+    yuv[1 * SCALER_TILE * WIDTH + 2 * SCALER_TILE + 5] ^= 1;
+    uint32_t second = dirty_update(&dirty, yuv, false);
+    CHECK(dirty_spans(&dirty, first, spans) == 1, "single change not found");
+    CHECK(spans[1].x0 == 2 * SCALER_TILE && spans[1].x1 == 3 * SCALER_TILE, "span %u..%u", spans[1].x0, spans[1].x1);
+
+    // change the first two words of tile 0, 0 so the hash comes out as before
+    uint8_t *tile = yuv;
+    uint32_t before = hash_after_first_word(0, 0), second_word = get_le32(tile + 4);
+    put_le32(tile, get_le32(tile) ^ 0x01010101);
+    uint32_t after = hash_after_first_word(0, 0);
+    put_le32(tile + 4, (before ^ second_word) ^ after);
+    uint32_t third = dirty_update(&dirty, yuv, false);
+    CHECK(dirty_spans(&dirty, second, spans) == 0, "crafted collision was detected, the test lost its point");
+
+    // a refresh stamps every tile, the stale one included
+    uint32_t fourth = dirty_update(&dirty, yuv, true);
+    CHECK(dirty.refreshed == fourth, "refresh serial %u, update %u", dirty.refreshed, fourth);
+    CHECK(dirty_spans(&dirty, third, spans) == tiles, "refresh didn't stamp every tile");
+    CHECK(dirty_update(&dirty, yuv, false) && dirty_spans(&dirty, fourth, spans) == 0, "unchanged picture after refresh");
+
+    if (failures) {
+        printf("%u failures\n", failures);
+        return 1;
+    }
+    printf("dirty tiles found, collisions repaired by refreshes\n");
+    return 0;
+}
@@ -0,0 +1,172 @@
+// SPSC ring: FIFO order, wraparound at the ring size, full and empty boundaries and writes larger
+// than the ring, single-threaded and with a producer and a consumer thread.
+#include "ring.h"
+#include <pthread.h>
+#include <sched.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <string.h>
+
+#define RING_SIZE 64
+
+static unsigned failures;
+
+#define CHECK(cond) do { \
+    if (!(cond)) { \
+        fprintf(stderr, "%s:%d: %s\n", __FILE__, __LINE__, #cond); \
+        ++failures; \
+    } \
+} while(0)
+
+// reads len bytes through peek/consume, in as many contiguous pieces as it takes
+static uint32_t read_bytes(struct ring *ring, uint8_t *dst, uint32_t len) {
+    uint32_t done = 0;
+    while(done < len) {
+        const uint8_t *data;
+        uint32_t n = ring_peek(ring, &data);
+        if (!n)
+            break;
+        if (n > len - done)
+            n = len - done;
+        memcpy(dst + done, data, n);
+        ring_consume(ring, n);
+        done += n;
+    }
+    return done;
+}
+
+static void test_empty(void) {
+    uint8_t data[RING_SIZE];
+    struct ring ring;
+    ring_init(&ring, data, RING_SIZE);
+    const uint8_t *p;
+    CHECK(ring_used(&ring) == 0);
+    CHECK(ring_free(&ring) == RING_SIZE);
+    CHECK(ring_peek(&ring, &p) == 0);
+    CHECK(ring_write(&ring, (const uint8_t *)"", 0));
+    CHECK(ring_used(&ring) == 0);
+}
+
+static void test_full(void) {
+    uint8_t data[RING_SIZE], src[RING_SIZE + 1], dst[RING_SIZE];
+    struct ring ring;
+    ring_init(&ring, data, RING_SIZE);
+    for(unsigned i = 0; i != sizeof(src); ++i)
+        src[i] = i;
+
+    // larger than the ring, rejected even while it's empty
+    CHECK(!ring_write(&ring, src, RING_SIZE + 1));
+    CHECK(ring.dropped_writes == 1 && ring.dropped_bytes == RING_SIZE + 1);
+    CHECK(ring_used(&ring) == 0);
+
+    // exactly full
+    CHECK(ring_write(&ring, src, RING_SIZE - 1));
+    CHECK(ring_write(&ring, src + RING_SIZE - 1, 1));
+    CHECK(ring_used(&ring) == RING_SIZE && ring_free(&ring) == 0);
+    CHECK(ring.high_water == RING_SIZE);
+    CHECK(!ring_write(&ring, src, 1));
+    CHECK(ring.dropped_writes == 2 && ring.dropped_bytes == RING_SIZE + 2);
+
+    // a write one byte too large for the space left goes nowhere
+    CHECK(read_bytes(&ring, dst, 8) == 8);
+    CHECK(!ring_write(&ring, src, 9));
+    CHECK(ring_used(&ring) == RING_SIZE - 8);
+    CHECK(ring_write(&ring, src, 8));
+    CHECK(read_bytes(&ring, dst, RING_SIZE) == RING_SIZE);
+    CHECK(!memcmp(dst, src + 8, RING_SIZE - 8) && !memcmp(dst + RING_SIZE - 8, src, 8));
+    CHECK(ring_used(&ring) == 0 && ring_free(&ring) == RING_SIZE);
+}
+
+// writes of every length from every offset, so each one wraps somewhere
+static void test_wraparound(void) {
+    uint8_t data[RING_SIZE], src[RING_SIZE], dst[RING_SIZE];
+    struct ring ring;
+    ring_init(&ring, data, RING_SIZE);
+    uint8_t next_write = 0, next_read = 0;
+    for(uint32_t round = 0; round != 4 * RING_SIZE; ++round) {
+        uint32_t len = round % RING_SIZE + 1;
+        for(uint32_t i = 0; i != len; ++i)
+            src[i] = next_write++;
+        CHECK(ring_write(&ring, src, len));
+        // the readable region ends at the end of the buffer at the latest
+        const uint8_t *p;
+        uint32_t first = ring_peek(&ring, &p);
+        CHECK(p >= data && p + first <= data + RING_SIZE);
+        CHECK(read_bytes(&ring, dst, len) == len);
+        for(uint32_t i = 0; i != len; ++i)
+            CHECK(dst[i] == next_read++);
+        CHECK(ring_used(&ring) == 0);
+    }
+    CHECK(ring.dropped_writes == 0);
+}
+
+// indices run freely, crossing 2^32 must not matter
+static void test_index_overflow(void) {
+    uint8_t data[RING_SIZE], src[48], dst[48];
+    struct ring ring;
+    ring_init(&ring, data, RING_SIZE);
+    atomic_store(&ring.head, UINT32_MAX - 20);
+    atomic_store(&ring.tail, UINT32_MAX - 20);
+    for(unsigned i = 0; i != sizeof(src); ++i)
+        src[i] = 100 + i;
+    CHECK(ring_write(&ring, src, sizeof(src)));
+    CHECK(ring_used(&ring) == sizeof(src));
+    CHECK(read_bytes(&ring, dst, sizeof(dst)) == sizeof(dst));
+    CHECK(!memcmp(src, dst, sizeof(src)));
+}
+
+#define STREAM_BYTES (1u << 20)
+
+static struct ring shared;
+static uint8_t shared_data[RING_SIZE];
+
+// writes a counting byte stream in chunks of varying length, retrying while the ring is full
+static void *producer(void *arg) {
+    uint8_t chunk[RING_SIZE / 2];
+    uint32_t sent = 0, seed = 1;
+    while(sent < STREAM_BYTES) {
+        seed = seed * 1103515245 + 12345;
+        uint32_t len = (seed >> 16) % sizeof(chunk) + 1;
+        if (len > STREAM_BYTES - sent)
+            len = STREAM_BYTES - sent;
+        for(uint32_t i = 0; i != len; ++i)
+            chunk[i] = (uint8_t)(sent + i);
+        while(!ring_write(&shared, chunk, len))
+            sched_yield();
+        sent += len;
+    }
+    return NULL;
+}
+
+static void test_threads(void) {
+    ring_init(&shared, shared_data, RING_SIZE);
+    pthread_t thread;
+    pthread_create(&thread, NULL, producer, NULL);
+    uint32_t received = 0;
+    bool in_order = true;
+    while(received < STREAM_BYTES) {
+        const uint8_t *p;
+        uint32_t n = ring_peek(&shared, &p);
+        if (!n)
+            sched_yield();
+        for(uint32_t i = 0; i != n; ++i)
+            in_order = in_order && p[i] == (uint8_t)(received + i);
+        ring_consume(&shared, n);
+        received += n;
+    }
+    pthread_join(thread, NULL);
+    CHECK(in_order);
+    CHECK(ring_used(&shared) == 0);
+    CHECK(shared.high_water <= RING_SIZE);
+}
+
+int main(void) {
+    test_empty();
+    test_full();
+    test_wraparound();
+    test_index_overflow();
+    test_threads();
+    if (failures)
+        fprintf(stderr, "ring_test: %u checks failed\n", failures);
+    return failures? 1: 0;
+}
@@ -0,0 +1,82 @@
+// Sliced conversion: every filter and fit, with and without frame cropping, converted slice by
+// slice bottom up with separate line buffers has to match a single run of the whole picture.
+#include "board.h"
+#include "scaler.h"
+#include <stdbool.h>
+#include <stdio.h>
+#include <string.h>
+
+static unsigned failures;
+
+#define CHECK(cond, ...) do { \
+    if (!(cond)) { \
+        printf("%s:%d: ", __FILE__, __LINE__); \
+        printf(__VA_ARGS__); \
+        printf("\n"); \
+        ++failures; \
+    } \
+} while (0)
+
+static const char *const filter_names[] = {"nearest", "integer", "bilinear"};
+static const char *const fit_names[] = {"letterbox", "fill"};
+
+struct picture {
+    uint32_t pic_w, pic_h;      // coded size
+    uint32_t x, y, w, h;        // visible part
+};
+
+static const struct picture pictures[] = {
+    {320, 240, 0, 0, 320, 240},
+    {176, 144, 0, 0, 176, 144},
+    {400, 240, 0, 0, 400, 240},
+    {208, 128, 0, 0, 200, 120},     // SPS cropping of a size that isn't whole macroblocks
+    {336, 256, 8, 6, 320, 240},     // cropped at the top left as well
+};
+
+static uint8_t yuv[800 * 480 * 3 / 2];
+static uint16_t whole[BOARD_LCD_H_RES * BOARD_LCD_V_RES], sliced[BOARD_LCD_H_RES * BOARD_LCD_V_RES];
+static struct scaler scaler;
+static struct scaler_lines lines;
+
+static void fill_picture(uint32_t size) {
+    uint32_t seed = 1;
+    for(uint32_t i = 0; i != size; ++i) {
+        seed = seed * 1103515245 + 12345;
+        yuv[i] = seed >> 16;
+    }
+}
+
+static void test_picture(const struct picture *p) {
+    fill_picture(p->pic_w * p->pic_h * 3 / 2);
+    for(unsigned filter = SCALER_NEAREST; filter <= SCALER_BILINEAR; ++filter) {
+        for(unsigned fit = SCALER_LETTERBOX; fit <= SCALER_FILL; ++fit) {
+            bool init = scaler_init(&scaler, p->w, p->h, BOARD_LCD_H_RES, BOARD_LCD_V_RES, filter, fit) &&
+                scaler_set_crop(&scaler, p->pic_w, p->pic_h, p->x, p->y);
+            CHECK(init, "%ux%u: scaler_init failed", (unsigned)p->w, (unsigned)p->h);
+            if (!init)
+                continue;
+            memset(whole, 0, sizeof(whole));
+            memset(sliced, 0, sizeof(sliced));
+            scaler_run(&scaler, yuv, whole, BOARD_LCD_H_RES);
+            for(uint32_t y1 = scaler.dst_h; y1; ) {
+                uint32_t y0 = (y1 - 1) / SCALER_SLICE_ROWS * SCALER_SLICE_ROWS;
+                scaler_run_slice(&scaler, &lines, yuv, sliced, BOARD_LCD_H_RES, NULL, y0, y1);
+                y1 = y0;
+            }
+            CHECK(!memcmp(whole, sliced, sizeof(whole)), "%ux%u at %u,%u of %ux%u, %s/%s: sliced conversion differs "
+                "from a single run", (unsigned)p->w, (unsigned)p->h, (unsigned)p->x, (unsigned)p->y,
+                (unsigned)p->pic_w, (unsigned)p->pic_h, filter_names[filter], fit_names[fit]);
+        }
+    }
+}
+
+int main(void) {
+    for(unsigned i = 0; i != sizeof(pictures) / sizeof(pictures[0]); ++i)
+        test_picture(&pictures[i]);
+    if (failures) {
+        printf("%u failures\n", failures);
+        return 1;
+    }
+    printf("sliced conversions match\n");
+    return 0;
+}
@@ -0,0 +1,96 @@
+// Clock estimate against a simulated remote clock: a skew sweep across TIMESYNC_MAX_DRIFT_PPB with
+// one exchange a second and random BLE delays, as the glass-to-glass ping/pong sees them. Once a
+// full window of exchanges is in, the offset half way to the next exchange, remote timestamps
+// converted back and the drift have to be within tolerance.
+#include "timesync.h"
+#include <stdio.h>
+#include <stdlib.h>
+
+#define REMOTE_OFFSET   5000000000LL
+#define START_US        123456789LL
+#define PING_US         1000000
+#define EXCHANGES       (TIMESYNC_SAMPLES * 3)
+#define TOLERANCE_US    1000
+// the stack jitter left in the bounds, spread over the window
+#define DRIFT_PPM_MAX   (2000 * 1000000LL / (TIMESYNC_SAMPLES * PING_US))
+
+static unsigned failures;
+
+#define CHECK(cond, ...) do { \
+    if (!(cond)) { \
+        if (failures++ < 10) { \
+            printf("%s:%d: ", __FILE__, __LINE__); \
+            printf(__VA_ARGS__); \
+            printf("\n"); \
+        } \
+    } \
+} while (0)
+
+static uint32_t seed;
+static int32_t skew_ppm;
+
+// one way BLE delay: one to four 7.5 ms connection intervals and up to 2 ms in the stacks
+static uint32_t delay(void) {
+    seed = seed * 1103515245 + 12345;
+    return 7500 * (1 + (seed >> 16) % 4) + (seed >> 4) % 2000;
+}
+
+static int64_t remote_time(int64_t local) {
+    return local + REMOTE_OFFSET + (local - START_US) * skew_ppm / 1000000;
+}
+
+static int64_t remote_to_local(int64_t remote) {
+    return START_US + (int64_t)((remote - REMOTE_OFFSET - START_US) * 1e6 / (1e6 + skew_ppm));
+}
+
+static void run(int32_t ppm, uint32_t run_seed) {
+    struct timesync ts;
+    timesync_init(&ts);
+    skew_ppm = ppm;
+    seed = run_seed;
+
+    int64_t max_error = 0, max_local_error = 0, max_drift_error = 0;
+    for(uint32_t i = 0; i != EXCHANGES; ++i) {
+        int64_t t1 = START_US + (int64_t)i * PING_US;
+        int64_t t2 = remote_time(t1 + delay());
+        int64_t t3 = t2 + 300;
+        int64_t t4 = remote_to_local(t3) + delay();
+        timesync_update(&ts, t1, t2, t3, t4);
+        CHECK(timesync_valid(&ts) == (i + 1 >= TIMESYNC_MIN_SAMPLES), "valid after %u exchanges", i + 1);
+        if (i < TIMESYNC_SAMPLES)
+            continue;
+
+        int64_t now = t4 + PING_US / 2;
+        int64_t error = llabs(timesync_offset(&ts, now) - (remote_time(now) - now));
+        int64_t local_error = llabs(timesync_to_local(&ts, remote_time(now)) - now);
+        int64_t drift_error = llabs((int64_t)ts.drift_ppb - (int64_t)ppm * 1000);
+        if (error > max_error)
+            max_error = error;
+        if (local_error > max_local_error)
+            max_local_error = local_error;
+        if (drift_error > max_drift_error)
+            max_drift_error = drift_error;
+    }
+    CHECK(max_error <= TOLERANCE_US, "%+ld ppm, seed %u: offset off by up to %lld us",
+        (long)ppm, run_seed, (long long)max_error);
+    CHECK(max_local_error <= TOLERANCE_US, "%+ld ppm, seed %u: converted times off by up to %lld us",
+        (long)ppm, run_seed, (long long)max_local_error);
+    CHECK(max_drift_error <= DRIFT_PPM_MAX * 1000, "%+ld ppm, seed %u: drift off by up to %lld ppb",
+        (long)ppm, run_seed, (long long)max_drift_error);
+}
+
+int main(void) {
+    static const int32_t skews[] = {
+        -TIMESYNC_MAX_DRIFT_PPB / 1000, -500, -100, -20, -1, 0, 1, 20, 100, 500, TIMESYNC_MAX_DRIFT_PPB / 1000,
+    };
+    for(uint32_t s = 0; s != sizeof(skews) / sizeof(skews[0]); ++s)
+        for(uint32_t run_seed = 1; run_seed != 5; ++run_seed)
+            run(skews[s], run_seed);
+
+    if (failures) {
+        printf("%u failures\n", failures);
+        return 1;
+    }
+    printf("clock estimate within %d us over the skew sweep\n", TOLERANCE_US);
+    return 0;
+}
@@ -0,0 +1,171 @@
+// Framing parser on hand-built streams: recovery of the frames a corrupted length swallows, in
+// one input and split across inputs, and the sequence number accounting of reordered, repeated and
+// restarted streams.
+#include "crc32.h"
+#include "packet_pool.h"
+#include "video_packet.h"
+#include <stdio.h>
+#include <string.h>
+
+#define BUFFER_SIZE 4096
+#define BUFFERS     4
+
+static unsigned failures;
+
+#define CHECK(cond, ...) do { \
+    if (!(cond)) { \
+        if (failures++ < 10) { \
+            printf("%s:%d: ", __FILE__, __LINE__); \
+            printf(__VA_ARGS__); \
+            printf("\n"); \
+        } \
+    } \
+} while (0)
+
+static uint8_t storage[BUFFER_SIZE * BUFFERS];
+static struct packet_pool pool;
+static struct video_packet pkt;
+static uint8_t stream[16384];
+static uint32_t stream_len;
+
+// seq of each frame delivered
+static uint16_t delivered[64];
+static uint32_t delivered_count;
+
+static void write_le(uint8_t *dst, uint32_t value, unsigned bytes) {
+    for(unsigned i = 0; i != bytes; ++i)
+        dst[i] = value >> (i * 8);
+}
+
+// appends a frame with payload bytes derived from seq, returns its offset in the stream
+static uint32_t add_frame(uint16_t seq, uint8_t flags, uint32_t len) {
+    uint8_t *header = stream + stream_len;
+    header[0] = VIDEO_FRAME_SYNC0;
+    header[1] = VIDEO_FRAME_SYNC1;
+    header[2] = VIDEO_FRAME_VERSION;
+    header[3] = flags;
+    write_le(header + 4, seq, 2);
+    write_le(header + 6, 0, 2);
+    write_le(header + 8, len, 4);
+    uint8_t *payload = header + VIDEO_FRAME_HEADER_SIZE;
+    for(uint32_t i = 0; i != len; ++i)
+        payload[i] = (uint8_t)(seq * 7 + i);
+    // keep sync bytes out of the payload, the corrupted length tests rely on the next header
+    // being the first one
+    for(uint32_t i = 0; i != len; ++i)
+        if (payload[i] == VIDEO_FRAME_SYNC0)
+            payload[i] = 0;
+    uint32_t crc = crc32_update(crc32_update(0, header, VIDEO_FRAME_CRC_OFFSET), payload, len);
+    write_le(header + VIDEO_FRAME_CRC_OFFSET, crc, 4);
+    uint32_t offset = stream_len;
+    stream_len += VIDEO_FRAME_HEADER_SIZE + len;
+    return offset;
+}
+
+static void start(void) {
+    packet_pool_init(&pool, storage, BUFFER_SIZE, BUFFERS);
+    video_packet_init(&pkt, &pool);
+    stream_len = 0;
+    delivered_count = 0;
+}
+
+// runs the stream through the parser in chunk sized inputs
+static void parse(uint32_t chunk) {
+    for(uint32_t offset = 0; offset < stream_len; offset += chunk) {
+        uint32_t len = stream_len - offset < chunk? stream_len - offset: chunk;
+        uint32_t done = 0;
+        while(done < len) {
+            done += video_packet_process(&pkt, stream + offset + done, len - done);
+            if (video_packet_finished(&pkt)) {
+                if (delivered_count != sizeof(delivered) / sizeof(delivered[0]))
+                    delivered[delivered_count++] = pkt.seq;
+                video_packet_free(&pkt);
+            }
+        }
+    }
+}
+
+static int was_delivered(uint16_t seq) {
+    for(uint32_t i = 0; i != delivered_count; ++i)
+        if (delivered[i] == seq)
+            return 1;
+    return 0;
+}
+
+// a length corrupted to cover the following frames, whose headers are found again
+static void check_corrupt_length(uint32_t chunk) {
+    start();
+    add_frame(0, VIDEO_FRAME_FLAG_IDR, 100);
+    uint32_t bad = add_frame(1, 0, 50);
+    add_frame(2, 0, 80);
+    add_frame(3, 0, 120);
+    add_frame(4, 0, 60);
+    add_frame(5, 0, 40);
+    // up to the end of 4's header
+    write_le(stream + bad + 8, 50 + 3 * VIDEO_FRAME_HEADER_SIZE + 200, 4);
+    parse(chunk);
+    CHECK(pkt.stats.corrupt == 1, "chunk %u: %u corrupt", chunk, pkt.stats.corrupt);
+    CHECK(!was_delivered(1), "chunk %u: corrupted frame delivered", chunk);
+    CHECK(pkt.stats.frames == delivered_count, "chunk %u: %u frames, %u delivered", chunk, pkt.stats.frames,
+        delivered_count);
+    if (chunk >= stream_len) {
+        // all of it in one input: nothing but the bad frame is lost
+        CHECK(delivered_count == 5, "chunk %u: %u frames delivered", chunk, delivered_count);
+        CHECK(pkt.stats.lost == 1, "chunk %u: %u lost", chunk, pkt.stats.lost);
+    }
+    CHECK(was_delivered(5), "chunk %u: frame after the corrupted span not delivered", chunk);
+    CHECK(pool.in_use == 0, "chunk %u: %u buffers still in use", chunk, pool.in_use);
+}
+
+static void check_sequence(void) {
+    // 2 arrives after 3: one frame lost, not 65535, and the late one is dropped
+    start();
+    add_frame(0, VIDEO_FRAME_FLAG_IDR, 20);
+    add_frame(1, 0, 20);
+    add_frame(3, 0, 20);
+    add_frame(2, 0, 20);
+    add_frame(4, 0, 20);
+    parse(stream_len);
+    CHECK(pkt.stats.lost == 1, "reorder: %u lost", pkt.stats.lost);
+    CHECK(pkt.stats.duplicate == 1, "reorder: %u duplicates", pkt.stats.duplicate);
+    CHECK(!was_delivered(2), "reorder: late frame delivered");
+
+    // repeats of any older frame are dropped, not only of the previous one
+    start();
+    for(uint16_t seq = 0; seq != 5; ++seq)
+        add_frame(seq, seq? 0: VIDEO_FRAME_FLAG_IDR, 20);
+    add_frame(4, 0, 20);
+    add_frame(1, 0, 20);
+    add_frame(5, 0, 20);
+    parse(stream_len);
+    CHECK(pkt.stats.frames == 6, "repeat: %u frames", pkt.stats.frames);
+    CHECK(pkt.stats.duplicate == 2, "repeat: %u duplicates", pkt.stats.duplicate);
+    CHECK(pkt.stats.lost == 0, "repeat: %u lost", pkt.stats.lost);
+
+    // wrap around and a restarted sender, which begins with an IDR
+    start();
+    add_frame(65534, VIDEO_FRAME_FLAG_IDR, 20);
+    add_frame(65535, 0, 20);
+    add_frame(0, 0, 20);
+    add_frame(2, 0, 20);
+    add_frame(0, VIDEO_FRAME_FLAG_IDR, 20);
+    add_frame(1, 0, 20);
+    parse(stream_len);
+    CHECK(pkt.stats.frames == 6, "restart: %u frames", pkt.stats.frames);
+    CHECK(pkt.stats.lost == 1, "restart: %u lost", pkt.stats.lost);
+    CHECK(pkt.stats.duplicate == 0, "restart: %u duplicates", pkt.stats.duplicate);
+}
+
+int main(void) {
+    static const uint32_t chunks[] = {1, 7, 20, 64, 182, 512, sizeof(stream)};
+    for(uint32_t i = 0; i != sizeof(chunks) / sizeof(chunks[0]); ++i)
+        check_corrupt_length(chunks[i]);
+    check_sequence();
+
+    if (failures) {
+        printf("%u failures\n", failures);
+        return 1;
+    }
+    printf("framing recovers from corrupted lengths, sequence numbers accounted\n");
+    return 0;
+}
@@ -0,0 +1,25 @@
+#pragma once
+
+#include "sdkconfig.h"
+
+#define BOARD_LCD_H_RES     800
+#define BOARD_LCD_V_RES     480
+#define BOARD_LCD_PCLK_HZ   16000000
+#define BOARD_LCD_H_BLANK   (4 + 8 + 8)         // hsync pulse, back and front porch in pixel clocks
+#define BOARD_LCD_BOUNCE_ROWS 16                // panel rows per bounce buffer
+
+#if CONFIG_MOTOCAST_PRESENT_TRIPLE
+#define BOARD_LCD_NUM_FBS   3
+#else
+#define BOARD_LCD_NUM_FBS   2
+#endif
+
+#ifdef ESP_PLATFORM
+
+#include "esp_lcd_panel_ops.h"
+
+extern esp_lcd_panel_handle_t panel_handle;
+
+void waveshare_init(void);
+
+#endif
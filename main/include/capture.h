@@ -0,0 +1,55 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stdint.h>
+
+// Flight recorder for the BLE byte stream: every write is kept with its length and the time since
+// the previous one, the oldest writes are dropped when the buffer is full. Records never wrap
+// around the end of the buffer, so each one can be handed out in place.
+//
+// Serialised format, all fields little-endian:
+//   0  magic 'M' 'C' 'A' 'P'
+//   4  version
+//   5  reserved, 3 bytes
+//   8  record count, u32
+// followed by the records:
+//   0  time since the previous write in microseconds, u32
+//   4  length, u16
+//   6  data
+#define CAPTURE_MAGIC           "MCAP"
+#define CAPTURE_VERSION         1
+#define CAPTURE_HEADER_SIZE     12
+#define CAPTURE_RECORD_HEADER   6
+
+struct capture {
+    uint8_t *data;
+    uint32_t size;
+    uint32_t head;          // next record is written here
+    uint32_t tail;          // oldest record
+    uint32_t records;
+    uint32_t bytes;         // payload bytes in the buffer
+    uint32_t evicted;       // records dropped to make room
+    int64_t last_time;
+};
+
+void capture_init(struct capture *c, uint8_t *data, uint32_t size);
+
+void capture_clear(struct capture *c);
+
+void capture_record(struct capture *c, int64_t time_us, const uint8_t *data, uint32_t len);
+
+typedef void (*capture_record_fn)(void *ctx, uint32_t delta_us, const uint8_t *data, uint32_t len);
+
+// calls fn for every record, oldest first
+void capture_for_each(const struct capture *c, capture_record_fn fn, void *ctx);
+
+// size of the serialised capture
+uint32_t capture_serialised_size(const struct capture *c);
+
+typedef bool (*capture_write_fn)(void *ctx, const void *data, uint32_t len);
+
+// writes the serialised capture through fn, stops at the first failing write
+bool capture_serialise(const struct capture *c, capture_write_fn fn, void *ctx);
+
+// calls fn for every record of a serialised capture, returns false if it's malformed
+bool capture_parse(const uint8_t *data, uint32_t len, capture_record_fn fn, void *ctx);
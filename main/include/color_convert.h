@@ -0,0 +1,69 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stdint.h>
+#include "sdkconfig.h"
+
+// YUV -> RGB matrices, by the standard and the range of the YUV values
+enum color_matrix {
+    COLOR_BT601_LIMITED,    // SD video, what streams without a colour description get
+    COLOR_BT601_FULL,
+    COLOR_BT709_LIMITED,    // HD video
+    COLOR_BT709_FULL,
+    COLOR_MATRIX_COUNT,
+};
+
+// Converts two picture rows sharing one I420 chroma row to RGB565.
+// y1/dst1 may alias y0/dst0 for the last row of an odd-height picture. x, y is the picture
+// position of y0[0], only the LUT engine's ordered dither looks at it.
+typedef void (*i420_to_rgb565_row2_t)(const uint8_t *y0, const uint8_t *y1, const uint8_t *u, const uint8_t *v,
+    uint16_t *dst0, uint16_t *dst1, uint32_t width, uint32_t x, uint32_t y);
+
+// Fixed-point formula of the given matrix, truncated to RGB565. One kernel per matrix with the
+// coefficients compiled in.
+i420_to_rgb565_row2_t i420_to_rgb565_formula(enum color_matrix matrix);
+
+// Table-driven version for the current matrix: contributions of Y, U and V are looked up and
+// summed per channel, the sum indexes a table which clamps, applies the panel gamma and quantises
+// with a 4x4 ordered dither. Needs color_convert_init().
+void i420_to_rgb565_row2_lut(const uint8_t *y0, const uint8_t *y1, const uint8_t *u, const uint8_t *v,
+    uint16_t *dst0, uint16_t *dst1, uint32_t width, uint32_t x, uint32_t y);
+
+#ifdef HAVE_ESP32S3
+
+// PIE version of the BT.601 limited range formula, 16 pixels per iteration.
+// Requires width % 16 == 0, y/dst 16-byte aligned and u/v 8-byte aligned.
+void i420_to_rgb565_row2_esp32s3(const uint8_t *y0, const uint8_t *y1, const uint8_t *u, const uint8_t *v,
+    uint16_t *dst0, uint16_t *dst1, uint32_t width, uint32_t x, uint32_t y);
+
+#endif
+
+// builds the LUT engine's tables for the configured matrix, BT.601 limited range with
+// MOTOCAST_COLOR_MATRIX_AUTO until color_convert_set_matrix()
+void color_convert_init(void);
+
+// Switches the matrix of every kernel picked from now on, and of the LUT engine right away. Call
+// between conversions, a scan-out refill running meanwhile may mix both matrices for one frame.
+void color_convert_set_matrix(enum color_matrix matrix);
+enum color_matrix color_convert_matrix(void);
+const char *color_matrix_name(enum color_matrix matrix);
+
+// plain C kernel of the configured conversion, for interrupts which don't save the PIE registers
+i420_to_rgb565_row2_t i420_to_rgb565_portable_kernel(void);
+
+// Picks the fastest row kernel of the configured conversion the picture and destination layout
+// allow.
+i420_to_rgb565_row2_t i420_to_rgb565_kernel(const uint8_t *yuv, uint32_t width, uint32_t height,
+    const uint16_t *dst, uint32_t dst_stride);
+
+// Converts a whole I420 picture, picking the fastest kernel the buffers allow.
+// dst_stride is in pixels.
+void i420_to_rgb565(const uint8_t *yuv, uint32_t width, uint32_t height, uint16_t *dst, uint32_t dst_stride);
+
+// logs the time per pixel of every row kernel on a synthetic gradient
+void color_convert_benchmark(void);
+
+// Converts a test picture of every U, V pair under Y ramps with the SIMD kernel and the plain C
+// formula, on the device. A kernel whose output differs anywhere is logged and not used from then
+// on. Returns false if any did, true on targets without one.
+bool color_convert_selftest(void);
@@ -0,0 +1,51 @@
+#pragma once
+
+#include <stdint.h>
+#include "video.h"
+
+// Back-channel to the sender, notifications on the control characteristic. All fields are
+// little-endian, byte 0 is the type:
+//   CONTROL_CREDIT, whenever the ring state changed
+//      1  flags, CONTROL_FLAG_*
+//      2  free packet buffers
+//      3  reserved
+//      4  bytes accepted into the ingest ring so far, u32, wrapping
+//      8  credit limit: accepted bytes can grow up to this before writes get dropped, u32, wrapping
+//      12 bytes queued for decoding, u32
+//   CONTROL_KEYFRAME, repeated every CONTROL_KEYFRAME_INTERVAL until an IDR access unit arrives
+//      1  reason, enum video_keyframe_reason
+//      2  sequence number of the last good access unit, u16
+//   CONTROL_BITRATE, every CONTROL_BITRATE_INTERVAL while video arrives
+//      1  reserved, 3 bytes
+//      4  suggested bitrate in bit/s, u32
+//      8  measured bitrate in bit/s, u32
+//      12 decode and conversion time per picture in us, u32
+//      16 decode task load in permille, u16
+//      18 pictures decoded per second, u16
+#define CONTROL_CREDIT              1
+#define CONTROL_KEYFRAME            2
+#define CONTROL_BITRATE             3
+
+#define CONTROL_FLAG_BEHIND         (1 << 0)    // dropping pictures to catch up
+
+#define CONTROL_CREDIT_SIZE         16
+#define CONTROL_KEYFRAME_SIZE       4
+#define CONTROL_BITRATE_SIZE        20
+#define CONTROL_MAX_SIZE            CONTROL_BITRATE_SIZE
+
+#define CONTROL_KEYFRAME_INTERVAL   500000
+#define CONTROL_BITRATE_INTERVAL    1000000
+
+// Bitrate hints keep the decode task's load between these, in permille
+#define CONTROL_LOAD_LOW            600
+#define CONTROL_LOAD_TARGET         750
+#define CONTROL_LOAD_HIGH           850
+
+// Each returns the size of the message written to dst, or 0 if none is due at time now.
+// Calls must not overlap.
+uint32_t control_credit(uint8_t dst[CONTROL_MAX_SIZE], const struct video_stats *stats);
+uint32_t control_keyframe(uint8_t dst[CONTROL_MAX_SIZE], const struct video_stats *stats, int64_t now);
+uint32_t control_bitrate(uint8_t dst[CONTROL_MAX_SIZE], const struct video_stats *stats, int64_t now);
+
+// starts over for a new connection
+void control_reset(void);
@@ -0,0 +1,6 @@
+#pragma once
+
+#include <stdint.h>
+
+// CRC-32 (IEEE 802.3, reflected), chainable: start with 0 and pass the previous result.
+uint32_t crc32_update(uint32_t crc, const uint8_t *data, uint32_t len);
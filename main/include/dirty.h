@@ -0,0 +1,32 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stdint.h>
+#include "scaler.h"
+
+// Tracks which SCALER_TILE x SCALER_TILE tiles of an I420 picture changed, from a hash of each tile
+// (luma and both chroma planes) compared with the previous picture's. Every update gets a serial
+// number and changed tiles are stamped with it, so a framebuffer last drawn from picture n only
+// needs the tiles stamped after n redrawn, however many pictures it missed. A change can leave the
+// hash as it was, which leaves the tile stale until a refresh stamps every tile.
+
+struct dirty_map {
+    uint32_t width, height;
+    uint32_t cols, rows;        // tiles
+    uint32_t serial;            // of the last update, 0 before the first
+    uint32_t refreshed;         // serial of the last update that stamped every tile
+    uint32_t hash[SCALER_MAX_BANDS][SCALER_MAX_TILE_COLS];
+    uint32_t changed[SCALER_MAX_BANDS][SCALER_MAX_TILE_COLS];   // serial of the last change
+};
+
+// returns false if the picture has more than SCALER_MAX_BANDS rows or SCALER_MAX_TILE_COLS
+// columns of tiles
+bool dirty_init(struct dirty_map *d, uint32_t width, uint32_t height);
+
+// hashes the next picture, returns its serial. With refresh, and on the first picture, every tile
+// counts as changed, so every framebuffer is drawn in full next time.
+uint32_t dirty_update(struct dirty_map *d, const uint8_t *yuv, bool refresh);
+
+// Fills one span per row of tiles with the source columns changed after picture since, as the
+// bounding span of those tiles, for scaler_run_spans(). Returns the number of changed tiles.
+uint32_t dirty_spans(const struct dirty_map *d, uint32_t since, struct scaler_span spans[SCALER_MAX_BANDS]);
@@ -0,0 +1,50 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stdint.h>
+#include "scaler.h"
+#include "sdkconfig.h"
+
+// Presentation scheduler on top of the RGB panel's own framebuffers.
+// Buffers are flipped at frame boundaries only, so scan-out never shows a half drawn picture.
+// With triple buffering the newest submitted frame always wins and the renderer never waits;
+// with double buffering a frame finished while the previous flip is still pending is dropped.
+// With MOTOCAST_YUV_SCANOUT the buffers hold I420 pictures which are converted into the panel's
+// bounce buffers as they're scanned out (see scanout.h); frame boundaries are the refills of row 0.
+
+struct display_stats {
+    uint32_t presented;  // frames flipped to scan-out
+    uint32_t dropped;    // frames never shown: no free buffer or replaced by a newer one
+    uint32_t repeated;   // refreshes which scanned out the previous frame again
+    uint32_t late;       // frames flipped more than one refresh period after submission
+    uint32_t refresh_us; // last measured refresh period
+    uint32_t refill_late;   // YUV scan-out: bounce buffer refills which took longer than the panel allows
+    uint32_t refill_max_us; // slowest refill so far
+};
+
+void display_init(void);
+
+// returns a framebuffer which is neither scanned out nor queued, or NULL if there is none
+uint16_t *display_acquire(void);
+
+// queues a framebuffer returned by display_acquire() for the next frame boundary, returns its frame
+// number, counting from 1
+uint32_t display_submit(uint16_t *fb);
+
+// time the frame was first scanned out: 0 while it may still be, -1 if it was dropped or is too old
+int64_t display_flip_time(uint32_t frame);
+
+void display_get_stats(struct display_stats *stats);
+
+#if CONFIG_MOTOCAST_YUV_SCANOUT
+
+// Switches to a new picture geometry, nothing is shown until the next submit. Measures the refills
+// of picture yuv with s's own line buffers and returns false if the slowest one doesn't fit into the
+// budget or the picture is larger than MOTOCAST_YUV_SCANOUT_MAX_PIXELS.
+bool display_yuv_configure(struct scaler *s, const uint8_t *yuv);
+
+// like display_acquire() and display_submit(), for I420 pictures of the configured geometry
+uint8_t *display_acquire_yuv(void);
+uint32_t display_submit_yuv(uint8_t *yuv);
+
+#endif
@@ -0,0 +1,51 @@
+#pragma once
+
+#include <stdint.h>
+
+// Glass-to-glass latency measurement. Senders opt in per access unit with VIDEO_FRAME_FLAG_TIMESTAMP
+// and put their capture time in front of the payload. For every such frame that reaches the panel
+// the device echoes when it was decoded and scanned out on its own clock, together with its
+// estimate of the sender clock (see timesync.h), which ping/pong exchanges on the same
+// characteristic keep up to date.
+//
+// Messages, all fields little-endian, byte 0 is the type:
+//   GLASS_PING, device -> sender
+//      4  device time t1, u64
+//   GLASS_PONG, sender -> device, sent as soon as possible after the ping
+//      4  t1 of the ping, u64
+//      12 sender time the ping was received, u64
+//      20 sender time of this reply, u64
+//   GLASS_ECHO, device -> sender
+//      1  number of echoes
+//      2  1 when the clock offset is valid
+//      3  reserved
+//      4  sender clock minus device clock at the last scan-out, i64
+//      12 echoes, GLASS_ECHO_SIZE each:
+//          0  sequence number, u16
+//          2  reserved, u16
+//          4  capture time, sender clock, u64
+//          12 decoded, device clock, u64
+//          20 scanned out, device clock, u64
+// Device times are microseconds since boot, sender times microseconds of any monotonic clock.
+
+#define GLASS_PING                  1
+#define GLASS_PONG                  2
+#define GLASS_ECHO                  3
+
+#define GLASS_PING_SIZE             12
+#define GLASS_PONG_SIZE             28
+#define GLASS_ECHO_HEADER_SIZE      12
+#define GLASS_ECHO_SIZE             28
+
+// decode task: a timestamped access unit was decoded and submitted as display frame
+void glass_frame(uint16_t seq, int64_t captured, int64_t decoded, uint32_t frame);
+
+// writes a ping sent at now into dst, returns its size
+uint32_t glass_ping(uint8_t dst[GLASS_PING_SIZE], int64_t now);
+
+// handles a message from the sender received at now
+void glass_receive(const uint8_t *data, uint32_t len, int64_t now);
+
+// writes an echo of the frames scanned out since the last call, at most size bytes, returns its
+// size or 0 if there is nothing to report. Calls must not overlap with glass_ping().
+uint32_t glass_echo(uint8_t *dst, uint32_t size);
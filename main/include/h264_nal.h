@@ -0,0 +1,44 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stdint.h>
+
+// Annex B NAL unit scanning, just enough to pick units by type and nal_ref_idc, and the few SPS
+// fields the pipeline needs besides the decoder.
+
+#define H264_NAL_SLICE      1
+#define H264_NAL_IDR        5
+#define H264_NAL_SEI        6
+#define H264_NAL_SPS        7
+#define H264_NAL_PPS        8
+
+// matrix_coefficients of the VUI
+#define H264_MATRIX_BT709           1
+#define H264_MATRIX_UNSPECIFIED     2
+#define H264_MATRIX_BT470BG         5   // BT.601 625 lines
+#define H264_MATRIX_SMPTE170M       6   // BT.601 525 lines
+
+struct h264_nal {
+    const uint8_t *data;    // starts with the 00 00 01 start code
+    uint32_t len;           // up to the next start code
+    uint8_t type;
+    uint8_t ref_idc;        // 0: no other picture refers to this one
+};
+
+// finds the NAL unit at or after *pos and advances *pos past it, false when there is none left
+bool h264_next_nal(const uint8_t **pos, const uint8_t *end, struct h264_nal *nal);
+
+static inline bool h264_nal_is_slice(const struct h264_nal *nal) {
+    return nal->type >= H264_NAL_SLICE && nal->type <= H264_NAL_IDR;
+}
+
+struct h264_sps {
+    uint32_t width, height;     // in macroblocks times 16, without cropping
+    uint32_t crop_x, crop_y;    // visible part of the picture after frame cropping, in luma samples,
+    uint32_t crop_w, crop_h;    // the whole picture without frame_cropping_flag
+    bool full_range;            // video_full_range_flag
+    uint8_t matrix;             // matrix_coefficients, H264_MATRIX_UNSPECIFIED without a colour description
+};
+
+// parses an SPS, rbsp points at the NAL header after the start code. False if it's cut short.
+bool h264_parse_sps(const uint8_t *rbsp, uint32_t len, struct h264_sps *sps);
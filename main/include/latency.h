@@ -0,0 +1,45 @@
+#pragma once
+
+#include <stdatomic.h>
+#include <stdint.h>
+
+// Lock-free latency histograms of the video pipeline, safe to update from any task or ISR.
+// Buckets: 0 is below 64 us, then two per octave up to 1 s, the last one is 1 s and above.
+
+#define LATENCY_BUCKETS 30
+
+enum latency_stage {
+    LATENCY_ARRIVAL,    // first byte of an access unit arriving over BLE -> access unit complete
+    LATENCY_DECODE,     // access unit complete -> picture decoded
+    LATENCY_CONVERT,    // picture decoded -> converted into a framebuffer
+    LATENCY_FLIP,       // framebuffer submitted -> scanned out
+    LATENCY_GLASS,      // capture on the sender -> scanned out, timestamped frames only, see glass.h
+    LATENCY_COUNT,
+};
+
+struct latency_histogram {
+    _Atomic uint32_t buckets[LATENCY_BUCKETS];
+};
+
+extern struct latency_histogram latency[LATENCY_COUNT];
+
+static inline unsigned latency_bucket(uint32_t us) {
+    if (us < 64)
+        return 0;
+    unsigned octave = 31 - __builtin_clz(us);
+    unsigned bucket = 1 + (octave - 6) * 2 + ((us >> (octave - 1)) & 1);
+    return bucket < LATENCY_BUCKETS? bucket: LATENCY_BUCKETS - 1;
+}
+
+static inline void latency_add(enum latency_stage stage, int64_t us) {
+    atomic_fetch_add_explicit(&latency[stage].buckets[latency_bucket(us > 0? (uint32_t)us: 0)], 1, memory_order_relaxed);
+}
+
+// lower bound of a bucket in microseconds
+uint32_t latency_bucket_start(unsigned bucket);
+
+// moves the counts accumulated since the previous call into counts
+void latency_take(enum latency_stage stage, uint32_t counts[LATENCY_BUCKETS]);
+
+// upper bound of the bucket holding the given percentile, 0 if counts are empty
+uint32_t latency_percentile(const uint32_t counts[LATENCY_BUCKETS], unsigned percent);
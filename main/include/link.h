@@ -0,0 +1,45 @@
+#pragma once
+
+#include <stdint.h>
+#include "esp_gap_ble_api.h"
+
+// Negotiates the BLE link for throughput once a client connects: 2M PHY, LL data length of
+// LINK_DATA_LEN and a connection interval of LINK_INTERVAL, one request after the other. A request
+// the central fails, ignores or answers with less is repeated after LINK_RETRY_US, doubling with
+// every attempt; after LINK_ATTEMPTS the next step is tried instead. Connection intervals are
+// relaxed towards LINK_INTERVAL_MAX along the way, some phones refuse the shortest one outright.
+// The parameters in use are tracked from the stack's events, whoever asked for them.
+
+#define LINK_DATA_LEN           251         // LL payload octets, the most the controller supports
+#define LINK_INTERVAL           6           // 7.5 ms in 1.25 ms units
+#define LINK_INTERVAL_MAX       24          // 30 ms
+#define LINK_TIMEOUT            400         // supervision timeout in 10 ms units
+#define LINK_RESPONSE_US        2000000     // time the central has to answer a request
+#define LINK_RETRY_US           250000
+#define LINK_ATTEMPTS           4
+
+#define LINK_PHY_1M             1
+#define LINK_PHY_2M             2
+#define LINK_PHY_CODED          3
+
+struct link_params {
+    uint16_t mtu;               // ATT MTU
+    uint16_t tx_octets;         // LL payload per packet
+    uint16_t rx_octets;
+    uint8_t tx_phy;             // LINK_PHY_*
+    uint8_t rx_phy;
+    uint16_t interval;          // connection interval in 1.25 ms units
+    uint16_t latency;           // peripheral latency in connection events
+    uint16_t timeout;           // supervision timeout in 10 ms units
+};
+
+void link_init(void);
+
+// BLE stack: a client connected with the given parameters, negotiation starts
+void link_connected(const esp_bd_addr_t bda, uint16_t interval, uint16_t latency, uint16_t timeout);
+void link_disconnected(void);
+void link_mtu(uint16_t mtu);
+void link_gap_event(esp_gap_ble_cb_event_t event, const esp_ble_gap_cb_param_t *param);
+
+// parameters of the current connection, defaults while there is none
+void link_get_params(struct link_params *params);
@@ -0,0 +1,25 @@
+#pragma once
+
+#include <stdint.h>
+
+#define PACKET_POOL_MAX_BUFFERS 32
+
+// Fixed set of equally sized buffers carved out of one allocation.
+// Only used from the decode task, so no locking.
+struct packet_pool {
+    uint8_t *storage;
+    uint32_t buffer_size;
+    uint32_t count;
+    uint32_t free_mask;
+
+    uint32_t in_use;
+    uint32_t peak_in_use;
+    uint32_t exhausted;
+    uint32_t oversized;
+};
+
+void packet_pool_init(struct packet_pool *pool, uint8_t *storage, uint32_t buffer_size, uint32_t count);
+
+// returns NULL if len does not fit into a buffer or all buffers are taken
+uint8_t *packet_pool_acquire(struct packet_pool *pool, uint32_t len);
+void packet_pool_release(struct packet_pool *pool, uint8_t *buffer);
@@ -0,0 +1,60 @@
+#pragma once
+
+#include <stdint.h>
+#include "sdkconfig.h"
+#include "platform.h"
+
+// Core placement of the video pipeline and, with MOTOCAST_PIPELINE_BENCHMARK, per-stage timing.
+
+enum pipeline_stage {
+    PIPELINE_INGEST,    // BLE write -> ingest ring, runs in the Bluedroid task
+    PIPELINE_PARSE,     // framing and CRC
+    PIPELINE_DECODE,    // esp_h264_dec_process, includes waiting for the tinyh264 helper task
+    PIPELINE_CONVERT,   // colour conversion and scaling into the framebuffer
+    PIPELINE_STAGE_COUNT,
+};
+
+// logs which core every pipeline stage runs on
+void pipeline_init(void);
+
+// logs stage and task utilisation since the previous call, no-op without MOTOCAST_PIPELINE_BENCHMARK
+void pipeline_report(void);
+
+typedef void (*pipeline_slice_fn)(void *arg, uint32_t index, unsigned worker);
+
+// Runs fn(arg, index, worker) for every index below count, spread over the calling task (worker 0)
+// and, with MOTOCAST_CONVERT_SPLIT, a helper task on the other core (worker 1). Indices are handed
+// out in order as workers become free and the call returns once all of them finished. The helper
+// only takes indices nobody started yet, so a helper that doesn't get scheduled in time costs
+// nothing but the wakeup. Returns the number of indices the helper ran. Calls must not overlap.
+uint32_t pipeline_parallel(uint32_t count, pipeline_slice_fn fn, void *arg);
+
+#if CONFIG_MOTOCAST_PIPELINE_BENCHMARK
+
+struct pipeline_stage_time {
+    uint32_t busy_us;   // wraps, only differences are meaningful
+    uint32_t count;
+};
+
+// every stage is only ever accounted from one task
+extern struct pipeline_stage_time pipeline_stages[PIPELINE_STAGE_COUNT];
+
+static inline int64_t pipeline_begin(void) {
+    return platform_time_us();
+}
+
+static inline void pipeline_end(enum pipeline_stage stage, int64_t start) {
+    pipeline_stages[stage].busy_us += (uint32_t)(platform_time_us() - start);
+    ++pipeline_stages[stage].count;
+}
+
+#else
+
+static inline int64_t pipeline_begin(void) {
+    return 0;
+}
+
+static inline void pipeline_end(enum pipeline_stage stage, int64_t start) {
+}
+
+#endif
@@ -0,0 +1,47 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+// The few platform services the portable pipeline sources need (framing, decode loop, conversion,
+// scaling). ESP-IDF versions are inline, the host build in host/ implements them in platform_host.c.
+
+enum platform_mem {
+    PLATFORM_MEM_INTERNAL,  // fast internal RAM
+    PLATFORM_MEM_EXTERNAL,  // large buffers, PSRAM on the device
+};
+
+#ifdef ESP_PLATFORM
+
+#include "esp_heap_caps.h"
+#include "esp_log.h"
+#include "esp_timer.h"
+
+static inline void *platform_alloc(size_t size, enum platform_mem mem) {
+    return heap_caps_malloc(size, (mem == PLATFORM_MEM_INTERNAL? MALLOC_CAP_INTERNAL: MALLOC_CAP_SPIRAM) | MALLOC_CAP_8BIT);
+}
+
+static inline void platform_free(void *ptr) {
+    heap_caps_free(ptr);
+}
+
+static inline int64_t platform_time_us(void) {
+    return esp_timer_get_time();
+}
+
+#define PLATFORM_LOGI ESP_LOGI
+#define PLATFORM_LOGE ESP_LOGE
+
+#else
+
+#include <stdio.h>
+
+// 4 byte aligned like heap_caps_malloc(), no more
+void *platform_alloc(size_t size, enum platform_mem mem);
+void platform_free(void *ptr);
+int64_t platform_time_us(void);
+
+#define PLATFORM_LOGI(tag, format, ...) fprintf(stderr, "I %s: " format "\n", tag, ##__VA_ARGS__)
+#define PLATFORM_LOGE(tag, format, ...) fprintf(stderr, "E %s: " format "\n", tag, ##__VA_ARGS__)
+
+#endif
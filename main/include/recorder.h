@@ -0,0 +1,32 @@
+#pragma once
+
+#include <stdint.h>
+#include "sdkconfig.h"
+
+// Field debugging with MOTOCAST_CAPTURE: every BLE write is kept in a PSRAM flight recorder (see
+// capture.h) and single key commands on the console UART act on it:
+//   d  dump over UART as "MCAP <hex>" lines, host/motocast_replay reads such a log directly
+//   s  save to the "capture" flash partition
+//   l  load from the "capture" flash partition
+//   r  replay through video_write() with the recorded timing
+//   R  replay as fast as the decoder takes it
+//   c  clear
+// Recording pauses while a command runs. Live BLE writes are refused during a replay, see
+// transport_pause().
+
+#if CONFIG_MOTOCAST_CAPTURE
+
+void recorder_init(void);
+
+// called from the GATT write handler before the data goes to video_write()
+void recorder_write(const uint8_t *data, uint32_t len);
+
+#else
+
+static inline void recorder_init(void) {
+}
+
+static inline void recorder_write(const uint8_t *data, uint32_t len) {
+}
+
+#endif
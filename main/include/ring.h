@@ -0,0 +1,31 @@
+#pragma once
+
+#include <stdatomic.h>
+#include <stdint.h>
+
+// Single-producer/single-consumer byte ring.
+// The producer only moves head, the consumer only moves tail, so no locks are needed.
+// Size must be a power of two; indices run freely and are masked on access.
+struct ring {
+    uint8_t *data;
+    uint32_t size;
+    _Atomic uint32_t head;
+    _Atomic uint32_t tail;
+
+    // producer-side statistics
+    uint32_t high_water;
+    uint32_t dropped_writes;
+    uint32_t dropped_bytes;
+};
+
+void ring_init(struct ring *ring, uint8_t *data, uint32_t size);
+
+uint32_t ring_used(const struct ring *ring);
+uint32_t ring_free(const struct ring *ring);
+
+// producer: copies all of src or nothing, returns 0 if there was no room
+int ring_write(struct ring *ring, const uint8_t *src, uint32_t len);
+
+// consumer: returns length of the contiguous readable region starting at *data
+uint32_t ring_peek(const struct ring *ring, const uint8_t **data);
+void ring_consume(struct ring *ring, uint32_t len);
@@ -0,0 +1,101 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stdint.h>
+
+// Fused I420 -> RGB565 conversion and upscaling into a framebuffer.
+// Source rows are converted pairwise into internal RAM line buffers and only the scaled
+// result is written to the (PSRAM) framebuffer.
+
+#define SCALER_MAX_WIDTH 800
+#define SCALER_TILE 16                  // partial updates work in tiles of one macroblock
+#define SCALER_MAX_BANDS 48             // rows of tiles partial updates support, 768 source rows
+#define SCALER_MAX_TILE_COLS ((SCALER_MAX_WIDTH + SCALER_TILE - 1) / SCALER_TILE)
+#define SCALER_SLICE_ROWS 16            // output rows per slice, the panel's bounce buffer height
+
+enum scaler_filter {
+    SCALER_NEAREST,
+    SCALER_INTEGER,     // largest integer factor that fits, always letterboxed
+    SCALER_BILINEAR,
+};
+
+enum scaler_fit {
+    SCALER_LETTERBOX,   // keep aspect ratio, centre the picture
+    SCALER_FILL,        // stretch over the whole output
+};
+
+// line buffers of one task running the scaler, in internal RAM
+struct scaler_lines {
+    int32_t cached_pair[2];
+    uint16_t cached_x0[2], cached_x1[2];    // converted columns of the cached pairs
+    unsigned next_slot;
+    bool portable;                          // plain C only, for interrupts which don't save the PIE registers
+    uint16_t lines[2][2][SCALER_MAX_WIDTH] __attribute__((aligned(16)));
+    uint16_t blend[SCALER_MAX_WIDTH];
+};
+
+struct scaler {
+    enum scaler_filter filter;
+    uint32_t src_w, src_h;
+    uint32_t pic_w, pic_h;                  // I420 picture the source is cut from, see scaler_set_crop()
+    uint32_t src_x, src_y;                  // source position in it
+    uint32_t out_w, out_h;
+    uint32_t dst_x, dst_y, dst_w, dst_h;
+    uint32_t factor;
+
+    uint16_t x_index[SCALER_MAX_WIDTH];     // left source tap of each output column
+    uint8_t x_weight[SCALER_MAX_WIDTH];     // bilinear weight of the right tap, 0..32
+    // output columns depending on source columns from c * SCALER_TILE on / before c * SCALER_TILE
+    uint16_t tile_dst_start[SCALER_MAX_TILE_COLS + 1];
+    uint16_t tile_dst_end[SCALER_MAX_TILE_COLS + 1];
+
+
+    struct scaler_lines work;               // for scaler_run() and scaler_run_spans()
+};
+
+// source columns [x0, x1) of a band of SCALER_TILE rows, empty if x0 == x1
+struct scaler_span {
+    uint16_t x0, x1;
+};
+
+// returns 0 if the source is too wide or empty
+int scaler_init(struct scaler *s, uint32_t src_w, uint32_t src_h, uint32_t out_w, uint32_t out_h,
+    enum scaler_filter filter, enum scaler_fit fit);
+
+// Makes the source the src_w x src_h part at x, y of a pic_w x pic_h picture, for streams with
+// frame cropping. scaler_init() sets the picture to the source itself. Returns 0 if the source
+// doesn't fit or x, y aren't even.
+int scaler_set_crop(struct scaler *s, uint32_t pic_w, uint32_t pic_h, uint32_t x, uint32_t y);
+
+// writes the scaled picture into fb at (dst_x, dst_y), leaving the rest of fb untouched
+void scaler_run(struct scaler *s, const uint8_t *yuv, uint16_t *fb, uint32_t fb_stride);
+
+// Like scaler_run(), but only redraws the output depending on the given columns of every band,
+// spans has one entry per band and needs src_h <= SCALER_MAX_BANDS * SCALER_TILE. Span edges
+// other than the picture's own must be multiples of SCALER_TILE, spans reaching past src_w are
+// cut off there. Returns output pixels written.
+uint32_t scaler_run_spans(struct scaler *s, const uint8_t *yuv, uint16_t *fb, uint32_t fb_stride,
+    const struct scaler_span *spans);
+
+// Output rows [y0, y1) of scaler_run_spans(), spans may be NULL for all of them. Slices can run
+// concurrently with one set of line buffers each, and their outputs add up to that of a single
+// run.
+uint32_t scaler_run_slice(const struct scaler *s, struct scaler_lines *l, const uint8_t *yuv, uint16_t *fb,
+    uint32_t fb_stride, const struct scaler_span *spans, uint32_t y0, uint32_t y1);
+
+// Rows [row, row + rows) of the whole out_w x out_h output into dst, with a stride of out_w and
+// black letterbox bars, e.g. to fill a scan-out buffer straight from the picture.
+void scaler_run_lines(const struct scaler *s, struct scaler_lines *l, const uint8_t *yuv, uint16_t *dst,
+    uint32_t row, uint32_t rows);
+
+typedef void (*rgb565_double_row_t)(const uint16_t *src, uint16_t *dst0, uint16_t *dst1, uint32_t width);
+
+// Doubles a row horizontally and writes it to two output rows.
+void rgb565_double_row_c(const uint16_t *src, uint16_t *dst0, uint16_t *dst1, uint32_t width);
+
+#ifdef HAVE_ESP32S3
+
+// PIE version, requires width % 8 == 0 and all pointers 16-byte aligned
+void rgb565_double_row_esp32s3(const uint16_t *src, uint16_t *dst0, uint16_t *dst1, uint32_t width);
+
+#endif
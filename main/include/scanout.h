@@ -0,0 +1,20 @@
+#pragma once
+
+#include <stdint.h>
+#include "scaler.h"
+
+// Timing of YUV scan-out (MOTOCAST_YUV_SCANOUT): the panel keeps two bounce buffers of
+// BOARD_LCD_BOUNCE_ROWS rows and asks for one to be refilled while it sends the other, so a refill
+// converting its rows straight from an I420 picture has to finish within the time of one buffer.
+// Refills run in the LCD interrupt with the plain C kernels.
+
+// share of scanout_budget_us() the slowest refill may take, the rest covers interrupt latency and
+// PSRAM contention with the decoder
+#define SCANOUT_BUDGET_PERCENT  70
+
+// time the panel takes to send one bounce buffer
+uint32_t scanout_budget_us(void);
+
+// Slowest refill of the picture yuv with geometry s over all positions of a frame, converted into
+// dst (BOARD_LCD_BOUNCE_ROWS rows) with l, which has to be set to portable.
+uint32_t scanout_measure(const struct scaler *s, struct scaler_lines *l, const uint8_t *yuv, uint16_t *dst);
@@ -0,0 +1,45 @@
+#pragma once
+
+#include <stdint.h>
+#include "latency.h"
+
+// Live telemetry for the phone app, one packet per reporting window, all fields little-endian:
+//   0  version
+//   1  number of histograms, LATENCY_COUNT in enum latency_stage order
+//   2  buckets per histogram, see latency.h for their bounds
+//   3  reserved
+//   4  window length in ms, u16
+//   6  frames presented, u16
+//   8  frames dropped by the display or to catch up, u16
+//  10  access units lost, corrupt or rejected, u16
+//  12  bytes received, u32
+//  16  ATT MTU, u16
+//  18  LL payload octets per packet towards the device, u16
+//  20  connection interval in 1.25 ms units, u16
+//  22  PHY towards the device, 1: 1M, 2: 2M, 3: coded
+//  23  PHY from the device
+//  24  BLE writes, u16
+//  26  decode task wakeups, u16, one per batch of writes (see MOTOCAST_INGEST_BATCH_US) at most
+//  28  histograms, u16 counts saturating at 0xffff
+#define TELEMETRY_VERSION       3
+#define TELEMETRY_HEADER_SIZE   28
+#define TELEMETRY_SIZE          (TELEMETRY_HEADER_SIZE + LATENCY_COUNT * LATENCY_BUCKETS * 2)
+
+struct telemetry_window {
+    uint32_t duration_ms;
+    uint32_t presented;
+    uint32_t dropped;
+    uint32_t lost;
+    uint32_t bytes;
+    uint32_t writes;
+    uint32_t wakeups;
+    // link parameters in use at the end of the window
+    uint16_t mtu;
+    uint16_t rx_octets;
+    uint16_t interval;
+    uint8_t rx_phy;
+    uint8_t tx_phy;
+};
+
+// serialises the window and takes the latency counts accumulated since the previous call
+uint32_t telemetry_build(uint8_t dst[TELEMETRY_SIZE], const struct telemetry_window *window);
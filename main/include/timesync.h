@@ -0,0 +1,47 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stdint.h>
+
+// NTP-style estimate of a remote clock. Each exchange gives four timestamps: t1 local send, t2
+// remote receive, t3 remote send and t4 local receive, which bound the offset between the clocks to
+// [t3 - t4, t2 - t1] however the delays were split between the two directions. The drift between
+// the clocks is the rate that lines the bounds of the last TIMESYNC_SAMPLES exchanges up best, the
+// one leaving the widest gap between the highest lower and the lowest upper bound. Moved along it to
+// the newest exchange, the bounds of the last TIMESYNC_OFFSET_SAMPLES are intersected, so a single
+// fast leg in either direction is enough to narrow the estimate, while an error in the drift only
+// counts for their shorter age. How large the drift is makes no difference to either estimate,
+// within TIMESYNC_MAX_DRIFT_PPB.
+
+#define TIMESYNC_SAMPLES        96
+#define TIMESYNC_OFFSET_SAMPLES 48
+#define TIMESYNC_MIN_SAMPLES    4           // exchanges before the estimate is used
+#define TIMESYNC_MAX_DRIFT_PPB  1000000     // +-1000 ppm, far beyond any crystal
+
+struct timesync_sample {
+    int64_t time;       // local receive time
+    int64_t low;        // bounds of remote minus local clock
+    int64_t high;
+};
+
+struct timesync {
+    struct timesync_sample samples[TIMESYNC_SAMPLES];
+    int64_t ages[TIMESYNC_SAMPLES];     // scratch of timesync_update(), per sample
+    uint32_t count;             // exchanges so far
+    int64_t time;               // local time of the estimate
+    int64_t offset;             // remote minus local clock
+    int64_t error;              // maximum error of offset
+    int32_t drift_ppb;          // remote clock rate relative to the local one
+};
+
+void timesync_init(struct timesync *ts);
+
+void timesync_update(struct timesync *ts, int64_t t1, int64_t t2, int64_t t3, int64_t t4);
+
+bool timesync_valid(const struct timesync *ts);
+
+// remote minus local clock at local time now
+int64_t timesync_offset(const struct timesync *ts, int64_t now);
+
+// remote timestamp converted to the local clock
+int64_t timesync_to_local(const struct timesync *ts, int64_t remote);
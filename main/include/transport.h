@@ -0,0 +1,59 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stdint.h>
+#include "sdkconfig.h"
+
+// Ways video data reaches the ingest ring. The sender picks one per write and may switch at any
+// time; all of them end in the same sink, video_write() on the device. Each keeps its own counts
+// so they can be compared on a live link.
+//   TRANSPORT_GATT       write or write without response to the video characteristic, one ATT
+//                        packet of at most MTU - 3 bytes per write
+//   TRANSPORT_GATT_LONG  prepared writes, handed over in one piece when executed, up to
+//                        TRANSPORT_LONG_WRITE_MAX bytes
+// L2CAP connection-oriented channels would be another one. They are deferred: Bluedroid has no LE
+// CoC API, and the channel waits for the move to NimBLE, which is a request of its own.
+
+// An attribute value is at most 512 octets (Core spec Vol 3 Part F 3.2.9), so is one long write.
+// Larger access units are chunked by the application: the sender cuts the framed stream, header
+// and payload alike, into pieces of up to this size and sends each as its own long write, prepare
+// writes at offsets from 0 and an execute, one round after the other. Executed rounds append to
+// the stream in order and the framing header's length puts the packet back together, so a round
+// needn't end at a packet boundary. A round that is cancelled or has a fragment refused delivers
+// nothing; the parser then loses that packet and resynchronises on the next header.
+#define TRANSPORT_LONG_WRITE_MAX 512
+
+enum transport {
+    TRANSPORT_GATT,
+    TRANSPORT_GATT_LONG,
+    TRANSPORT_COUNT,
+};
+
+typedef void (*transport_sink_fn)(const uint8_t *data, uint32_t len);
+
+struct transport_stats {
+    uint32_t bytes;         // all wrap, only differences are meaningful
+    uint32_t writes;
+    uint32_t sink_us;       // wall time in the sink, with MOTOCAST_TRANSPORT_COMPARE; not the
+                            // stack's CPU time for the transport, which happens before the call
+    uint32_t refused;       // writes dropped while paused
+};
+
+void transport_init(transport_sink_fn sink);
+
+// hands data received over a transport to the sink, only ever called from one task
+void transport_write(enum transport transport, const uint8_t *data, uint32_t len);
+
+// Stops or resumes handing writes to the sink, so another task can feed it for a while, e.g. a
+// replay. A write that got past the check before the pause may still be in the sink, the other
+// task has to wait until transport_busy() is false.
+void transport_pause(bool pause);
+bool transport_busy(void);
+
+void transport_get_stats(enum transport transport, struct transport_stats *stats);
+
+// logs throughput, writes and time in the sink of every transport that carried data since the
+// previous call, no-op without MOTOCAST_TRANSPORT_COMPARE
+void transport_report(void);
+
+extern const char *const transport_names[TRANSPORT_COUNT];
@@ -1,17 +1,70 @@
+#pragma once
+
 #include "esp_h264_dec.h"
+#include "video_packet.h"
 
-struct video_packet {
-    uint8_t * data;
-    uint8_t header_read;
-    uint32_t data_len;
-    uint32_t data_written;
+// why the sender should send an IDR picture, the first problem since the last one
+enum video_keyframe_reason {
+    VIDEO_KEYFRAME_NONE,
+    VIDEO_KEYFRAME_START,       // no IDR picture decoded yet
+    VIDEO_KEYFRAME_LOST,        // access units lost, corrupt or rejected
+    VIDEO_KEYFRAME_RESYNC,      // framing lost sync
+    VIDEO_KEYFRAME_DECODE,      // decoder error
 };
 
-int video_packet_finished(struct video_packet *pkt);
+struct video_stats {
+    uint32_t ring_size;
+    uint32_t ring_used;
+    uint32_t ring_high_water;
+    uint32_t ring_dropped_writes;
+    uint32_t ring_dropped_bytes;
+    uint32_t ring_accepted;         // bytes written into the ring so far, wrapping
+    uint32_t ring_consumed;         // bytes decoded so far, wrapping
+    uint32_t ingest_writes;         // BLE writes so far, wrapping
+    uint32_t ingest_batches;        // batches they were grouped into, see MOTOCAST_INGEST_BATCH_US
+    uint32_t decode_wakeups;        // times the decode task woke up
+
+    uint32_t pool_count;
+    uint32_t pool_in_use;
+    uint32_t pool_peak_in_use;
+    uint32_t pool_exhausted;
+    uint32_t pool_oversized;
+
+    struct video_packet_stats packets;
 
-// returns number of processed bytes
-uint32_t video_packet_process(struct video_packet *pkt, const uint8_t *buffer, uint32_t buffer_len);
+    uint32_t width;                 // current stream resolution, 0 before the first picture
+    uint32_t height;
+    uint32_t resolution_changes;
+
+    uint32_t late_dropped;          // non-reference pictures discarded before decoding to catch up
+    uint32_t late_skipped;          // pictures decoded but not shown to catch up
+    uint32_t behind;                // 1 while catching up
+
+    uint32_t pictures;              // pictures decoded
+    uint32_t decode_us;             // time spent in the decoder, wrapping
+    uint32_t convert_us;            // time spent converting pictures, wrapping
+    uint32_t convert_full;          // pictures converted as a whole and the time spent on them, wrapping
+    uint32_t convert_full_us;
+    uint32_t convert_partial;       // pictures of which only changed tiles were converted, see MOTOCAST_DIRTY_TILES
+    uint32_t convert_partial_us;
+    uint32_t pixels_drawn;          // framebuffer pixels written by conversions, wrapping
+    uint32_t pixels_total;          // those a full conversion of every picture would have written
+    uint32_t convert_slices;        // slices of SCALER_SLICE_ROWS converted, see MOTOCAST_CONVERT_SPLIT
+    uint32_t convert_helper_slices; // those converted on the other core
+    uint32_t decode_errors;
+    uint32_t keyframes;             // IDR access units decoded
+    enum video_keyframe_reason keyframe_reason;
+    uint32_t last_seq;              // sequence number of the last good access unit
+};
 
 void video_init(void);
 
-esp_h264_err_t video_decode(uint8_t *buffer, uint32_t buffer_len);
+// called from BLE callbacks: copies data into the ingest ring and wakes decode task
+void video_write(const uint8_t *buffer, uint32_t buffer_len);
+
+// bytes the ingest ring takes right now, a write larger than that is dropped
+uint32_t video_ring_free(void);
+
+void video_get_stats(struct video_stats *stats);
+
+esp_h264_err_t video_decode(const uint8_t *buffer, uint32_t buffer_len);
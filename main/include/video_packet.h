@@ -0,0 +1,87 @@
+#pragma once
+
+#include <stdint.h>
+#include "packet_pool.h"
+
+// Stream framing, all fields little-endian:
+//   0  sync 'M' 'C'
+//   2  version
+//   3  flags
+//   4  sequence number, u16
+//   6  reserved, u16, must be zero
+//   8  payload length, u32
+//  12  CRC32 of header bytes 0..11 followed by the payload, u32
+// followed by the payload (one H.264 access unit in Annex B format). With VIDEO_FRAME_FLAG_TIMESTAMP
+// the payload starts with the sender's capture time in microseconds, u64, see glass.h.
+#define VIDEO_FRAME_SYNC0           'M'
+#define VIDEO_FRAME_SYNC1           'C'
+#define VIDEO_FRAME_VERSION         1
+#define VIDEO_FRAME_HEADER_SIZE     16
+#define VIDEO_FRAME_CRC_OFFSET      12
+
+#define VIDEO_FRAME_FLAG_IDR        (1 << 0)    // access unit contains an IDR picture
+#define VIDEO_FRAME_FLAG_CONFIG     (1 << 1)    // access unit contains SPS/PPS
+#define VIDEO_FRAME_FLAG_TIMESTAMP  (1 << 2)    // payload starts with the capture time
+
+#define VIDEO_FRAME_TIMESTAMP_SIZE  8
+
+struct video_packet_stats {
+    uint32_t frames;        // valid frames delivered
+    uint32_t lost;          // frames missing according to sequence numbers
+    uint32_t corrupt;       // frames dropped because of CRC mismatch
+    uint32_t duplicate;     // sequence numbers older than expected, dropped
+    uint32_t rejected;      // no pool buffer for the payload
+    uint32_t bad_headers;   // headers failing validation
+    uint32_t resync_bytes;  // bytes skipped looking for sync
+    uint32_t fast_path;     // payloads decoded in place from the input buffer
+    uint32_t slow_path;     // payloads assembled in a pool buffer
+};
+
+struct video_packet {
+    const uint8_t * payload; // set when finished, either data or a pointer into the input buffer
+    uint32_t payload_len;    // access unit length, without the timestamp
+    int64_t timestamp;       // sender capture time, 0 without VIDEO_FRAME_FLAG_TIMESTAMP
+    uint8_t * data;
+    uint8_t header[VIDEO_FRAME_HEADER_SIZE];
+    uint8_t header_read;
+    uint8_t skip; // payload is consumed and discarded
+    uint8_t flags;
+    uint16_t seq;
+    uint32_t data_len;
+    uint32_t data_written;
+    uint32_t crc;
+
+    uint16_t next_seq;
+    uint8_t have_seq;
+    struct packet_pool *pool;
+    struct video_packet_stats stats;
+};
+
+void video_packet_init(struct video_packet *pkt, struct packet_pool *pool);
+
+// true when a complete, CRC-checked access unit is in pkt->payload
+int video_packet_finished(const struct video_packet *pkt);
+
+// returns number of processed bytes, stops right after a finished packet
+// if the whole payload is inside buffer it's not copied: pkt->payload then points into buffer,
+// which must stay valid until video_packet_free()
+uint32_t video_packet_process(struct video_packet *pkt, const uint8_t *buffer, uint32_t buffer_len);
+
+// returns the packet buffer to the pool and starts looking for the next header
+void video_packet_free(struct video_packet *pkt);
+
+// Producer side view of the framing: follows packet boundaries through the stream by the headers'
+// payload lengths, without CRC checks or copies, so a writer can tell when a packet is complete.
+// Skips and resynchronises where the parser does, except for the rescan after a CRC mismatch.
+struct video_frame_tracker {
+    uint32_t max_len;       // longer payloads are rejected, the packet pool's buffer size
+    uint32_t remaining;     // payload bytes still to come
+    uint8_t header[VIDEO_FRAME_HEADER_SIZE];
+    uint8_t header_read;
+    uint8_t in_payload;
+};
+
+void video_frame_tracker_init(struct video_frame_tracker *t, uint32_t max_len);
+
+// follows the stream through buffer, returns 1 if it completes at least one packet
+int video_frame_track(struct video_frame_tracker *t, const uint8_t *buffer, uint32_t buffer_len);
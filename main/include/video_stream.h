@@ -0,0 +1,21 @@
+#pragma once
+
+#include "packet_pool.h"
+#include "video.h"
+
+// Platform independent part of the video pipeline: framing, decoding, resolution tracking,
+// conversion and scaling into the display's framebuffers. Fed by video_decode().
+
+// returns when the stream byte at offset, counted over all video_decode() input, arrived over BLE,
+// or 0 if that's unknown
+typedef int64_t (*video_arrival_fn)(uint32_t offset);
+
+// returns the bytes queued for video_decode(), including the buffer being decoded
+typedef uint32_t (*video_backlog_fn)(void);
+
+// arrival and backlog may be NULL, the arrival latency isn't measured and only the other one is
+// checked to detect when decoding falls behind then
+void video_stream_init(struct packet_pool *pool, video_arrival_fn arrival, video_backlog_fn backlog);
+
+// fills the packet, resolution and catch-up fields
+void video_stream_get_stats(struct video_stats *stats);
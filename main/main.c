@@ -1,3 +1,4 @@
+#include <stdatomic.h>
 #include <stdio.h>
 #include <string.h>
 #include "esp_bt.h"
@@ -8,13 +9,40 @@
 #include "esp_log.h"
 #include "esp_timer.h"
 #include "nvs_flash.h"
+#include "board.h"
+#include "control.h"
+#include "display.h"
+#include "glass.h"
+#include "link.h"
+#include "pipeline.h"
+#include "recorder.h"
+#include "telemetry.h"
+#include "transport.h"
 #include "video.h"
 
 #define TAG "MAIN"
 #define DEVICE_NAME "Motocast"
 #define GATTS_SERVICE_UUID   0x00FF
 #define GATTS_CHAR_UUID      0xFF01
-#define GATTS_NUM_HANDLE     4
+#define GATTS_TELEMETRY_UUID 0xFF02
+#define GATTS_SYNC_UUID      0xFF03
+#define GATTS_CONTROL_UUID   0xFF04
+
+enum {
+    IDX_SVC,
+    IDX_VIDEO_CHAR,
+    IDX_VIDEO_VAL,
+    IDX_TELEMETRY_CHAR,
+    IDX_TELEMETRY_VAL,
+    IDX_TELEMETRY_CFG,
+    IDX_SYNC_CHAR,
+    IDX_SYNC_VAL,
+    IDX_SYNC_CFG,
+    IDX_CONTROL_CHAR,
+    IDX_CONTROL_VAL,
+    IDX_CONTROL_CFG,
+    GATTS_NUM_HANDLE,
+};
 
 // Maximum MTU size (ESP32 supports up to 517 bytes)
 #define MAX_MTU_SIZE 517
@@ -24,16 +52,22 @@ static uint8_t adv_config_done = 0;
 #define ADV_CONFIG_FLAG (1 << 0)
 #define SCAN_RSP_CONFIG_FLAG (1 << 1)
 
-#define PREPARE_BUF_MAX_SIZE (1024)
-
+// Connection state is written by the BLE stack's task and read by timers in the esp_timer task,
+// so it's atomic. conn_id is stored before connected is set.
 static uint16_t gatts_if_id = 0;
-static uint16_t conn_id = 0;
+static _Atomic uint16_t conn_id = 0;
 static uint16_t gatts_handle = 0;
-static uint16_t current_mtu = 23;
-
-// Throughput monitoring
-static uint32_t bytes_received = 0;
-static int64_t last_report_time = 0;
+static uint16_t telemetry_handle = 0;
+static uint16_t telemetry_cfg_handle = 0;
+static _Atomic bool connected = false;
+static _Atomic bool telemetry_notify = false;
+static uint16_t sync_handle = 0;
+static uint16_t sync_cfg_handle = 0;
+static _Atomic bool sync_notify = false;
+static uint16_t control_handle = 0;
+static uint16_t control_cfg_handle = 0;
+static _Atomic bool control_notify = false;
+static _Atomic uint16_t current_mtu = 23;
 
 // Optimized advertising parameters for faster connection
 static esp_ble_adv_params_t adv_params = {
@@ -90,55 +124,246 @@ static const uint16_t character_declaration_uuid = ESP_GATT_UUID_CHAR_DECLARE;
 static const uint8_t char_prop_write = ESP_GATT_CHAR_PROP_BIT_WRITE | ESP_GATT_CHAR_PROP_BIT_WRITE_NR;
 static const uint16_t char_uuid = GATTS_CHAR_UUID;
 static const uint8_t char_value[1] = {0x00};
+static const uint16_t character_client_config_uuid = ESP_GATT_UUID_CHAR_CLIENT_CONFIG;
+static const uint8_t char_prop_read_notify = ESP_GATT_CHAR_PROP_BIT_READ | ESP_GATT_CHAR_PROP_BIT_NOTIFY;
+static const uint16_t telemetry_uuid = GATTS_TELEMETRY_UUID;
+static const uint8_t telemetry_cfg_value[2] = {0x00, 0x00};
+static uint8_t telemetry_value[TELEMETRY_SIZE];
+static const uint8_t char_prop_write_notify = ESP_GATT_CHAR_PROP_BIT_WRITE_NR | ESP_GATT_CHAR_PROP_BIT_NOTIFY;
+static const uint16_t sync_uuid = GATTS_SYNC_UUID;
+static const uint8_t sync_cfg_value[2] = {0x00, 0x00};
+static const uint8_t sync_value[1] = {0x00};
+static uint8_t sync_buffer[MAX_MTU_SIZE];
+static const uint8_t char_prop_notify = ESP_GATT_CHAR_PROP_BIT_NOTIFY;
+static const uint16_t control_uuid = GATTS_CONTROL_UUID;
+static const uint8_t control_value[1] = {0x00};
+static const uint8_t control_cfg_value[2] = {0x00, 0x00};
 
 // Attribute table
 static uint16_t service_uuid = GATTS_SERVICE_UUID;
 
 static const esp_gatts_attr_db_t gatt_db[GATTS_NUM_HANDLE] = {
     // Service Declaration
-    [0] = {{ESP_GATT_AUTO_RSP}, {
+    [IDX_SVC] = {{ESP_GATT_AUTO_RSP}, {
         ESP_UUID_LEN_16, (uint8_t *)&primary_service_uuid, 
         ESP_GATT_PERM_READ, sizeof(uint16_t), sizeof(service_uuid), 
         (uint8_t *)&service_uuid}
     },
     
     // Characteristic Declaration
-    [1] = {{ESP_GATT_AUTO_RSP}, {
+    [IDX_VIDEO_CHAR] = {{ESP_GATT_AUTO_RSP}, {
         ESP_UUID_LEN_16, (uint8_t *)&character_declaration_uuid, 
         ESP_GATT_PERM_READ, sizeof(uint8_t), sizeof(uint8_t), 
         (uint8_t *)&char_prop_write}
     },
     
-    // Characteristic Value
-    [2] = {{ESP_GATT_AUTO_RSP}, {
+    // Characteristic Value, answered here so long writes end up in prepare_buf
+    [IDX_VIDEO_VAL] = {{ESP_GATT_RSP_BY_APP}, {
         ESP_UUID_LEN_16, (uint8_t *)&char_uuid, 
-        ESP_GATT_PERM_WRITE, MAX_MTU_SIZE, sizeof(char_value), 
+        ESP_GATT_PERM_WRITE, TRANSPORT_LONG_WRITE_MAX, sizeof(char_value), 
         (uint8_t *)char_value}
     },
+
+    // Telemetry: latency histograms and frame counts, see telemetry.h
+    [IDX_TELEMETRY_CHAR] = {{ESP_GATT_AUTO_RSP}, {
+        ESP_UUID_LEN_16, (uint8_t *)&character_declaration_uuid,
+        ESP_GATT_PERM_READ, sizeof(uint8_t), sizeof(uint8_t),
+        (uint8_t *)&char_prop_read_notify}
+    },
+
+    [IDX_TELEMETRY_VAL] = {{ESP_GATT_AUTO_RSP}, {
+        ESP_UUID_LEN_16, (uint8_t *)&telemetry_uuid,
+        ESP_GATT_PERM_READ, TELEMETRY_SIZE, TELEMETRY_SIZE,
+        telemetry_value}
+    },
+
+    [IDX_TELEMETRY_CFG] = {{ESP_GATT_AUTO_RSP}, {
+        ESP_UUID_LEN_16, (uint8_t *)&character_client_config_uuid,
+        ESP_GATT_PERM_READ | ESP_GATT_PERM_WRITE, sizeof(uint16_t), sizeof(telemetry_cfg_value),
+        (uint8_t *)telemetry_cfg_value}
+    },
+
+    // Glass-to-glass latency: clock sync and frame timestamp echoes, see glass.h
+    [IDX_SYNC_CHAR] = {{ESP_GATT_AUTO_RSP}, {
+        ESP_UUID_LEN_16, (uint8_t *)&character_declaration_uuid,
+        ESP_GATT_PERM_READ, sizeof(uint8_t), sizeof(uint8_t),
+        (uint8_t *)&char_prop_write_notify}
+    },
+
+    [IDX_SYNC_VAL] = {{ESP_GATT_AUTO_RSP}, {
+        ESP_UUID_LEN_16, (uint8_t *)&sync_uuid,
+        ESP_GATT_PERM_WRITE, GLASS_PONG_SIZE, sizeof(sync_value),
+        (uint8_t *)sync_value}
+    },
+
+    [IDX_SYNC_CFG] = {{ESP_GATT_AUTO_RSP}, {
+        ESP_UUID_LEN_16, (uint8_t *)&character_client_config_uuid,
+        ESP_GATT_PERM_READ | ESP_GATT_PERM_WRITE, sizeof(uint16_t), sizeof(sync_cfg_value),
+        (uint8_t *)sync_cfg_value}
+    },
+
+    // Flow control, keyframe requests and bitrate hints for the sender, see control.h
+    [IDX_CONTROL_CHAR] = {{ESP_GATT_AUTO_RSP}, {
+        ESP_UUID_LEN_16, (uint8_t *)&character_declaration_uuid,
+        ESP_GATT_PERM_READ, sizeof(uint8_t), sizeof(uint8_t),
+        (uint8_t *)&char_prop_notify}
+    },
+
+    [IDX_CONTROL_VAL] = {{ESP_GATT_AUTO_RSP}, {
+        ESP_UUID_LEN_16, (uint8_t *)&control_uuid,
+        ESP_GATT_PERM_READ, CONTROL_MAX_SIZE, sizeof(control_value),
+        (uint8_t *)control_value}
+    },
+
+    [IDX_CONTROL_CFG] = {{ESP_GATT_AUTO_RSP}, {
+        ESP_UUID_LEN_16, (uint8_t *)&character_client_config_uuid,
+        ESP_GATT_PERM_READ | ESP_GATT_PERM_WRITE, sizeof(uint16_t), sizeof(control_cfg_value),
+        (uint8_t *)control_cfg_value}
+    },
 };
 
-typedef struct {
-    uint8_t *prepare_buf;
-    int prepare_len;
-} prepare_type_env_t;
+_Static_assert(TRANSPORT_LONG_WRITE_MAX <= CONFIG_MOTOCAST_RING_SIZE,
+    "MOTOCAST_RING_SIZE must hold a long write");
 
-prepare_type_env_t prepare_write_env = {};
+// Long writes: prepared fragments are collected here and handed over in one piece on execute,
+// larger access units take several rounds, see transport.h. Only touched from the BLE task.
+static uint8_t prepare_buf[TRANSPORT_LONG_WRITE_MAX];
+static uint32_t prepare_len;            // fragments have to continue or overwrite what's there
+static bool prepare_failed;             // a fragment was refused, the rest is refused as well
+static esp_gatt_rsp_t prepare_rsp;      // prepare responses echo the fragment, too big for the stack
 
-static void report_throughput(void) {
-    int64_t now = esp_timer_get_time();
-    if (last_report_time == 0) {
-        last_report_time = now;
+static void prepare_write(esp_gatt_if_t gatts_if, const esp_ble_gatts_cb_param_t *param) {
+    uint32_t offset = param->write.offset, len = param->write.len;
+    esp_gatt_status_t status = ESP_GATT_OK;
+    if (prepare_failed || offset > prepare_len)
+        status = ESP_GATT_INVALID_OFFSET;
+    else if (len > TRANSPORT_LONG_WRITE_MAX - offset || len > sizeof(prepare_rsp.attr_value.value))
+        status = ESP_GATT_INVALID_ATTR_LEN;
+
+    if (status == ESP_GATT_OK) {
+        memcpy(prepare_buf + offset, param->write.value, len);
+        if (offset + len > prepare_len)
+            prepare_len = offset + len;
+    } else {
+        prepare_failed = true;
+    }
+    if (!param->write.need_rsp)
         return;
+    prepare_rsp.attr_value.handle = param->write.handle;
+    prepare_rsp.attr_value.offset = offset;
+    prepare_rsp.attr_value.len = status == ESP_GATT_OK? len: 0;
+    prepare_rsp.attr_value.auth_req = ESP_GATT_AUTH_REQ_NONE;
+    memcpy(prepare_rsp.attr_value.value, param->write.value, prepare_rsp.attr_value.len);
+    esp_err_t err = esp_ble_gatts_send_response(gatts_if, param->write.conn_id, param->write.trans_id,
+                                                status, &prepare_rsp);
+    if (err != ESP_OK)
+        ESP_LOGE(TAG, "Send response error: %x", err);
+}
+
+// publishes the telemetry characteristic once per second, off the write path
+static void telemetry_timer(void *arg) {
+    static int64_t last_time;
+    static struct display_stats last_display;
+    static uint32_t last_lost, last_late, last_bytes, last_writes, last_wakeups;
+
+    int64_t now = esp_timer_get_time();
+    struct display_stats display;
+    display_get_stats(&display);
+    struct video_stats stats;
+    video_get_stats(&stats);
+    uint32_t lost = stats.packets.lost + stats.packets.corrupt + stats.packets.rejected;
+    uint32_t late = stats.late_dropped + stats.late_skipped;
+    uint32_t bytes = 0;
+    for(unsigned i = 0; i != TRANSPORT_COUNT; ++i) {
+        struct transport_stats transport;
+        transport_get_stats(i, &transport);
+        bytes += transport.bytes;
     }
-    
-    int64_t elapsed_us = now - last_report_time;
-    if (elapsed_us >= 1000000) {  // Report every second
-        float throughput_kbps = (bytes_received * 8.0f) / (elapsed_us / 1000.0f);
-        ESP_LOGI(TAG, "Throughput: %.2f kbps (%.2f KB/s), MTU: %d", 
-                 throughput_kbps, bytes_received / 1024.0f, current_mtu);
-        bytes_received = 0;
-        last_report_time = now;
+
+    struct telemetry_window window = {
+        .duration_ms = last_time? (uint32_t)((now - last_time) / 1000): 0,
+        .presented = display.presented - last_display.presented,
+        .dropped = display.dropped - last_display.dropped + late - last_late,
+        .lost = lost - last_lost,
+        .bytes = bytes - last_bytes,
+        .writes = stats.ingest_writes - last_writes,
+        .wakeups = stats.decode_wakeups - last_wakeups,
+    };
+    last_time = now;
+    last_display = display;
+    last_lost = lost;
+    last_late = late;
+    last_bytes = bytes;
+    last_writes = stats.ingest_writes;
+    last_wakeups = stats.decode_wakeups;
+
+    struct link_params link;
+    link_get_params(&link);
+    window.mtu = link.mtu;
+    window.rx_octets = link.rx_octets;
+    window.interval = link.interval;
+    window.rx_phy = link.rx_phy;
+    window.tx_phy = link.tx_phy;
+
+    uint32_t len = telemetry_build(telemetry_value, &window);
+    if (telemetry_handle)
+        esp_ble_gatts_set_attr_value(telemetry_handle, len, telemetry_value);
+    // a notification has to fit into a single ATT packet, smaller MTUs can still read it
+    bool up = connected;
+    uint16_t conn = conn_id;
+    uint32_t payload = current_mtu - 3u;
+    if (up && telemetry_notify && len <= payload)
+        esp_ble_gatts_send_indicate(gatts_if_id, conn, telemetry_handle, len, telemetry_value, false);
+
+    // echoes are taken even without a listener so the queue of timestamped frames keeps moving
+    bool sync = up && sync_notify;
+    bool echo = sync && payload >= GLASS_ECHO_HEADER_SIZE + GLASS_ECHO_SIZE;
+    while((len = glass_echo(sync_buffer, echo? payload: sizeof(sync_buffer))) != 0) {
+        if (echo)
+            esp_ble_gatts_send_indicate(gatts_if_id, conn, sync_handle, len, sync_buffer, false);
+    }
+    if (sync) {
+        len = glass_ping(sync_buffer, esp_timer_get_time());
+        esp_ble_gatts_send_indicate(gatts_if_id, conn, sync_handle, len, sync_buffer, false);
     }
+    pipeline_report();
+    transport_report();
+#if CONFIG_MOTOCAST_PIPELINE_BENCHMARK && CONFIG_MOTOCAST_DIRTY_TILES
+    static struct video_stats last_convert;
+    uint32_t full = stats.convert_full - last_convert.convert_full;
+    uint32_t partial = stats.convert_partial - last_convert.convert_partial;
+    uint32_t full_us = stats.convert_full_us - last_convert.convert_full_us;
+    uint32_t partial_us = stats.convert_partial_us - last_convert.convert_partial_us;
+    uint32_t total = stats.pixels_total - last_convert.pixels_total;
+    uint32_t drawn = stats.pixels_drawn - last_convert.pixels_drawn;
+    last_convert = stats;
+    // the saving is estimated from the full conversions of the same window
+    if (full + partial)
+        ESP_LOGI(TAG, "dirty tiles: %.1f%% of pixels skipped, %lu full avg %lu us, %lu partial avg %lu us, "
+            "%ld us saved per frame", total? 100.0f - drawn * 100.0f / total: 0.0f,
+            (unsigned long)full, (unsigned long)(full? full_us / full: 0),
+            (unsigned long)partial, (unsigned long)(partial? partial_us / partial: 0),
+            full? (long)(full_us / full) - (long)((full_us + partial_us) / (full + partial)): 0L);
+#endif
+}
+
+static void control_send(uint16_t conn, const uint8_t *msg, uint32_t len) {
+    if (len)
+        esp_ble_gatts_send_indicate(gatts_if_id, conn, control_handle, len, (uint8_t *)msg, false);
+}
+
+// back-channel to the sender, often enough for credits to keep the link busy
+static void control_timer(void *arg) {
+    if (!connected || !control_notify)
+        return;
+    uint16_t conn = conn_id;
+    struct video_stats stats;
+    video_get_stats(&stats);
+    int64_t now = esp_timer_get_time();
+    uint8_t msg[CONTROL_MAX_SIZE];
+    control_send(conn, msg, control_keyframe(msg, &stats, now));
+    control_send(conn, msg, control_credit(msg, &stats));
+    control_send(conn, msg, control_bitrate(msg, &stats, now));
 }
 
 static void gatts_event_handler(esp_gatts_cb_event_t event, esp_gatt_if_t gatts_if, 
@@ -176,8 +401,14 @@ static void gatts_event_handler(esp_gatts_cb_event_t event, esp_gatt_if_t gatts_
         case ESP_GATTS_CREAT_ATTR_TAB_EVT:
             if (param->add_attr_tab.status == ESP_GATT_OK) {
                 ESP_LOGI(TAG, "Attribute table created, handles: %d", param->add_attr_tab.num_handle);
-                gatts_handle = param->add_attr_tab.handles[2]; // Characteristic value handle
-                esp_ble_gatts_start_service(param->add_attr_tab.handles[0]);
+                gatts_handle = param->add_attr_tab.handles[IDX_VIDEO_VAL];
+                telemetry_handle = param->add_attr_tab.handles[IDX_TELEMETRY_VAL];
+                telemetry_cfg_handle = param->add_attr_tab.handles[IDX_TELEMETRY_CFG];
+                sync_handle = param->add_attr_tab.handles[IDX_SYNC_VAL];
+                sync_cfg_handle = param->add_attr_tab.handles[IDX_SYNC_CFG];
+                control_handle = param->add_attr_tab.handles[IDX_CONTROL_VAL];
+                control_cfg_handle = param->add_attr_tab.handles[IDX_CONTROL_CFG];
+                esp_ble_gatts_start_service(param->add_attr_tab.handles[IDX_SVC]);
             } else {
                 ESP_LOGE(TAG, "Create attribute table failed, error: 0x%x", param->add_attr_tab.status);
             }
@@ -186,125 +417,74 @@ static void gatts_event_handler(esp_gatts_cb_event_t event, esp_gatt_if_t gatts_
         case ESP_GATTS_CONNECT_EVT:
             ESP_LOGI(TAG, "Client connected, conn_id: %d", param->connect.conn_id);
             conn_id = param->connect.conn_id;
-            bytes_received = 0;
-            last_report_time = 0;
-            
-            // Request maximum MTU immediately
-            esp_ble_gatt_set_local_mtu(PREFERRED_MTU);
-            
-            // Request aggressive connection parameters for maximum throughput
-            esp_ble_conn_update_params_t conn_params = {0};
-            memcpy(conn_params.bda, param->connect.remote_bda, sizeof(esp_bd_addr_t));
+            connected = true;
+            telemetry_notify = false;
+            sync_notify = false;
+            control_notify = false;
             
-            // Connection interval: 7.5ms (minimum allowed by BLE spec for data transfer)
-            conn_params.min_int = 0x06;  // 6 * 1.25ms = 7.5ms
-            conn_params.max_int = 0x06;  // Keep it fixed for consistent performance
-            conn_params.latency = 0;     // No slave latency - respond to every event
-            conn_params.timeout = 400;   // 4 seconds supervision timeout
-            
-            esp_ble_gap_update_conn_params(&conn_params);
-            
-            ESP_LOGI(TAG, "Requesting connection interval: 7.5ms, latency: 0");
+            // 2M PHY, data length extension and a short connection interval, see link.h. The MTU
+            // is up to the client, the local maximum was set at startup.
+            link_connected(param->connect.remote_bda, param->connect.conn_params.interval,
+                           param->connect.conn_params.latency, param->connect.conn_params.timeout);
             break;
             
         case ESP_GATTS_DISCONNECT_EVT:
             ESP_LOGI(TAG, "Client disconnected, reason: 0x%x", param->disconnect.reason);
             current_mtu = 23;
-            bytes_received = 0;
-            last_report_time = 0;
+            connected = false;
+            telemetry_notify = false;
+            sync_notify = false;
+            control_notify = false;
+            prepare_len = 0;
+            prepare_failed = false;
+            link_disconnected();
             esp_ble_gap_start_advertising(&adv_params);
             break;
             
         case ESP_GATTS_MTU_EVT:
             current_mtu = param->mtu.mtu;
+            link_mtu(param->mtu.mtu);
             ESP_LOGI(TAG, "MTU Exchange complete: %d bytes (payload: %d bytes)", 
-                     current_mtu, current_mtu - 3);
+                     param->mtu.mtu, param->mtu.mtu - 3);
             break;
             
         case ESP_GATTS_WRITE_EVT:
-            if (!param->write.is_prep) {
-                // Regular write - count bytes for throughput
-                bytes_received += param->write.len;
-                report_throughput();
-                video_decode(param->write.value, param->write.len);
+            if (param->write.handle == telemetry_cfg_handle) {
+                // client characteristic configuration, answered by the stack
+                telemetry_notify = param->write.len == 2 && (param->write.value[0] & 1);
+                break;
             }
-            
-            esp_gatt_status_t status = ESP_GATT_OK;
-            
-            if (param->write.need_rsp) {
-                if (param->write.is_prep) {
-                    // Prepare write handling
-                    if (param->write.offset > PREPARE_BUF_MAX_SIZE) {
-                        status = ESP_GATT_INVALID_OFFSET;
-                    } else if ((param->write.offset + param->write.len) > PREPARE_BUF_MAX_SIZE) {
-                        status = ESP_GATT_INVALID_ATTR_LEN;
-                    }
-                    
-                    if (status == ESP_GATT_OK && prepare_write_env.prepare_buf == NULL) {
-                        prepare_write_env.prepare_buf = (uint8_t *)malloc(PREPARE_BUF_MAX_SIZE);
-                        prepare_write_env.prepare_len = 0;
-                        if (prepare_write_env.prepare_buf == NULL) {
-                            ESP_LOGE(TAG, "Prep buffer allocation failed");
-                            status = ESP_GATT_NO_RESOURCES;
-                        }
-                    }
-                    
-                    // Send response quickly to minimize round-trip time
-                    esp_gatt_rsp_t *gatt_rsp = (esp_gatt_rsp_t *)calloc(1, sizeof(esp_gatt_rsp_t));
-                    if (gatt_rsp) {
-                        gatt_rsp->attr_value.len = param->write.len;
-                        gatt_rsp->attr_value.handle = param->write.handle;
-                        gatt_rsp->attr_value.offset = param->write.offset;
-                        gatt_rsp->attr_value.auth_req = ESP_GATT_AUTH_REQ_NONE;
-                        memcpy(gatt_rsp->attr_value.value, param->write.value, param->write.len);
-                        
-                        esp_err_t response_err = esp_ble_gatts_send_response(gatts_if, 
-                            param->write.conn_id, param->write.trans_id, status, gatt_rsp);
-                        
-                        if (response_err != ESP_OK) {
-                            ESP_LOGE(TAG, "Send response error: %x", response_err);
-                        }
-                        free(gatt_rsp);
-                    } else {
-                        ESP_LOGE(TAG, "Response allocation failed");
-                        status = ESP_GATT_NO_RESOURCES;
-                    }
-                    
-                    if (status != ESP_GATT_OK) {
-                        return;
-                    }
-                    
-                    // Copy data to prepare buffer
-                    memcpy(prepare_write_env.prepare_buf + param->write.offset,
-                           param->write.value, param->write.len);
-                    prepare_write_env.prepare_len += param->write.len;
-                    
-                } else {
-                    // Regular write with response
-                    esp_ble_gatts_send_response(gatts_if, param->write.conn_id, 
-                                                param->write.trans_id, status, NULL);
-                }
+            if (param->write.handle == sync_cfg_handle) {
+                sync_notify = param->write.len == 2 && (param->write.value[0] & 1);
+                break;
+            }
+            if (param->write.handle == control_cfg_handle) {
+                control_notify = param->write.len == 2 && (param->write.value[0] & 1);
+                control_reset();
+                break;
+            }
+            if (param->write.handle == sync_handle) {
+                glass_receive(param->write.value, param->write.len, esp_timer_get_time());
+                break;
+            }
+            if (param->write.is_prep) {
+                prepare_write(gatts_if, param);
+                break;
             }
+            recorder_write(param->write.value, param->write.len);
+            transport_write(TRANSPORT_GATT, param->write.value, param->write.len);
+            if (param->write.need_rsp)
+                esp_ble_gatts_send_response(gatts_if, param->write.conn_id, param->write.trans_id, ESP_GATT_OK, NULL);
             break;
 
         case ESP_GATTS_EXEC_WRITE_EVT:
-            if (param->exec_write.exec_write_flag == ESP_GATT_PREP_WRITE_EXEC) {
-                ESP_LOGI(TAG, "Long write complete: %u bytes", prepare_write_env.prepare_len);
-                bytes_received += prepare_write_env.prepare_len;
-                report_throughput();
-                video_decode(prepare_write_env.prepare_buf, prepare_write_env.prepare_len);
-            } else {
-                ESP_LOGI(TAG, "Long write cancelled");
-            }
-            
-            if (prepare_write_env.prepare_buf) {
-                free(prepare_write_env.prepare_buf);
-                prepare_write_env.prepare_buf = NULL;
+            if (param->exec_write.exec_write_flag == ESP_GATT_PREP_WRITE_EXEC && prepare_len && !prepare_failed) {
+                recorder_write(prepare_buf, prepare_len);
+                transport_write(TRANSPORT_GATT_LONG, prepare_buf, prepare_len);
             }
-            prepare_write_env.prepare_len = 0;
-            
-            // Send response
-            esp_ble_gatts_send_response(gatts_if, param->exec_write.conn_id, 
+            prepare_len = 0;
+            prepare_failed = false;
+            esp_ble_gatts_send_response(gatts_if, param->exec_write.conn_id,
                                        param->exec_write.trans_id, ESP_GATT_OK, NULL);
             break;
             
@@ -314,6 +494,7 @@ static void gatts_event_handler(esp_gatts_cb_event_t event, esp_gatt_if_t gatts_
 }
 
 static void gap_event_handler(esp_gap_ble_cb_event_t event, esp_ble_gap_cb_param_t *param) {
+    link_gap_event(event, param);
     switch (event) {
         case ESP_GAP_BLE_ADV_DATA_SET_COMPLETE_EVT:
             adv_config_done &= (~ADV_CONFIG_FLAG);
@@ -342,7 +523,7 @@ static void gap_event_handler(esp_gap_ble_cb_event_t event, esp_ble_gap_cb_param
         case ESP_GAP_BLE_UPDATE_CONN_PARAMS_EVT:
             ESP_LOGI(TAG, "Connection params updated: status=%d, interval=%.2fms, latency=%d, timeout=%dms",
                      param->update_conn_params.status,
-                     param->update_conn_params.min_int * 1.25,
+                     param->update_conn_params.conn_int * 1.25,
                      param->update_conn_params.latency,
                      param->update_conn_params.timeout * 10);
             break;
@@ -352,12 +533,11 @@ static void gap_event_handler(esp_gap_ble_cb_event_t event, esp_ble_gap_cb_param
     }
 }
 
-extern void waveshare_init(void);
-
 void app_main(void) {
     esp_err_t ret;
 
     waveshare_init();
+    recorder_init();
     
     ret = nvs_flash_init();
     if (ret == ESP_ERR_NVS_NO_FREE_PAGES || ret == ESP_ERR_NVS_NEW_VERSION_FOUND) {
@@ -396,10 +576,28 @@ void app_main(void) {
     // Set maximum MTU early
     esp_ble_gatt_set_local_mtu(PREFERRED_MTU);
     
+    link_init();
+    transport_init(video_write);
     esp_ble_gatts_register_callback(gatts_event_handler);
     esp_ble_gap_register_callback(gap_event_handler);
     
     esp_ble_gatts_app_register(0);
+
+    const esp_timer_create_args_t telemetry_timer_args = {
+        .callback = telemetry_timer,
+        .name = "telemetry",
+    };
+    esp_timer_handle_t telemetry_timer_handle;
+    ESP_ERROR_CHECK(esp_timer_create(&telemetry_timer_args, &telemetry_timer_handle));
+    ESP_ERROR_CHECK(esp_timer_start_periodic(telemetry_timer_handle, 1000000));
+
+    const esp_timer_create_args_t control_timer_args = {
+        .callback = control_timer,
+        .name = "control",
+    };
+    esp_timer_handle_t control_timer_handle;
+    ESP_ERROR_CHECK(esp_timer_create(&control_timer_args, &control_timer_handle));
+    ESP_ERROR_CHECK(esp_timer_start_periodic(control_timer_handle, 100000));
     
     ESP_LOGI(TAG, "BLE High-Throughput Receiver initialized");
     ESP_LOGI(TAG, "Device: %s | Max MTU: %d | Payload: %d bytes", 
@@ -4,6 +4,8 @@
 #include "esp_lcd_panel_ops.h"
 #include "esp_lcd_panel_rgb.h"
 #include "esp_log.h"
+#include "board.h"
+#include "display.h"
 #include "video.h"
 
 #define I2C_MASTER_NUM (0)
@@ -69,9 +71,9 @@ void waveshare_init(void) {
     esp_lcd_rgb_panel_config_t panel_config = {
         .clk_src = LCD_CLK_SRC_DEFAULT, // Set the clock source for the panel
         .timings =  {
-            .pclk_hz = 16000000, // Pixel clock frequency
-            .h_res = 800, // Horizontal resolution
-            .v_res = 480, // Vertical resolution
+            .pclk_hz = BOARD_LCD_PCLK_HZ, // Pixel clock frequency
+            .h_res = BOARD_LCD_H_RES, // Horizontal resolution
+            .v_res = BOARD_LCD_V_RES, // Vertical resolution
             .hsync_pulse_width = 4, // Horizontal sync pulse width
             .hsync_back_porch = 8, // Horizontal back porch
             .hsync_front_porch = 8, // Horizontal front porch
@@ -84,8 +86,8 @@ void waveshare_init(void) {
         },
         .data_width = 16, // Data width for RGB
         .bits_per_pixel = 16, // Bits per pixel
-        .num_fbs = 2, // Number of frame buffers
-        .bounce_buffer_size_px = 16 * 800, // Bounce buffer size in pixels * width
+        .num_fbs = BOARD_LCD_NUM_FBS, // Number of frame buffers
+        .bounce_buffer_size_px = BOARD_LCD_BOUNCE_ROWS * BOARD_LCD_H_RES, // Bounce buffer size in pixels * width
         .sram_trans_align = 4, // SRAM transaction alignment
         .psram_trans_align = 64, // PSRAM transaction alignment
         .hsync_gpio_num = GPIO_NUM_46, // GPIO number for horizontal sync
@@ -112,7 +114,11 @@ void waveshare_init(void) {
             GPIO_NUM_40,
             },
         .flags = {
+#if CONFIG_MOTOCAST_YUV_SCANOUT
+            .no_fb = 1, // bounce buffers are filled from I420 pictures, see display.c
+#else
             .fb_in_psram = 1, // Use PSRAM for framebuffer
+#endif
         },
     };
     ESP_ERROR_CHECK(esp_lcd_new_rgb_panel(&panel_config, &panel_handle));
@@ -120,5 +126,6 @@ void waveshare_init(void) {
     ESP_ERROR_CHECK(esp_lcd_panel_init(panel_handle)); // Initialize the LCD panel
 
     waveshare_rgb_lcd_bl_on();
+    display_init();
     video_init();
 }
@@ -0,0 +1,145 @@
+#include "capture.h"
+#include <string.h>
+
+// length value marking the rest of the buffer as unused, the next record is at the start
+#define CAPTURE_WRAP 0xffff
+
+static void write_le16(uint8_t *dst, uint16_t value) {
+    dst[0] = value;
+    dst[1] = value >> 8;
+}
+
+static void write_le32(uint8_t *dst, uint32_t value) {
+    dst[0] = value;
+    dst[1] = value >> 8;
+    dst[2] = value >> 16;
+    dst[3] = value >> 24;
+}
+
+static uint16_t read_le16(const uint8_t *src) {
+    return src[0] | (src[1] << 8);
+}
+
+static uint32_t read_le32(const uint8_t *src) {
+    return src[0] | (src[1] << 8) | (src[2] << 16) | ((uint32_t)src[3] << 24);
+}
+
+void capture_init(struct capture *c, uint8_t *data, uint32_t size) {
+    c->data = data;
+    c->size = size;
+    capture_clear(c);
+}
+
+void capture_clear(struct capture *c) {
+    c->head = c->tail = 0;
+    c->records = 0;
+    c->bytes = 0;
+    c->evicted = 0;
+    c->last_time = 0;
+}
+
+// position of the record at pos, following a wrap marker or a tail too short for a header
+static uint32_t capture_resolve(const struct capture *c, uint32_t pos) {
+    if (c->size - pos < CAPTURE_RECORD_HEADER || read_le16(c->data + pos + 4) == CAPTURE_WRAP)
+        return 0;
+    return pos;
+}
+
+static void capture_evict(struct capture *c) {
+    uint32_t pos = capture_resolve(c, c->tail);
+    uint16_t len = read_le16(c->data + pos + 4);
+    c->tail = pos + CAPTURE_RECORD_HEADER + len;
+    c->bytes -= len;
+    ++c->evicted;
+    if (!--c->records)
+        c->head = c->tail = 0;
+}
+
+void capture_record(struct capture *c, int64_t time_us, const uint8_t *data, uint32_t len) {
+    uint32_t n = CAPTURE_RECORD_HEADER + len;
+    if (len >= CAPTURE_WRAP || n > c->size)
+        return;
+
+    for(;;) {
+        if (!c->records)
+            c->head = c->tail = 0;
+        if (c->head > c->tail || !c->records) {
+            // free space at the end and before the oldest record
+            if (c->size - c->head >= n)
+                break;
+            if (c->tail >= n) {
+                if (c->size - c->head >= CAPTURE_RECORD_HEADER)
+                    write_le16(c->data + c->head + 4, CAPTURE_WRAP);
+                c->head = 0;
+                break;
+            }
+        } else if (c->tail - c->head >= n) {
+            break;
+        }
+        capture_evict(c);
+    }
+
+    uint8_t *dst = c->data + c->head;
+    write_le32(dst, c->records? (uint32_t)(time_us - c->last_time): 0);
+    write_le16(dst + 4, len);
+    memcpy(dst + CAPTURE_RECORD_HEADER, data, len);
+    c->head += n;
+    c->last_time = time_us;
+    c->bytes += len;
+    ++c->records;
+}
+
+void capture_for_each(const struct capture *c, capture_record_fn fn, void *ctx) {
+    uint32_t pos = c->tail;
+    for(uint32_t i = 0; i != c->records; ++i) {
+        pos = capture_resolve(c, pos);
+        uint16_t len = read_le16(c->data + pos + 4);
+        // the first record's delta refers to an evicted one
+        fn(ctx, i? read_le32(c->data + pos): 0, c->data + pos + CAPTURE_RECORD_HEADER, len);
+        pos += CAPTURE_RECORD_HEADER + len;
+    }
+}
+
+uint32_t capture_serialised_size(const struct capture *c) {
+    return CAPTURE_HEADER_SIZE + c->records * CAPTURE_RECORD_HEADER + c->bytes;
+}
+
+struct serialise_ctx {
+    capture_write_fn fn;
+    void *ctx;
+    bool ok;
+};
+
+static void serialise_record(void *ctx, uint32_t delta_us, const uint8_t *data, uint32_t len) {
+    struct serialise_ctx *s = ctx;
+    uint8_t header[CAPTURE_RECORD_HEADER];
+    write_le32(header, delta_us);
+    write_le16(header + 4, len);
+    s->ok = s->ok && s->fn(s->ctx, header, sizeof(header)) && s->fn(s->ctx, data, len);
+}
+
+bool capture_serialise(const struct capture *c, capture_write_fn fn, void *ctx) {
+    uint8_t header[CAPTURE_HEADER_SIZE] = CAPTURE_MAGIC;
+    header[4] = CAPTURE_VERSION;
+    write_le32(header + 8, c->records);
+    struct serialise_ctx s = {fn, ctx, fn(ctx, header, sizeof(header))};
+    capture_for_each(c, serialise_record, &s);
+    return s.ok;
+}
+
+bool capture_parse(const uint8_t *data, uint32_t len, capture_record_fn fn, void *ctx) {
+    if (len < CAPTURE_HEADER_SIZE || memcmp(data, CAPTURE_MAGIC, 4) || data[4] != CAPTURE_VERSION)
+        return false;
+    uint32_t records = read_le32(data + 8);
+    uint32_t pos = CAPTURE_HEADER_SIZE;
+    for(uint32_t i = 0; i != records; ++i) {
+        if (len - pos < CAPTURE_RECORD_HEADER)
+            return false;
+        uint16_t n = read_le16(data + pos + 4);
+        if (len - pos - CAPTURE_RECORD_HEADER < n)
+            return false;
+        fn(ctx, read_le32(data + pos), data + pos + CAPTURE_RECORD_HEADER, n);
+        pos += CAPTURE_RECORD_HEADER + n;
+    }
+    return true;
+}
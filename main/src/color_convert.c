@@ -0,0 +1,314 @@
+#include "color_convert.h"
+#include "platform.h"
+#include <math.h>
+#include <stdbool.h>
+
+static const char *TAG = "color";
+
+#ifndef CONFIG_MOTOCAST_COLOR_GAMMA
+#define CONFIG_MOTOCAST_COLOR_GAMMA 100     // formula builds only use the LUT engine for benchmarks
+#endif
+
+#if CONFIG_MOTOCAST_COLOR_MATRIX_BT601_FULL
+#define COLOR_MATRIX_DEFAULT COLOR_BT601_FULL
+#elif CONFIG_MOTOCAST_COLOR_MATRIX_BT709_LIMITED
+#define COLOR_MATRIX_DEFAULT COLOR_BT709_LIMITED
+#elif CONFIG_MOTOCAST_COLOR_MATRIX_BT709_FULL
+#define COLOR_MATRIX_DEFAULT COLOR_BT709_FULL
+#else
+#define COLOR_MATRIX_DEFAULT COLOR_BT601_LIMITED
+#endif
+
+// 8-bit fixed point, R = gain * (Y - offset) + rv * V, G = ... - gu * U - gv * V, B = ... + bu * U
+// with U, V centred on 0. Limited range scales Y by 255/219 and chroma by 255/224.
+struct color_coeffs {
+    int16_t y_offset, y_gain;
+    int16_t rv, gu, gv, bu;
+};
+
+static const struct color_coeffs color_coeffs[COLOR_MATRIX_COUNT] = {
+    [COLOR_BT601_LIMITED] = {16, 298, 409, 100, 208, 516},
+    [COLOR_BT601_FULL]    = { 0, 256, 359,  88, 183, 454},
+    [COLOR_BT709_LIMITED] = {16, 298, 459,  55, 136, 541},
+    [COLOR_BT709_FULL]    = { 0, 256, 403,  48, 120, 475},
+};
+
+static const char *const color_matrix_names[COLOR_MATRIX_COUNT] = {
+    "BT.601 limited range", "BT.601 full range", "BT.709 limited range", "BT.709 full range",
+};
+
+static enum color_matrix matrix = COLOR_MATRIX_DEFAULT;
+#ifdef HAVE_ESP32S3
+static bool simd_ok = true;     // cleared by a failed color_convert_selftest()
+#endif
+
+static inline int clamp_u8(int x) {
+    return x < 0? 0: x > 255? 255: x;
+}
+
+// Sums stay far inside int, only the result is clamped. Y below the limited range's black is
+// taken as black before adding chroma, like the PIE kernel does.
+static inline uint16_t yuv_to_rgb565(const struct color_coeffs *c, int y, int u, int v) {
+    y = y < c->y_offset? 0: c->y_gain * (y - c->y_offset);
+    int r = clamp_u8((y + c->rv * v + 128) >> 8);
+    int g = clamp_u8((y - c->gu * u - c->gv * v + 128) >> 8);
+    int b = clamp_u8((y + c->bu * u + 128) >> 8);
+    return ((r >> 3) << 11) | ((g >> 2) << 5) | (b >> 3);
+}
+
+// inlined into one kernel per matrix, which leaves the coefficients as constants
+static inline __attribute__((always_inline)) void i420_to_rgb565_row2_formula(const struct color_coeffs *c,
+    const uint8_t *y0, const uint8_t *y1, const uint8_t *u, const uint8_t *v,
+    uint16_t *dst0, uint16_t *dst1, uint32_t width) {
+    for(uint32_t j = 0; j < width; j += 2) {
+        int t_u = *u++ - 128;
+        int t_v = *v++ - 128;
+        dst0[j] = yuv_to_rgb565(c, y0[j], t_u, t_v);
+        dst1[j] = yuv_to_rgb565(c, y1[j], t_u, t_v);
+        if (j + 1 < width) {
+            dst0[j + 1] = yuv_to_rgb565(c, y0[j + 1], t_u, t_v);
+            dst1[j + 1] = yuv_to_rgb565(c, y1[j + 1], t_u, t_v);
+        }
+    }
+}
+
+#define COLOR_FORMULA_KERNEL(name, m) \
+    static void name(const uint8_t *y0, const uint8_t *y1, const uint8_t *u, const uint8_t *v, \
+        uint16_t *dst0, uint16_t *dst1, uint32_t width, uint32_t x, uint32_t y) { \
+        i420_to_rgb565_row2_formula(&color_coeffs[m], y0, y1, u, v, dst0, dst1, width); \
+    }
+
+COLOR_FORMULA_KERNEL(i420_to_rgb565_row2_bt601_limited, COLOR_BT601_LIMITED)
+COLOR_FORMULA_KERNEL(i420_to_rgb565_row2_bt601_full, COLOR_BT601_FULL)
+COLOR_FORMULA_KERNEL(i420_to_rgb565_row2_bt709_limited, COLOR_BT709_LIMITED)
+COLOR_FORMULA_KERNEL(i420_to_rgb565_row2_bt709_full, COLOR_BT709_FULL)
+
+static const i420_to_rgb565_row2_t formula_kernels[COLOR_MATRIX_COUNT] = {
+    [COLOR_BT601_LIMITED] = i420_to_rgb565_row2_bt601_limited,
+    [COLOR_BT601_FULL] = i420_to_rgb565_row2_bt601_full,
+    [COLOR_BT709_LIMITED] = i420_to_rgb565_row2_bt709_limited,
+    [COLOR_BT709_FULL] = i420_to_rgb565_row2_bt709_full,
+};
+
+i420_to_rgb565_row2_t i420_to_rgb565_formula(enum color_matrix m) {
+    return formula_kernels[m];
+}
+
+// Channel sums are in half steps of 8 bits and index the output tables from LUT_MIN on, which
+// covers blue of black with the lowest U up to blue of white with the highest U, BT.709 limited
+// range having the largest coefficients.
+#define LUT_MIN (-544)
+#define LUT_MAX 1096
+#define LUT_FRACTION 4          // output table bits below one RGB565 step, the dither's resolution
+
+// static, so in internal RAM, about 9 KB
+static struct {
+    int16_t y[256], rv[256], gu[256], gv[256], bu[256];
+    // clamped, gamma corrected and scaled to 31 and 63 RGB565 steps, in 1/16 steps. Adding a
+    // threshold below 16 can't carry past the top step.
+    uint16_t rb[LUT_MAX - LUT_MIN], g[LUT_MAX - LUT_MIN];
+} lut;
+
+#if CONFIG_MOTOCAST_COLOR_DITHER
+// 4x4 Bayer matrix, thresholds in 1/16 RGB565 steps
+static const uint8_t lut_dither[4][4] = {
+    { 0,  8,  2, 10},
+    {12,  4, 14,  6},
+    { 3, 11,  1,  9},
+    {15,  7, 13,  5},
+};
+#else
+static const uint8_t lut_round[4] = {8, 8, 8, 8};
+#endif
+
+// the matrix's coefficients, rounded to half steps
+static void color_lut_matrix(const struct color_coeffs *c) {
+    for(int i = 0; i != 256; ++i) {
+        int chroma = i - 128, ty = i < c->y_offset? 0: i - c->y_offset;
+        lut.y[i] = (c->y_gain * ty + 64) >> 7;
+        lut.rv[i] = (c->rv * chroma + 64) >> 7;
+        lut.gu[i] = (-c->gu * chroma + 64) >> 7;
+        lut.gv[i] = (-c->gv * chroma + 64) >> 7;
+        lut.bu[i] = (c->bu * chroma + 64) >> 7;
+    }
+}
+
+void color_convert_init(void) {
+    color_lut_matrix(&color_coeffs[matrix]);
+    const double gamma = CONFIG_MOTOCAST_COLOR_GAMMA / 100.0;
+    for(int i = LUT_MIN; i != LUT_MAX; ++i) {
+        double level = pow((i < 0? 0: i > 510? 510: i) / 510.0, gamma);
+        lut.rb[i - LUT_MIN] = lrint(level * (31 << LUT_FRACTION));
+        lut.g[i - LUT_MIN] = lrint(level * (63 << LUT_FRACTION));
+    }
+}
+
+void color_convert_set_matrix(enum color_matrix m) {
+    if (m == matrix)
+        return;
+    matrix = m;
+    color_lut_matrix(&color_coeffs[m]);
+}
+
+enum color_matrix color_convert_matrix(void) {
+    return matrix;
+}
+
+const char *color_matrix_name(enum color_matrix m) {
+    return color_matrix_names[m];
+}
+
+static inline uint16_t lut_pixel(int y, int r, int g, int b, unsigned threshold) {
+    int ty = lut.y[y];
+    return ((lut.rb[ty + r - LUT_MIN] + threshold) >> LUT_FRACTION << 11) |
+        ((lut.g[ty + g - LUT_MIN] + threshold) >> LUT_FRACTION << 5) |
+        ((lut.rb[ty + b - LUT_MIN] + threshold) >> LUT_FRACTION);
+}
+
+void i420_to_rgb565_row2_lut(const uint8_t *y0, const uint8_t *y1, const uint8_t *u, const uint8_t *v,
+    uint16_t *dst0, uint16_t *dst1, uint32_t width, uint32_t x, uint32_t y) {
+#if CONFIG_MOTOCAST_COLOR_DITHER
+    const uint8_t *d0 = lut_dither[y & 3], *d1 = lut_dither[(y + 1) & 3];
+#else
+    const uint8_t *d0 = lut_round, *d1 = lut_round;
+#endif
+    for(uint32_t j = 0; j < width; j += 2) {
+        int r = lut.rv[*v], g = lut.gu[*u] + lut.gv[*v], b = lut.bu[*u];
+        ++u;
+        ++v;
+        // row 0 last, it's the one that counts if dst1 aliases dst0
+        unsigned k = (x + j) & 3;
+        dst1[j] = lut_pixel(y1[j], r, g, b, d1[k]);
+        dst0[j] = lut_pixel(y0[j], r, g, b, d0[k]);
+        if (j + 1 < width) {
+            k = (k + 1) & 3;
+            dst1[j + 1] = lut_pixel(y1[j + 1], r, g, b, d1[k]);
+            dst0[j + 1] = lut_pixel(y0[j + 1], r, g, b, d0[k]);
+        }
+    }
+}
+
+i420_to_rgb565_row2_t i420_to_rgb565_portable_kernel(void) {
+#if CONFIG_MOTOCAST_COLOR_LUT
+    return i420_to_rgb565_row2_lut;
+#else
+    return formula_kernels[matrix];
+#endif
+}
+
+i420_to_rgb565_row2_t i420_to_rgb565_kernel(const uint8_t *yuv, uint32_t width, uint32_t height,
+    const uint16_t *dst, uint32_t dst_stride) {
+#if !CONFIG_MOTOCAST_COLOR_LUT && defined(HAVE_ESP32S3)
+    // table lookups don't vectorise, PIE has no gather. Other matrices' coefficients would
+    // overflow its 16-bit lanes.
+    uint32_t chroma_offset = width * height;
+    if (simd_ok && matrix == COLOR_BT601_LIMITED && width % 16 == 0 && dst_stride % 8 == 0 && (uintptr_t)yuv % 16 == 0 &&
+        (uintptr_t)dst % 16 == 0 && chroma_offset % 16 == 0 && (chroma_offset / 4) % 8 == 0)
+        return i420_to_rgb565_row2_esp32s3;
+#endif
+    return i420_to_rgb565_portable_kernel();
+}
+
+void i420_to_rgb565(const uint8_t *yuv, uint32_t width, uint32_t height, uint16_t *dst, uint32_t dst_stride) {
+    const uint32_t cwidth = (width + 1) / 2;
+    const uint8_t *Y = yuv;
+    const uint8_t *U = Y + width * height;
+    const uint8_t *V = U + cwidth * ((height + 1) / 2);
+    i420_to_rgb565_row2_t kernel = i420_to_rgb565_kernel(yuv, width, height, dst, dst_stride);
+    for(uint32_t i = 0; i < height; i += 2) {
+        // odd height: convert the last row onto itself
+        uint32_t next = i + 1 < height? 1: 0;
+        kernel(Y, Y + next * width, U, V, dst, dst + next * dst_stride, width, 0, i);
+        Y += 2 * width;
+        U += cwidth;
+        V += cwidth;
+        dst += 2 * dst_stride;
+    }
+}
+
+#define BENCH_WIDTH 320
+#define BENCH_PAIRS 1000
+
+void color_convert_benchmark(void) {
+    static uint8_t yuv[3 * BENCH_WIDTH] __attribute__((aligned(16)));
+    static uint16_t dst[2][BENCH_WIDTH] __attribute__((aligned(16)));
+    const struct {
+        const char *name;
+        i420_to_rgb565_row2_t kernel;
+    } kernels[] = {
+        {"formula", i420_to_rgb565_formula(matrix)},
+#ifdef HAVE_ESP32S3
+        {"formula PIE", i420_to_rgb565_row2_esp32s3},
+#endif
+        {"LUT", i420_to_rgb565_row2_lut},
+    };
+    // a grey ramp under a hue sweep
+    uint8_t *u = yuv + 2 * BENCH_WIDTH, *v = u + BENCH_WIDTH / 2;
+    for(uint32_t i = 0; i != 2 * BENCH_WIDTH; ++i)
+        yuv[i] = i * 255 / (2 * BENCH_WIDTH - 1);
+    for(uint32_t i = 0; i != BENCH_WIDTH / 2; ++i) {
+        u[i] = i * 255 / (BENCH_WIDTH / 2 - 1);
+        v[i] = 255 - u[i];
+    }
+    for(unsigned k = 0; k != sizeof(kernels) / sizeof(kernels[0]); ++k) {
+        int64_t start = platform_time_us();
+        for(uint32_t i = 0; i != BENCH_PAIRS; ++i)
+            kernels[k].kernel(yuv, yuv + BENCH_WIDTH, u, v, dst[0], dst[1], BENCH_WIDTH, 0, 2 * i);
+        int64_t elapsed = platform_time_us() - start;
+        PLATFORM_LOGI(TAG, "%-11s %6.2f ns per pixel", kernels[k].name,
+            elapsed * 1000.0 / (2 * BENCH_WIDTH * BENCH_PAIRS));
+    }
+}
+
+#define SELFTEST_WIDTH 256
+#define SELFTEST_PAIRS 512      // row pairs, every U, V pair once
+
+bool color_convert_selftest(void) {
+#ifdef HAVE_ESP32S3
+    // one allocation holding y0, y1, u, v and both kernels' rows, 16-byte aligned by hand
+    uint8_t *mem = platform_alloc(3 * SELFTEST_WIDTH + 4 * SELFTEST_WIDTH * sizeof(uint16_t) + 15,
+        PLATFORM_MEM_INTERNAL);
+    if (!mem)
+        return false;
+    uint8_t *y0 = (uint8_t *)(((uintptr_t)mem + 15) & ~(uintptr_t)15), *y1 = y0 + SELFTEST_WIDTH;
+    uint8_t *u = y1 + SELFTEST_WIDTH, *v = u + SELFTEST_WIDTH / 2;
+    uint16_t *ref = (uint16_t *)(v + SELFTEST_WIDTH / 2), *pie = ref + 2 * SELFTEST_WIDTH;
+    i420_to_rgb565_row2_t formula = formula_kernels[COLOR_BT601_LIMITED];
+
+    // a test picture of every U, V pair under Y ramps shifting from row pair to row pair
+    uint32_t mismatches = 0;
+    int64_t start = platform_time_us();
+    for(uint32_t p = 0; p != SELFTEST_PAIRS; ++p) {
+        for(uint32_t x = 0; x != SELFTEST_WIDTH; ++x) {
+            y0[x] = x + p;
+            y1[x] = 255 - x + 3 * p;
+        }
+        for(uint32_t c = 0; c != SELFTEST_WIDTH / 2; ++c) {
+            uint32_t k = p * (SELFTEST_WIDTH / 2) + c;
+            u[c] = k;
+            v[c] = k >> 8;
+        }
+        formula(y0, y1, u, v, ref, ref + SELFTEST_WIDTH, SELFTEST_WIDTH, 0, 2 * p);
+        i420_to_rgb565_row2_esp32s3(y0, y1, u, v, pie, pie + SELFTEST_WIDTH, SELFTEST_WIDTH, 0, 2 * p);
+        for(uint32_t i = 0; i != 2 * SELFTEST_WIDTH; ++i) {
+            if (pie[i] == ref[i])
+                continue;
+            if (!mismatches++) {
+                uint32_t x = i % SELFTEST_WIDTH;
+                PLATFORM_LOGE(TAG, "PIE conversion of Y %u U %u V %u is %04x, the formula's %04x",
+                    (i < SELFTEST_WIDTH? y0: y1)[x], u[x / 2], v[x / 2], pie[i], ref[i]);
+            }
+        }
+    }
+    int64_t elapsed = platform_time_us() - start;
+    platform_free(mem);
+    if (mismatches) {
+        PLATFORM_LOGE(TAG, "PIE conversion differs in %lu of %u pixels, using the C kernel",
+            (unsigned long)mismatches, 2 * SELFTEST_WIDTH * SELFTEST_PAIRS);
+        simd_ok = false;
+        return false;
+    }
+    PLATFORM_LOGI(TAG, "PIE conversion matches the formula, %lld us", (long long)elapsed);
+#endif
+    return true;
+}
@@ -0,0 +1,105 @@
+#include "control.h"
+#include <stdbool.h>
+
+static uint32_t credit_limit, credit_queued;
+static int64_t keyframe_time;
+static int64_t bitrate_time;
+static struct video_stats bitrate_stats;
+
+static void write_le16(uint8_t *dst, uint32_t value) {
+    if (value > 0xffff)
+        value = 0xffff;
+    dst[0] = value;
+    dst[1] = value >> 8;
+}
+
+static void write_le32(uint8_t *dst, uint32_t value) {
+    dst[0] = value;
+    dst[1] = value >> 8;
+    dst[2] = value >> 16;
+    dst[3] = value >> 24;
+}
+
+void control_reset(void) {
+    credit_limit = credit_queued = 0;
+    keyframe_time = 0;
+    bitrate_time = 0;
+}
+
+uint32_t control_credit(uint8_t dst[CONTROL_MAX_SIZE], const struct video_stats *stats) {
+    uint32_t limit = stats->ring_consumed + stats->ring_size;
+    if (limit == credit_limit && stats->ring_used == credit_queued)
+        return 0;
+    credit_limit = limit;
+    credit_queued = stats->ring_used;
+
+    dst[0] = CONTROL_CREDIT;
+    dst[1] = stats->behind? CONTROL_FLAG_BEHIND: 0;
+    uint32_t free_buffers = stats->pool_count - stats->pool_in_use;
+    dst[2] = free_buffers < 0xff? free_buffers: 0xff;
+    dst[3] = 0;
+    write_le32(dst + 4, stats->ring_accepted);
+    write_le32(dst + 8, limit);
+    write_le32(dst + 12, stats->ring_used);
+    return CONTROL_CREDIT_SIZE;
+}
+
+uint32_t control_keyframe(uint8_t dst[CONTROL_MAX_SIZE], const struct video_stats *stats, int64_t now) {
+    if (stats->keyframe_reason == VIDEO_KEYFRAME_NONE) {
+        keyframe_time = 0;
+        return 0;
+    }
+    // the sender needs time to produce one, the first one may still be in flight
+    if (keyframe_time && now - keyframe_time < CONTROL_KEYFRAME_INTERVAL)
+        return 0;
+    keyframe_time = now;
+
+    dst[0] = CONTROL_KEYFRAME;
+    dst[1] = stats->keyframe_reason;
+    write_le16(dst + 2, stats->last_seq);
+    return CONTROL_KEYFRAME_SIZE;
+}
+
+uint32_t control_bitrate(uint8_t dst[CONTROL_MAX_SIZE], const struct video_stats *stats, int64_t now) {
+    if (!bitrate_time) {
+        bitrate_time = now;
+        bitrate_stats = *stats;
+        return 0;
+    }
+    int64_t window = now - bitrate_time;
+    if (window < CONTROL_BITRATE_INTERVAL)
+        return 0;
+
+    uint32_t bytes = stats->ring_accepted - bitrate_stats.ring_accepted;
+    uint32_t pictures = stats->pictures - bitrate_stats.pictures;
+    uint32_t busy = (stats->decode_us - bitrate_stats.decode_us) + (stats->convert_us - bitrate_stats.convert_us);
+    bool overrun = stats->late_dropped != bitrate_stats.late_dropped ||
+        stats->ring_dropped_writes != bitrate_stats.ring_dropped_writes;
+    bitrate_time = now;
+    bitrate_stats = *stats;
+    if (!bytes || !pictures)
+        return 0;
+
+    uint32_t measured = (uint32_t)((uint64_t)bytes * 8 * 1000000 / window);
+    uint32_t load = (uint32_t)((uint64_t)busy * 1000 / window);
+    // decode time grows with the bitrate, aim for the target load
+    uint64_t target = measured;
+    if (load > CONTROL_LOAD_HIGH)
+        target = (uint64_t)measured * CONTROL_LOAD_TARGET / load;
+    else if (overrun)
+        target = (uint64_t)measured * 3 / 4;
+    else if (load < CONTROL_LOAD_LOW)
+        target = load? (uint64_t)measured * CONTROL_LOAD_TARGET / load: (uint64_t)measured * 5 / 4;
+    // raise it in steps, a wrong guess shouldn't cost more than a quarter
+    if (target > (uint64_t)measured * 5 / 4)
+        target = (uint64_t)measured * 5 / 4;
+
+    dst[0] = CONTROL_BITRATE;
+    dst[1] = dst[2] = dst[3] = 0;
+    write_le32(dst + 4, (uint32_t)target);
+    write_le32(dst + 8, measured);
+    write_le32(dst + 12, busy / pictures);
+    write_le16(dst + 16, load);
+    write_le16(dst + 18, (uint32_t)((uint64_t)pictures * 1000000 / window));
+    return CONTROL_BITRATE_SIZE;
+}
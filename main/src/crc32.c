@@ -0,0 +1,33 @@
+#include "crc32.h"
+
+#ifdef ESP_PLATFORM
+
+#include "esp_rom_crc.h"
+
+uint32_t crc32_update(uint32_t crc, const uint8_t *data, uint32_t len) {
+    return esp_rom_crc32_le(crc, data, len);
+}
+
+#else
+
+static uint32_t crc32_table[256];
+
+static void crc32_init_table(void) {
+    for(uint32_t i = 0; i != 256; ++i) {
+        uint32_t c = i;
+        for(unsigned k = 0; k != 8; ++k)
+            c = (c & 1)? 0xedb88320u ^ (c >> 1): c >> 1;
+        crc32_table[i] = c;
+    }
+}
+
+uint32_t crc32_update(uint32_t crc, const uint8_t *data, uint32_t len) {
+    if (!crc32_table[1])
+        crc32_init_table();
+    crc = ~crc;
+    while(len--)
+        crc = crc32_table[(crc ^ *data++) & 0xff] ^ (crc >> 8);
+    return ~crc;
+}
+
+#endif
@@ -0,0 +1,71 @@
+#include "dirty.h"
+#include <string.h>
+
+#define MIN(a, b) ((a) < (b)? (a): (b))
+
+// FNV-1a over 32-bit words. Both steps are bijective, so a single changed word always changes the
+// hash, but changes to several words can cancel out and go unnoticed.
+static uint32_t dirty_hash(uint32_t h, const uint8_t *p, uint32_t stride, uint32_t w, uint32_t rows) {
+    for(uint32_t y = 0; y != rows; ++y, p += stride) {
+        uint32_t x = 0;
+        for(; x + 4 <= w; x += 4) {
+            uint32_t v;
+            memcpy(&v, p + x, sizeof(v));
+            h = (h ^ v) * 16777619u;
+        }
+        for(; x != w; ++x)
+            h = (h ^ p[x]) * 16777619u;
+    }
+    return h;
+}
+
+bool dirty_init(struct dirty_map *d, uint32_t width, uint32_t height) {
+    memset(d, 0, sizeof(*d));
+    d->width = width;
+    d->height = height;
+    d->cols = (width + SCALER_TILE - 1) / SCALER_TILE;
+    d->rows = (height + SCALER_TILE - 1) / SCALER_TILE;
+    return width && height && d->cols <= SCALER_MAX_TILE_COLS && d->rows <= SCALER_MAX_BANDS;
+}
+
+uint32_t dirty_update(struct dirty_map *d, const uint8_t *yuv, bool refresh) {
+    const uint32_t w = d->width, h = d->height, cw = (w + 1) / 2, ch = (h + 1) / 2;
+    const uint8_t *U = yuv + w * h, *V = U + cw * ch;
+    const uint32_t T = SCALER_TILE, CT = SCALER_TILE / 2;
+    if (!d->serial++)
+        refresh = true;
+    if (refresh)
+        d->refreshed = d->serial;
+    for(uint32_t r = 0; r != d->rows; ++r) {
+        uint32_t rows = MIN(T, h - r * T), crows = MIN(CT, ch - r * CT);
+        for(uint32_t c = 0; c != d->cols; ++c) {
+            uint32_t cols = MIN(T, w - c * T), ccols = MIN(CT, cw - c * CT);
+            uint32_t hash = dirty_hash(2166136261u, yuv + r * T * w + c * T, w, cols, rows);
+            hash = dirty_hash(hash, U + r * CT * cw + c * CT, cw, ccols, crows);
+            hash = dirty_hash(hash, V + r * CT * cw + c * CT, cw, ccols, crows);
+            if (refresh || hash != d->hash[r][c]) {
+                d->hash[r][c] = hash;
+                d->changed[r][c] = d->serial;
+            }
+        }
+    }
+    return d->serial;
+}
+
+uint32_t dirty_spans(const struct dirty_map *d, uint32_t since, struct scaler_span spans[SCALER_MAX_BANDS]) {
+    uint32_t changed = 0;
+    for(uint32_t r = 0; r != d->rows; ++r) {
+        uint32_t first = d->cols, last = 0;
+        for(uint32_t c = 0; c != d->cols; ++c) {
+            if ((int32_t)(d->changed[r][c] - since) > 0) {
+                first = MIN(first, c);
+                last = c + 1;
+                ++changed;
+            }
+        }
+        spans[r] = first < last?
+            (struct scaler_span){first * SCALER_TILE, MIN(last * SCALER_TILE, d->width)}:
+            (struct scaler_span){0, 0};
+    }
+    return changed;
+}
@@ -0,0 +1,263 @@
+#include "display.h"
+#include "board.h"
+#include "latency.h"
+#include "platform.h"
+#include "scanout.h"
+#include "esp_attr.h"
+#include "esp_idf_version.h"
+#include "esp_lcd_panel_rgb.h"
+#include "esp_log.h"
+#include "esp_timer.h"
+#include "freertos/FreeRTOS.h"
+#include <string.h>
+
+static const char *TAG = "display";
+
+// the panel's framebuffers, or I420 pictures with YUV scan-out
+static void *fbs[BOARD_LCD_NUM_FBS];
+
+// front: being scanned out, queued: handed to the driver, becomes front at the next frame boundary.
+// The driver is told about a flip before it's recorded as queued, so a boundary racing with
+// display_submit() can only make the bookkeeping keep a buffer busy for one frame too long.
+static portMUX_TYPE lock = portMUX_INITIALIZER_UNLOCKED;
+static int front;
+static int queued = -1;
+static int64_t submit_time[BOARD_LCD_NUM_FBS];
+static uint32_t submit_frame[BOARD_LCD_NUM_FBS];
+static uint32_t submitted;
+// recent flips, frame numbers only ever grow
+#define FLIP_LOG 64
+static struct {
+    uint32_t frame;
+    int64_t time;
+} flip_log[FLIP_LOG];
+static uint32_t flips;
+static int64_t last_boundary;
+static struct display_stats stats;
+
+#if CONFIG_MOTOCAST_YUV_SCANOUT
+
+#if CONFIG_LCD_RGB_ISR_IRAM_SAFE
+#error "YUV scan-out converts in the LCD interrupt with code in flash, disable LCD_RGB_ISR_IRAM_SAFE"
+#endif
+
+#define PICTURE_SIZE (CONFIG_MOTOCAST_YUV_SCANOUT_MAX_PIXELS * 3 / 2)
+
+// Refills use the current geometry, set by display_yuv_configure() into the one not in use. Front
+// and queued are reset at the same time, so only pictures of the current geometry are shown; a
+// refill still working with the previous one is done long before a further configuration.
+static struct scaler geometry[2];
+static const struct scaler *current;
+static bool showing;                // front holds a picture of the current geometry
+static struct scaler_lines refill_lines;
+static uint16_t *measure_buf;
+static uint32_t refill_budget_us;
+
+#endif
+
+static bool IRAM_ATTR display_on_frame_boundary(esp_lcd_panel_handle_t panel, const esp_lcd_rgb_panel_event_data_t *edata, void *user_ctx) {
+    int64_t now = esp_timer_get_time();
+    portENTER_CRITICAL_ISR(&lock);
+    if (last_boundary)
+        stats.refresh_us = now - last_boundary;
+    last_boundary = now;
+    if (queued >= 0) {
+        if (stats.refresh_us && now - submit_time[queued] > stats.refresh_us)
+            ++stats.late;
+        latency_add(LATENCY_FLIP, now - submit_time[queued]);
+        flip_log[flips % FLIP_LOG].frame = submit_frame[queued];
+        flip_log[flips % FLIP_LOG].time = now;
+        ++flips;
+        front = queued;
+        queued = -1;
+        ++stats.presented;
+#if CONFIG_MOTOCAST_YUV_SCANOUT
+        showing = true;
+#endif
+    } else if (stats.presented) {
+        ++stats.repeated;
+    }
+    portEXIT_CRITICAL_ISR(&lock);
+    return false;
+}
+
+#if CONFIG_MOTOCAST_YUV_SCANOUT
+
+static bool IRAM_ATTR display_on_bounce_empty(esp_lcd_panel_handle_t panel, void *bounce_buf, int pos_px, int len_bytes, void *user_ctx) {
+    uint32_t row = pos_px / BOARD_LCD_H_RES, rows = len_bytes / (BOARD_LCD_H_RES * sizeof(uint16_t));
+    if (!row)
+        display_on_frame_boundary(panel, NULL, user_ctx);
+
+    int64_t start = esp_timer_get_time();
+    portENTER_CRITICAL_ISR(&lock);
+    const uint8_t *picture = showing? fbs[front]: NULL;
+    const struct scaler *s = current;
+    portEXIT_CRITICAL_ISR(&lock);
+    if (picture)
+        scaler_run_lines(s, &refill_lines, picture, bounce_buf, row, rows);
+    else
+        memset(bounce_buf, 0, len_bytes);
+
+    uint32_t took = esp_timer_get_time() - start;
+    portENTER_CRITICAL_ISR(&lock);
+    if (took > refill_budget_us)
+        ++stats.refill_late;
+    if (took > stats.refill_max_us)
+        stats.refill_max_us = took;
+    portEXIT_CRITICAL_ISR(&lock);
+    return false;
+}
+
+#endif
+
+void display_init(void) {
+#if CONFIG_MOTOCAST_YUV_SCANOUT
+    for(unsigned i = 0; i != BOARD_LCD_NUM_FBS; ++i) {
+        fbs[i] = platform_alloc(PICTURE_SIZE, PLATFORM_MEM_EXTERNAL);
+        if (!fbs[i])
+            abort();
+    }
+    // in PSRAM unlike the bounce buffers, which only makes measured refills slower
+    measure_buf = platform_alloc(BOARD_LCD_BOUNCE_ROWS * BOARD_LCD_H_RES * sizeof(uint16_t), PLATFORM_MEM_EXTERNAL);
+    if (!measure_buf)
+        abort();
+    refill_lines.portable = true;
+    refill_budget_us = scanout_budget_us();
+
+    esp_lcd_rgb_panel_event_callbacks_t callbacks = {
+        .on_bounce_empty = display_on_bounce_empty,
+    };
+    ESP_ERROR_CHECK(esp_lcd_rgb_panel_register_event_callbacks(panel_handle, &callbacks, NULL));
+    ESP_LOGI(TAG, "YUV scan-out, %d pictures of up to %d pixels, %lu us per refill", BOARD_LCD_NUM_FBS,
+        CONFIG_MOTOCAST_YUV_SCANOUT_MAX_PIXELS, (unsigned long)refill_budget_us);
+#else
+#if BOARD_LCD_NUM_FBS == 3
+    ESP_ERROR_CHECK(esp_lcd_rgb_panel_get_frame_buffer(panel_handle, 3, (void **)&fbs[0], (void **)&fbs[1], (void **)&fbs[2]));
+#else
+    ESP_ERROR_CHECK(esp_lcd_rgb_panel_get_frame_buffer(panel_handle, 2, (void **)&fbs[0], (void **)&fbs[1]));
+#endif
+
+    esp_lcd_rgb_panel_event_callbacks_t callbacks = {};
+#if ESP_IDF_VERSION >= ESP_IDF_VERSION_VAL(5, 4, 0)
+    callbacks.on_frame_buf_complete = display_on_frame_boundary;
+#else
+    // board.c always configures bounce buffers
+    callbacks.on_bounce_frame_finish = display_on_frame_boundary;
+#endif
+    ESP_ERROR_CHECK(esp_lcd_rgb_panel_register_event_callbacks(panel_handle, &callbacks, NULL));
+    ESP_LOGI(TAG, "%d framebuffers", BOARD_LCD_NUM_FBS);
+#endif
+}
+
+static void *display_acquire_buffer(void) {
+    void *fb = NULL;
+    portENTER_CRITICAL(&lock);
+    for(int i = 0; i != BOARD_LCD_NUM_FBS; ++i) {
+        if (i != front && i != queued) {
+            fb = fbs[i];
+            break;
+        }
+    }
+    if (!fb)
+        ++stats.dropped;
+    portEXIT_CRITICAL(&lock);
+    return fb;
+}
+
+// records fb as queued once the driver has been told about it
+static uint32_t display_submit_buffer(void *fb) {
+    int index = 0;
+    while(fbs[index] != fb)
+        ++index;
+
+    submit_time[index] = esp_timer_get_time();
+#if !CONFIG_MOTOCAST_YUV_SCANOUT
+    // passing one of the panel's own framebuffers makes the driver switch to it instead of copying
+    ESP_ERROR_CHECK_WITHOUT_ABORT(esp_lcd_panel_draw_bitmap(panel_handle, 0, 0, BOARD_LCD_H_RES, BOARD_LCD_V_RES, fb));
+#endif
+
+    portENTER_CRITICAL(&lock);
+    if (queued >= 0 && queued != index)
+        ++stats.dropped;
+    queued = index;
+    uint32_t frame = submit_frame[index] = ++submitted;
+    portEXIT_CRITICAL(&lock);
+    return frame;
+}
+
+uint16_t *display_acquire(void) {
+    return display_acquire_buffer();
+}
+
+uint32_t display_submit(uint16_t *fb) {
+    return display_submit_buffer(fb);
+}
+
+#if CONFIG_MOTOCAST_YUV_SCANOUT
+
+bool display_yuv_configure(struct scaler *s, const uint8_t *yuv) {
+    portENTER_CRITICAL(&lock);
+    showing = false;
+    queued = -1;
+    portEXIT_CRITICAL(&lock);
+    // the whole decoded picture is kept, cropped or not
+    if (s->pic_w * s->pic_h > CONFIG_MOTOCAST_YUV_SCANOUT_MAX_PIXELS) {
+        ESP_LOGE(TAG, "%lux%lu is too large for YUV scan-out", (unsigned long)s->pic_w, (unsigned long)s->pic_h);
+        return false;
+    }
+
+    bool portable = s->work.portable;
+    s->work.portable = true;
+    uint32_t slowest = scanout_measure(s, &s->work, yuv, measure_buf);
+    s->work.portable = portable;
+    uint32_t allowed = refill_budget_us * SCANOUT_BUDGET_PERCENT / 100;
+    if (slowest > allowed) {
+        ESP_LOGE(TAG, "%lux%lu refills take up to %lu us, more than the %lu us scan-out allows",
+            (unsigned long)s->src_w, (unsigned long)s->src_h, (unsigned long)slowest, (unsigned long)allowed);
+        return false;
+    }
+    ESP_LOGI(TAG, "%lux%lu refills take up to %lu us of %lu us", (unsigned long)s->src_w, (unsigned long)s->src_h,
+        (unsigned long)slowest, (unsigned long)allowed);
+
+    struct scaler *next = current == &geometry[0]? &geometry[1]: &geometry[0];
+    *next = *s;
+    portENTER_CRITICAL(&lock);
+    current = next;
+    portEXIT_CRITICAL(&lock);
+    return true;
+}
+
+uint8_t *display_acquire_yuv(void) {
+    return display_acquire_buffer();
+}
+
+uint32_t display_submit_yuv(uint8_t *yuv) {
+    return display_submit_buffer(yuv);
+}
+
+#endif
+
+int64_t display_flip_time(uint32_t frame) {
+    int64_t time = -1;
+    portENTER_CRITICAL(&lock);
+    uint32_t n = flips < FLIP_LOG? flips: FLIP_LOG;
+    if (!n || (int32_t)(flip_log[(flips - 1) % FLIP_LOG].frame - frame) < 0) {
+        time = 0;
+    } else {
+        for(uint32_t i = 1; i <= n; ++i) {
+            uint32_t flipped = flip_log[(flips - i) % FLIP_LOG].frame;
+            if (flipped == frame)
+                time = flip_log[(flips - i) % FLIP_LOG].time;
+            if ((int32_t)(flipped - frame) <= 0)
+                break;
+        }
+    }
+    portEXIT_CRITICAL(&lock);
+    return time;
+}
+
+void display_get_stats(struct display_stats *out) {
+    portENTER_CRITICAL(&lock);
+    *out = stats;
+    portEXIT_CRITICAL(&lock);
+}
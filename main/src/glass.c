@@ -0,0 +1,113 @@
+#include "glass.h"
+#include "display.h"
+#include "latency.h"
+#include "timesync.h"
+#include <stdatomic.h>
+#include <stdbool.h>
+
+// timestamped frames waiting for their flip, filled by the decode task
+#define PENDING 64
+static struct {
+    uint16_t seq;
+    int64_t captured;
+    int64_t decoded;
+    uint32_t frame;
+} pending[PENDING];
+static _Atomic uint32_t pending_head, pending_tail;
+
+// last pong, handed from the BLE stack to the task calling glass_echo()
+static struct {
+    int64_t t1, t2, t3, t4;
+} pong;
+static _Atomic bool pong_full;
+
+static int64_t last_ping;
+static struct timesync sender_clock;
+
+static void write_le64(uint8_t *dst, uint64_t value) {
+    for(unsigned i = 0; i != 8; ++i)
+        dst[i] = value >> (i * 8);
+}
+
+static uint64_t read_le64(const uint8_t *src) {
+    uint64_t value = 0;
+    for(unsigned i = 0; i != 8; ++i)
+        value |= (uint64_t)src[i] << (i * 8);
+    return value;
+}
+
+void glass_frame(uint16_t seq, int64_t captured, int64_t decoded, uint32_t frame) {
+    uint32_t head = atomic_load_explicit(&pending_head, memory_order_relaxed);
+    if (head - atomic_load_explicit(&pending_tail, memory_order_acquire) == PENDING)
+        return;
+    pending[head % PENDING].seq = seq;
+    pending[head % PENDING].captured = captured;
+    pending[head % PENDING].decoded = decoded;
+    pending[head % PENDING].frame = frame;
+    atomic_store_explicit(&pending_head, head + 1, memory_order_release);
+}
+
+uint32_t glass_ping(uint8_t dst[GLASS_PING_SIZE], int64_t now) {
+    dst[0] = GLASS_PING;
+    dst[1] = dst[2] = dst[3] = 0;
+    write_le64(dst + 4, now);
+    last_ping = now;
+    return GLASS_PING_SIZE;
+}
+
+void glass_receive(const uint8_t *data, uint32_t len, int64_t now) {
+    if (len < GLASS_PONG_SIZE || data[0] != GLASS_PONG || atomic_load_explicit(&pong_full, memory_order_acquire))
+        return;
+    pong.t1 = read_le64(data + 4);
+    pong.t2 = read_le64(data + 12);
+    pong.t3 = read_le64(data + 20);
+    pong.t4 = now;
+    atomic_store_explicit(&pong_full, true, memory_order_release);
+}
+
+// feeds a pong answering the last ping into the clock estimate
+static void glass_sync(void) {
+    if (!atomic_load_explicit(&pong_full, memory_order_acquire))
+        return;
+    if (pong.t1 == last_ping && last_ping)
+        timesync_update(&sender_clock, pong.t1, pong.t2, pong.t3, pong.t4);
+    atomic_store_explicit(&pong_full, false, memory_order_release);
+}
+
+uint32_t glass_echo(uint8_t *dst, uint32_t size) {
+    glass_sync();
+    bool synced = timesync_valid(&sender_clock);
+    uint32_t len = GLASS_ECHO_HEADER_SIZE, count = 0;
+    int64_t last_flip = 0;
+    uint32_t tail = atomic_load_explicit(&pending_tail, memory_order_relaxed);
+    uint32_t head = atomic_load_explicit(&pending_head, memory_order_acquire);
+    for(; tail != head && count != 255 && len + GLASS_ECHO_SIZE <= size; ++tail) {
+        int64_t flipped = display_flip_time(pending[tail % PENDING].frame);
+        if (!flipped)
+            break;
+        if (flipped < 0)
+            continue;
+        int64_t captured = pending[tail % PENDING].captured;
+        if (synced)
+            latency_add(LATENCY_GLASS, flipped - timesync_to_local(&sender_clock, captured));
+        uint8_t *echo = dst + len;
+        echo[0] = pending[tail % PENDING].seq;
+        echo[1] = pending[tail % PENDING].seq >> 8;
+        echo[2] = echo[3] = 0;
+        write_le64(echo + 4, captured);
+        write_le64(echo + 12, pending[tail % PENDING].decoded);
+        write_le64(echo + 20, flipped);
+        len += GLASS_ECHO_SIZE;
+        last_flip = flipped;
+        ++count;
+    }
+    atomic_store_explicit(&pending_tail, tail, memory_order_release);
+    if (!count)
+        return 0;
+    dst[0] = GLASS_ECHO;
+    dst[1] = count;
+    dst[2] = synced;
+    dst[3] = 0;
+    write_le64(dst + 4, synced? timesync_offset(&sender_clock, last_flip): 0);
+    return len;
+}
@@ -0,0 +1,167 @@
+#include "h264_nal.h"
+#include <string.h>
+
+// position of the first 00 00 01 start code at or after p, end if there is none
+static const uint8_t *h264_find_start_code(const uint8_t *p, const uint8_t *end) {
+    const uint8_t *q = p + 2;
+    while(q < end) {
+        // emulation prevention keeps 00 00 01 out of the payload, so every 01 after two zeros is one
+        q = memchr(q, 1, end - q);
+        if (!q)
+            break;
+        if (q[-1] == 0 && q[-2] == 0)
+            return q - 2;
+        q += 3;
+    }
+    return end;
+}
+
+bool h264_next_nal(const uint8_t **pos, const uint8_t *end, struct h264_nal *nal) {
+    const uint8_t *start = h264_find_start_code(*pos, end);
+    if (end - start < 4) {
+        *pos = end;
+        return false;
+    }
+    const uint8_t *next = h264_find_start_code(start + 3, end);
+    nal->data = start;
+    nal->len = next - start;
+    nal->type = start[3] & 0x1f;
+    nal->ref_idc = (start[3] >> 5) & 3;
+    *pos = next;
+    return true;
+}
+
+// RBSP bit reader skipping emulation prevention bytes, reads zeros past the end
+struct bits {
+    const uint8_t *data;
+    uint32_t len, pos, bit;
+    unsigned zeros;
+};
+
+static unsigned read_bit(struct bits *b) {
+    if (b->pos >= b->len)
+        return 0;
+    if (b->bit == 0) {
+        if (b->zeros >= 2 && b->data[b->pos] == 3) {
+            b->zeros = 0;
+            if (++b->pos >= b->len)
+                return 0;
+        }
+        b->zeros = b->data[b->pos]? 0: b->zeros + 1;
+    }
+    unsigned value = (b->data[b->pos] >> (7 - b->bit)) & 1;
+    if (++b->bit == 8) {
+        b->bit = 0;
+        ++b->pos;
+    }
+    return value;
+}
+
+static uint32_t read_bits(struct bits *b, unsigned n) {
+    uint32_t value = 0;
+    while(n--)
+        value = (value << 1) | read_bit(b);
+    return value;
+}
+
+static uint32_t read_ue(struct bits *b) {
+    unsigned leading = 0;
+    while(!read_bit(b) && leading < 32)
+        ++leading;
+    return leading? ((1u << leading) - 1) + read_bits(b, leading): 0;
+}
+
+static int32_t read_se(struct bits *b) {
+    uint32_t v = read_ue(b);
+    return (v & 1)? (int32_t)((v + 1) / 2): -(int32_t)(v / 2);
+}
+
+static void skip_scaling_list(struct bits *b, unsigned size) {
+    int32_t last = 8, next = 8;
+    for(unsigned j = 0; j != size; ++j) {
+        if (next)
+            next = (last + read_se(b) + 256) % 256;
+        last = next? next: last;
+    }
+}
+
+bool h264_parse_sps(const uint8_t *rbsp, uint32_t len, struct h264_sps *sps) {
+    if (len < 2)
+        return false;
+    struct bits b = {rbsp + 1, len - 1, 0, 0, 0};
+    unsigned profile = read_bits(&b, 8);
+    read_bits(&b, 16);  // constraint flags, level
+    read_ue(&b);        // seq_parameter_set_id
+    uint32_t chroma_format = 1;
+    if (profile == 100 || profile == 110 || profile == 122 || profile == 244 || profile == 44 ||
+            profile == 83 || profile == 86 || profile == 118 || profile == 128) {
+        chroma_format = read_ue(&b);
+        if (chroma_format == 3)
+            read_bit(&b);
+        read_ue(&b);    // bit depths
+        read_ue(&b);
+        read_bit(&b);
+        if (read_bit(&b)) {
+            for(unsigned i = 0; i != (chroma_format == 3? 12u: 8u); ++i)
+                if (read_bit(&b))
+                    skip_scaling_list(&b, i < 6? 16: 64);
+        }
+    }
+    read_ue(&b);        // log2_max_frame_num_minus4
+    uint32_t poc_type = read_ue(&b);
+    if (poc_type == 0) {
+        read_ue(&b);
+    } else if (poc_type == 1) {
+        read_bit(&b);
+        read_se(&b);
+        read_se(&b);
+        for(uint32_t n = read_ue(&b); n--; )
+            read_se(&b);
+    }
+    read_ue(&b);        // max_num_ref_frames
+    read_bit(&b);
+    uint32_t mbs_w = read_ue(&b) + 1;
+    uint32_t map_units_h = read_ue(&b) + 1;
+    uint32_t frame_mbs_only = read_bit(&b);
+    if (b.pos >= b.len || mbs_w > 512 || map_units_h > 512)
+        return false;
+    sps->width = mbs_w * 16;
+    sps->height = (2 - frame_mbs_only) * map_units_h * 16;
+    sps->full_range = false;
+    sps->matrix = H264_MATRIX_UNSPECIFIED;
+
+    if (!frame_mbs_only)
+        read_bit(&b);   // mb_adaptive_frame_field_flag
+    read_bit(&b);       // direct_8x8_inference_flag
+    sps->crop_x = sps->crop_y = 0;
+    sps->crop_w = sps->width;
+    sps->crop_h = sps->height;
+    if (read_bit(&b)) {
+        // offsets count chroma samples, and field pairs without frame_mbs_only
+        uint32_t unit_x = chroma_format == 1 || chroma_format == 2? 2: 1;
+        uint32_t unit_y = (chroma_format == 1? 2: 1) * (2 - frame_mbs_only);
+        uint64_t left = (uint64_t)read_ue(&b) * unit_x, right = (uint64_t)read_ue(&b) * unit_x;
+        uint64_t top = (uint64_t)read_ue(&b) * unit_y, bottom = (uint64_t)read_ue(&b) * unit_y;
+        if (left + right >= sps->width || top + bottom >= sps->height)
+            return false;
+        sps->crop_x = left;
+        sps->crop_y = top;
+        sps->crop_w = sps->width - left - right;
+        sps->crop_h = sps->height - top - bottom;
+    }
+    if (!read_bit(&b))  // vui_parameters_present_flag
+        return true;
+    if (read_bit(&b) && read_bits(&b, 8) == 255)
+        read_bits(&b, 32);  // extended sample aspect ratio
+    if (read_bit(&b))
+        read_bit(&b);   // overscan_appropriate_flag
+    if (read_bit(&b)) {
+        read_bits(&b, 3);   // video_format
+        sps->full_range = read_bit(&b);
+        if (read_bit(&b)) {
+            read_bits(&b, 16);  // colour_primaries, transfer_characteristics
+            sps->matrix = read_bits(&b, 8);
+        }
+    }
+    return b.pos < b.len;
+}
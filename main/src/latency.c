@@ -0,0 +1,30 @@
+#include "latency.h"
+
+struct latency_histogram latency[LATENCY_COUNT];
+
+uint32_t latency_bucket_start(unsigned bucket) {
+    if (!bucket)
+        return 0;
+    unsigned octave = 6 + (bucket - 1) / 2;
+    return (1u << octave) + ((bucket - 1) & 1) * (1u << (octave - 1));
+}
+
+void latency_take(enum latency_stage stage, uint32_t counts[LATENCY_BUCKETS]) {
+    for(unsigned i = 0; i != LATENCY_BUCKETS; ++i)
+        counts[i] = atomic_exchange_explicit(&latency[stage].buckets[i], 0, memory_order_relaxed);
+}
+
+uint32_t latency_percentile(const uint32_t counts[LATENCY_BUCKETS], unsigned percent) {
+    uint64_t total = 0;
+    for(unsigned i = 0; i != LATENCY_BUCKETS; ++i)
+        total += counts[i];
+    if (!total)
+        return 0;
+    uint64_t seen = 0;
+    for(unsigned i = 0; i != LATENCY_BUCKETS - 1; ++i) {
+        seen += counts[i];
+        if (seen * 100 >= total * percent)
+            return latency_bucket_start(i + 1);
+    }
+    return latency_bucket_start(LATENCY_BUCKETS - 1);
+}
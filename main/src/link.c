@@ -0,0 +1,263 @@
+#include "link.h"
+#include "esp_log.h"
+#include "esp_timer.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/semphr.h"
+#include <stdbool.h>
+#include <string.h>
+
+static const char *TAG = "link";
+
+enum link_step {
+    STEP_IDLE,
+    STEP_PHY,
+    STEP_DATA_LEN,
+    STEP_CONN_PARAMS,
+    STEP_DONE,
+};
+
+static const char *const step_names[] = {"idle", "PHY", "data length", "connection parameters", "done"};
+
+// guards everything below, the BLE stack and the retry timer run in different tasks
+static SemaphoreHandle_t lock;
+static esp_timer_handle_t timer;
+static struct link_params params;
+static esp_bd_addr_t peer;
+static enum link_step step;
+static bool waiting;            // a request is out, otherwise the timer is a back-off
+static uint32_t attempts;
+static uint16_t max_interval;   // relaxed after refusals
+
+static const struct link_params defaults = {
+    .mtu = 23,
+    .tx_octets = 27,
+    .rx_octets = 27,
+    .tx_phy = LINK_PHY_1M,
+    .rx_phy = LINK_PHY_1M,
+};
+
+static void link_arm(uint64_t us) {
+    esp_timer_stop(timer);
+    esp_timer_start_once(timer, us);
+}
+
+static bool link_step_done(void) {
+    switch(step) {
+    case STEP_PHY:
+        return params.tx_phy == LINK_PHY_2M && params.rx_phy == LINK_PHY_2M;
+    case STEP_DATA_LEN:
+        return params.tx_octets >= LINK_DATA_LEN;
+    case STEP_CONN_PARAMS:
+        return params.interval && params.interval <= max_interval && params.latency == 0;
+    default:
+        return true;
+    }
+}
+
+static esp_err_t link_request(void) {
+    switch(step) {
+    case STEP_PHY:
+#if CONFIG_BT_BLE_50_FEATURES_SUPPORTED
+        return esp_ble_gap_set_preferred_phy(peer, 0, ESP_BLE_GAP_PHY_2M_PREF_MASK,
+                                             ESP_BLE_GAP_PHY_2M_PREF_MASK, ESP_BLE_GAP_PHY_OPTIONS_NO_PREF);
+#else
+        return ESP_ERR_NOT_SUPPORTED;
+#endif
+    case STEP_DATA_LEN:
+        return esp_ble_gap_set_pkt_data_len(peer, LINK_DATA_LEN);
+    case STEP_CONN_PARAMS: {
+        esp_ble_conn_update_params_t update = {
+            .min_int = LINK_INTERVAL,
+            .max_int = max_interval,
+            .latency = 0,
+            .timeout = LINK_TIMEOUT,
+        };
+        memcpy(update.bda, peer, sizeof(esp_bd_addr_t));
+        return esp_ble_gap_update_conn_params(&update);
+    }
+    default:
+        return ESP_OK;
+    }
+}
+
+static void link_retry(void);
+
+// sends the request of the current step, or moves on while steps are already satisfied
+static void link_next(void) {
+    while(step != STEP_DONE && link_step_done()) {
+        ++step;
+        attempts = 0;
+    }
+    if (step == STEP_DONE) {
+        esp_timer_stop(timer);
+        waiting = false;
+        ESP_LOGI(TAG, "negotiated: MTU %u, %u/%u octets, PHY %u/%u, interval %.2f ms, latency %u",
+                 params.mtu, params.tx_octets, params.rx_octets, params.tx_phy, params.rx_phy,
+                 params.interval * 1.25, params.latency);
+        return;
+    }
+    ++attempts;
+    esp_err_t err = link_request();
+    if (err == ESP_ERR_NOT_SUPPORTED) {
+        ESP_LOGI(TAG, "%s not supported by this build", step_names[step]);
+        ++step;
+        attempts = 0;
+        link_next();
+    } else if (err != ESP_OK) {
+        ESP_LOGW(TAG, "%s request failed: %s", step_names[step], esp_err_to_name(err));
+        link_retry();
+    } else {
+        waiting = true;
+        link_arm(LINK_RESPONSE_US);
+    }
+}
+
+// the current step failed or fell short, retries later or gives up on it
+static void link_retry(void) {
+    esp_timer_stop(timer);
+    waiting = false;
+    uint64_t delay = (uint64_t)LINK_RETRY_US << (attempts - 1);
+    if (step == STEP_CONN_PARAMS && attempts >= 2 && max_interval < LINK_INTERVAL_MAX) {
+        // the central keeps refusing, ask for less
+        max_interval = max_interval * 2 < LINK_INTERVAL_MAX? max_interval * 2: LINK_INTERVAL_MAX;
+        attempts = 0;
+    } else if (attempts >= LINK_ATTEMPTS) {
+        ESP_LOGW(TAG, "giving up on %s", step_names[step]);
+        ++step;
+        attempts = 0;
+        link_next();
+        return;
+    }
+    link_arm(delay);
+}
+
+static void link_timer(void *arg) {
+    xSemaphoreTake(lock, portMAX_DELAY);
+    if (step != STEP_IDLE && step != STEP_DONE) {
+        if (waiting) {
+            ESP_LOGW(TAG, "no answer to %s request", step_names[step]);
+            link_retry();
+        } else {
+            link_next();
+        }
+    }
+    xSemaphoreGive(lock);
+}
+
+void link_init(void) {
+    lock = xSemaphoreCreateMutex();
+    const esp_timer_create_args_t timer_args = {
+        .callback = link_timer,
+        .name = "link",
+    };
+    ESP_ERROR_CHECK(esp_timer_create(&timer_args, &timer));
+    params = defaults;
+}
+
+void link_connected(const esp_bd_addr_t bda, uint16_t interval, uint16_t latency, uint16_t timeout) {
+    xSemaphoreTake(lock, portMAX_DELAY);
+    params = defaults;
+    params.interval = interval;
+    params.latency = latency;
+    params.timeout = timeout;
+    memcpy(peer, bda, sizeof(esp_bd_addr_t));
+    max_interval = LINK_INTERVAL;
+    step = STEP_PHY;
+    attempts = 0;
+    link_next();
+    xSemaphoreGive(lock);
+}
+
+void link_disconnected(void) {
+    xSemaphoreTake(lock, portMAX_DELAY);
+    esp_timer_stop(timer);
+    step = STEP_IDLE;
+    waiting = false;
+    params = defaults;
+    xSemaphoreGive(lock);
+}
+
+void link_mtu(uint16_t mtu) {
+    xSemaphoreTake(lock, portMAX_DELAY);
+    params.mtu = mtu;
+    xSemaphoreGive(lock);
+}
+
+// records what the stack reports and, if it answers the outstanding request, moves on
+void link_gap_event(esp_gap_ble_cb_event_t event, const esp_ble_gap_cb_param_t *param) {
+    enum link_step answers;
+    bool success, final = true;
+    switch(event) {
+#if CONFIG_BT_BLE_50_FEATURES_SUPPORTED
+    case ESP_GAP_BLE_SET_PREFERRED_PHY_COMPLETE_EVT:
+        // only the command status. The result comes with a PHY update, or not at all if the PHY
+        // doesn't change, so read it back as well.
+        answers = STEP_PHY;
+        success = param->set_perf_phy.status == ESP_BT_STATUS_SUCCESS;
+        final = !success;
+        xSemaphoreTake(lock, portMAX_DELAY);
+        if (success && step == STEP_PHY)
+            esp_ble_gap_read_phy(peer);
+        break;
+    case ESP_GAP_BLE_READ_PHY_COMPLETE_EVT:
+        answers = STEP_PHY;
+        success = param->read_phy.status == ESP_BT_STATUS_SUCCESS;
+        final = false;
+        xSemaphoreTake(lock, portMAX_DELAY);
+        if (success) {
+            params.tx_phy = param->read_phy.tx_phy;
+            params.rx_phy = param->read_phy.rx_phy;
+        }
+        break;
+    case ESP_GAP_BLE_PHY_UPDATE_COMPLETE_EVT:
+        answers = STEP_PHY;
+        success = param->phy_update.status == ESP_BT_STATUS_SUCCESS;
+        xSemaphoreTake(lock, portMAX_DELAY);
+        if (success) {
+            params.tx_phy = param->phy_update.tx_phy;
+            params.rx_phy = param->phy_update.rx_phy;
+        }
+        break;
+#endif
+    case ESP_GAP_BLE_SET_PKT_LENGTH_COMPLETE_EVT:
+        answers = STEP_DATA_LEN;
+        success = param->pkt_data_length_cmpl.status == ESP_BT_STATUS_SUCCESS;
+        xSemaphoreTake(lock, portMAX_DELAY);
+        if (success) {
+            params.tx_octets = param->pkt_data_length_cmpl.params.tx_len;
+            params.rx_octets = param->pkt_data_length_cmpl.params.rx_len;
+        }
+        break;
+    case ESP_GAP_BLE_UPDATE_CONN_PARAMS_EVT:
+        // also reports updates the central started on its own
+        answers = STEP_CONN_PARAMS;
+        success = param->update_conn_params.status == ESP_BT_STATUS_SUCCESS;
+        xSemaphoreTake(lock, portMAX_DELAY);
+        if (success) {
+            params.interval = param->update_conn_params.conn_int;
+            params.latency = param->update_conn_params.latency;
+            params.timeout = param->update_conn_params.timeout;
+        }
+        break;
+    default:
+        return;
+    }
+
+    if (step == answers && waiting) {
+        if (success && link_step_done()) {
+            waiting = false;
+            link_next();
+        } else if (final) {
+            ESP_LOGW(TAG, "%s request %s, attempt %u", step_names[step],
+                     success? "fell short": "failed", (unsigned)attempts);
+            link_retry();
+        }
+    }
+    xSemaphoreGive(lock);
+}
+
+void link_get_params(struct link_params *dst) {
+    xSemaphoreTake(lock, portMAX_DELAY);
+    *dst = params;
+    xSemaphoreGive(lock);
+}
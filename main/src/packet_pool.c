@@ -0,0 +1,36 @@
+#include "packet_pool.h"
+
+void packet_pool_init(struct packet_pool *pool, uint8_t *storage, uint32_t buffer_size, uint32_t count) {
+    if (count > PACKET_POOL_MAX_BUFFERS)
+        count = PACKET_POOL_MAX_BUFFERS;
+    pool->storage = storage;
+    pool->buffer_size = buffer_size;
+    pool->count = count;
+    pool->free_mask = count == 32? 0xffffffffu: (1u << count) - 1;
+    pool->in_use = pool->peak_in_use = 0;
+    pool->exhausted = pool->oversized = 0;
+}
+
+uint8_t *packet_pool_acquire(struct packet_pool *pool, uint32_t len) {
+    if (len > pool->buffer_size) {
+        ++pool->oversized;
+        return 0;
+    }
+    if (!pool->free_mask) {
+        ++pool->exhausted;
+        return 0;
+    }
+    unsigned index = __builtin_ctz(pool->free_mask);
+    pool->free_mask &= ~(1u << index);
+    if (++pool->in_use > pool->peak_in_use)
+        pool->peak_in_use = pool->in_use;
+    return pool->storage + index * pool->buffer_size;
+}
+
+void packet_pool_release(struct packet_pool *pool, uint8_t *buffer) {
+    if (!buffer)
+        return;
+    unsigned index = (buffer - pool->storage) / pool->buffer_size;
+    pool->free_mask |= 1u << index;
+    --pool->in_use;
+}
@@ -0,0 +1,176 @@
+#include "pipeline.h"
+#include "esp_log.h"
+#include <stdbool.h>
+#include <stdlib.h>
+#include "freertos/FreeRTOS.h"
+#include "freertos/semphr.h"
+#include "freertos/task.h"
+
+static const char *TAG = "pipeline";
+
+#if CONFIG_ESP_H264_DUAL_TASK && CONFIG_ESP_H264_DUAL_TASK_CORE == CONFIG_MOTOCAST_DECODE_TASK_CORE
+#warning "tinyh264 helper task shares a core with the decode task, dual task decoding won't run in parallel"
+#endif
+
+#if CONFIG_MOTOCAST_CONVERT_SPLIT
+
+#define HELPER_CORE (!CONFIG_MOTOCAST_DECODE_TASK_CORE)
+
+// the current pipeline_parallel() call, guarded by job_lock
+static struct {
+    pipeline_slice_fn fn;
+    void *arg;
+    uint32_t count, next, completed;
+    uint32_t helper;            // indices run by the helper
+} job;
+static portMUX_TYPE job_lock = portMUX_INITIALIZER_UNLOCKED;
+static SemaphoreHandle_t helper_start, helper_done;
+
+// runs indices until none are left, returns how many
+static uint32_t pipeline_work(unsigned worker) {
+    uint32_t done = 0;
+    for(;;) {
+        portENTER_CRITICAL(&job_lock);
+        if (done)
+            ++job.completed;
+        uint32_t index = job.next < job.count? job.next++: UINT32_MAX;
+        if (index != UINT32_MAX && worker)
+            ++job.helper;
+        pipeline_slice_fn fn = job.fn;
+        void *arg = job.arg;
+        portEXIT_CRITICAL(&job_lock);
+        if (index == UINT32_MAX)
+            return done;
+        fn(arg, index, worker);
+        ++done;
+    }
+}
+
+static void pipeline_helper_task(void *arg) {
+    for(;;) {
+        xSemaphoreTake(helper_start, portMAX_DELAY);
+        if (pipeline_work(1))
+            xSemaphoreGive(helper_done);
+    }
+}
+
+static void pipeline_helper_start(void) {
+    helper_start = xSemaphoreCreateBinary();
+    helper_done = xSemaphoreCreateBinary();
+    if (!helper_start || !helper_done || xTaskCreatePinnedToCore(pipeline_helper_task, "convert_helper", 3072, NULL,
+            CONFIG_MOTOCAST_DECODE_TASK_PRIORITY, NULL, HELPER_CORE) != pdPASS) {
+        ESP_LOGE(TAG, "failed to create conversion helper task");
+        abort();
+    }
+    ESP_LOGI(TAG, "convert helper: core %d, priority %d", HELPER_CORE, CONFIG_MOTOCAST_DECODE_TASK_PRIORITY);
+}
+
+uint32_t pipeline_parallel(uint32_t count, pipeline_slice_fn fn, void *arg) {
+    portENTER_CRITICAL(&job_lock);
+    job.fn = fn;
+    job.arg = arg;
+    job.count = count;
+    job.next = job.completed = job.helper = 0;
+    portEXIT_CRITICAL(&job_lock);
+    xSemaphoreGive(helper_start);
+
+    pipeline_work(0);
+    for(;;) {
+        portENTER_CRITICAL(&job_lock);
+        bool finished = job.completed == count;
+        uint32_t helper = job.helper;
+        portEXIT_CRITICAL(&job_lock);
+        if (finished)
+            return helper;
+        // the helper is still on its last index, a stale give from an earlier call just loops
+        xSemaphoreTake(helper_done, portMAX_DELAY);
+    }
+}
+
+#else
+
+uint32_t pipeline_parallel(uint32_t count, pipeline_slice_fn fn, void *arg) {
+    for(uint32_t i = 0; i != count; ++i)
+        fn(arg, i, 0);
+    return 0;
+}
+
+#endif
+
+void pipeline_init(void) {
+    ESP_LOGI(TAG, "ble: core %d", CONFIG_BT_BLUEDROID_PINNED_TO_CORE);
+    ESP_LOGI(TAG, "decode + convert: core %d, priority %d",
+        CONFIG_MOTOCAST_DECODE_TASK_CORE, CONFIG_MOTOCAST_DECODE_TASK_PRIORITY);
+#if CONFIG_ESP_H264_DUAL_TASK
+    ESP_LOGI(TAG, "decoder helper: core %d, priority %d",
+        CONFIG_ESP_H264_DUAL_TASK_CORE, CONFIG_ESP_H264_DUAL_TASK_PRIORITY);
+#else
+    ESP_LOGI(TAG, "decoder helper: disabled");
+#endif
+#if CONFIG_MOTOCAST_CONVERT_SPLIT
+    pipeline_helper_start();
+#endif
+}
+
+#if CONFIG_MOTOCAST_PIPELINE_BENCHMARK
+
+#define MAX_TASKS 32
+
+struct pipeline_stage_time pipeline_stages[PIPELINE_STAGE_COUNT];
+
+static const char *const stage_names[PIPELINE_STAGE_COUNT] = {"ingest", "parse", "decode", "convert"};
+
+static struct pipeline_stage_time last_stages[PIPELINE_STAGE_COUNT];
+static int64_t last_report;
+
+static TaskStatus_t tasks[MAX_TASKS];
+static TaskHandle_t last_handles[MAX_TASKS];
+static configRUN_TIME_COUNTER_TYPE last_runtimes[MAX_TASKS];
+static configRUN_TIME_COUNTER_TYPE last_total;
+
+static configRUN_TIME_COUNTER_TYPE last_runtime(TaskHandle_t handle) {
+    for(unsigned i = 0; i != MAX_TASKS; ++i)
+        if (last_handles[i] == handle)
+            return last_runtimes[i];
+    return 0;
+}
+
+void pipeline_report(void) {
+    int64_t now = esp_timer_get_time();
+    uint32_t elapsed = (uint32_t)(now - last_report);
+    last_report = now;
+    if (!elapsed)
+        return;
+
+    for(unsigned i = 0; i != PIPELINE_STAGE_COUNT; ++i) {
+        struct pipeline_stage_time current = pipeline_stages[i];
+        uint32_t busy = current.busy_us - last_stages[i].busy_us;
+        uint32_t count = current.count - last_stages[i].count;
+        last_stages[i] = current;
+        ESP_LOGI(TAG, "%-8s %5.1f%% wall, %lu calls, avg %lu us", stage_names[i], busy * 100.0f / elapsed,
+            (unsigned long)count, (unsigned long)(count? busy / count: 0));
+    }
+
+    configRUN_TIME_COUNTER_TYPE total;
+    UBaseType_t n = uxTaskGetSystemState(tasks, MAX_TASKS, &total);
+    configRUN_TIME_COUNTER_TYPE total_delta = total - last_total;
+    last_total = total;
+    for(UBaseType_t i = 0; i != n; ++i) {
+        configRUN_TIME_COUNTER_TYPE delta = tasks[i].ulRunTimeCounter - last_runtime(tasks[i].xHandle);
+        // per core figure: the run time counter advances at wall clock rate on both cores
+        if (total_delta && delta * 100 >= total_delta)
+            ESP_LOGI(TAG, "task %-16s core %2d %5.1f%%", tasks[i].pcTaskName,
+                tasks[i].xCoreID < 2? (int)tasks[i].xCoreID: -1, delta * 100.0f / total_delta);
+    }
+    for(UBaseType_t i = 0; i != MAX_TASKS; ++i) {
+        last_handles[i] = i < n? tasks[i].xHandle: NULL;
+        last_runtimes[i] = i < n? tasks[i].ulRunTimeCounter: 0;
+    }
+}
+
+#else
+
+void pipeline_report(void) {
+}
+
+#endif
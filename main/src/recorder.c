@@ -0,0 +1,245 @@
+#include "recorder.h"
+
+#if CONFIG_MOTOCAST_CAPTURE
+
+#include "capture.h"
+#include "transport.h"
+#include "video.h"
+#include "driver/uart.h"
+#include "esp_heap_caps.h"
+#include "esp_log.h"
+#include "esp_partition.h"
+#include "esp_timer.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/semphr.h"
+#include "freertos/task.h"
+#include <stdio.h>
+#include <string.h>
+
+static const char *TAG = "recorder";
+
+#define DUMP_LINE 32
+#define FLASH_CHUNK 4096
+
+static struct capture capture;
+static SemaphoreHandle_t lock;
+static bool recording;
+
+void recorder_write(const uint8_t *data, uint32_t len) {
+    if (!recording)
+        return;
+    xSemaphoreTake(lock, portMAX_DELAY);
+    if (recording)
+        capture_record(&capture, esp_timer_get_time(), data, len);
+    xSemaphoreGive(lock);
+}
+
+static void recorder_set_recording(bool enable) {
+    xSemaphoreTake(lock, portMAX_DELAY);
+    recording = enable;
+    xSemaphoreGive(lock);
+}
+
+struct dump_ctx {
+    uint8_t line[DUMP_LINE];
+    uint32_t fill;
+};
+
+static void dump_flush(struct dump_ctx *d) {
+    if (!d->fill)
+        return;
+    char text[5 + DUMP_LINE * 2 + 1] = "MCAP ";
+    for(uint32_t i = 0; i != d->fill; ++i)
+        sprintf(text + 5 + i * 2, "%02x", d->line[i]);
+    puts(text);
+    d->fill = 0;
+}
+
+static bool dump_write(void *ctx, const void *data, uint32_t len) {
+    struct dump_ctx *d = ctx;
+    const uint8_t *src = data;
+    while(len) {
+        uint32_t n = DUMP_LINE - d->fill < len? DUMP_LINE - d->fill: len;
+        memcpy(d->line + d->fill, src, n);
+        d->fill += n;
+        src += n;
+        len -= n;
+        if (d->fill == DUMP_LINE)
+            dump_flush(d);
+    }
+    return true;
+}
+
+static const esp_partition_t *recorder_partition(void) {
+    const esp_partition_t *part = esp_partition_find_first(ESP_PARTITION_TYPE_DATA, ESP_PARTITION_SUBTYPE_ANY, "capture");
+    if (!part)
+        ESP_LOGE(TAG, "no \"capture\" partition");
+    return part;
+}
+
+struct flash_ctx {
+    const esp_partition_t *part;
+    uint32_t offset;
+    uint32_t fill;
+    uint8_t *chunk;
+};
+
+static bool flash_flush(struct flash_ctx *f) {
+    if (!f->fill)
+        return true;
+    if (esp_partition_write(f->part, f->offset, f->chunk, f->fill) != ESP_OK)
+        return false;
+    f->offset += f->fill;
+    f->fill = 0;
+    return true;
+}
+
+static bool flash_write(void *ctx, const void *data, uint32_t len) {
+    struct flash_ctx *f = ctx;
+    const uint8_t *src = data;
+    while(len) {
+        uint32_t n = FLASH_CHUNK - f->fill < len? FLASH_CHUNK - f->fill: len;
+        memcpy(f->chunk + f->fill, src, n);
+        f->fill += n;
+        src += n;
+        len -= n;
+        if (f->fill == FLASH_CHUNK && !flash_flush(f))
+            return false;
+    }
+    return true;
+}
+
+static void recorder_save(void) {
+    const esp_partition_t *part = recorder_partition();
+    if (!part)
+        return;
+    uint32_t size = capture_serialised_size(&capture);
+    if (size > part->size) {
+        ESP_LOGE(TAG, "capture of %lu bytes doesn't fit the partition", (unsigned long)size);
+        return;
+    }
+    struct flash_ctx f = {part, 0, 0, heap_caps_malloc(FLASH_CHUNK, MALLOC_CAP_INTERNAL | MALLOC_CAP_8BIT)};
+    if (!f.chunk)
+        return;
+    uint32_t erase = (size + part->erase_size - 1) / part->erase_size * part->erase_size;
+    bool ok = esp_partition_erase_range(part, 0, erase) == ESP_OK &&
+        capture_serialise(&capture, flash_write, &f) && flash_flush(&f);
+    free(f.chunk);
+    ESP_LOGI(TAG, "save %s, %lu bytes", ok? "done": "failed", (unsigned long)size);
+}
+
+struct load_ctx {
+    int64_t time;
+};
+
+static void load_record(void *ctx, uint32_t delta_us, const uint8_t *data, uint32_t len) {
+    struct load_ctx *l = ctx;
+    l->time += delta_us;
+    capture_record(&capture, l->time, data, len);
+}
+
+static void recorder_load(void) {
+    const esp_partition_t *part = recorder_partition();
+    if (!part)
+        return;
+    const void *data;
+    esp_partition_mmap_handle_t handle;
+    if (esp_partition_mmap(part, 0, part->size, ESP_PARTITION_MMAP_DATA, &data, &handle) != ESP_OK) {
+        ESP_LOGE(TAG, "failed to map the capture partition");
+        return;
+    }
+    capture_clear(&capture);
+    struct load_ctx l = {};
+    if (!capture_parse(data, part->size, load_record, &l))
+        ESP_LOGE(TAG, "no valid capture in flash");
+    esp_partition_munmap(handle);
+    ESP_LOGI(TAG, "loaded %lu writes", (unsigned long)capture.records);
+}
+
+struct replay_ctx {
+    bool realtime;
+    int64_t start;
+    int64_t offset;
+};
+
+static void replay_record(void *ctx, uint32_t delta_us, const uint8_t *data, uint32_t len) {
+    struct replay_ctx *r = ctx;
+    if (r->realtime) {
+        r->offset += delta_us;
+        int64_t wait = r->start + r->offset - esp_timer_get_time();
+        if (wait >= portTICK_PERIOD_MS * 1000)
+            vTaskDelay(wait / 1000 / portTICK_PERIOD_MS);
+    }
+    // the ring drops what doesn't fit, wait for the decoder instead. Writes larger than the ring
+    // are dropped either way.
+    while(len <= CONFIG_MOTOCAST_RING_SIZE && video_ring_free() < len)
+        vTaskDelay(1);
+    video_write(data, len);
+}
+
+// The replay is the ring's only producer while it runs: live writes are refused until it's done.
+static void recorder_replay(bool realtime) {
+    transport_pause(true);
+    while(transport_busy())
+        vTaskDelay(1);
+    struct replay_ctx r = {realtime, esp_timer_get_time(), 0};
+    capture_for_each(&capture, replay_record, &r);
+    transport_pause(false);
+    ESP_LOGI(TAG, "replayed %lu writes, %lu bytes in %lu ms", (unsigned long)capture.records,
+        (unsigned long)capture.bytes, (unsigned long)((esp_timer_get_time() - r.start) / 1000));
+}
+
+static void recorder_task(void *arg) {
+    for(;;) {
+        uint8_t cmd;
+        if (uart_read_bytes(CONFIG_ESP_CONSOLE_UART_NUM, &cmd, 1, portMAX_DELAY) != 1)
+            continue;
+        recorder_set_recording(false);
+        switch(cmd) {
+        case 'd': {
+            struct dump_ctx d = {};
+            capture_serialise(&capture, dump_write, &d);
+            dump_flush(&d);
+            puts("MCAP end");
+            break;
+        }
+        case 's':
+            recorder_save();
+            break;
+        case 'l':
+            recorder_load();
+            break;
+        case 'r':
+        case 'R':
+            recorder_replay(cmd == 'r');
+            break;
+        case 'c':
+            capture_clear(&capture);
+            break;
+        default:
+            break;
+        }
+        ESP_LOGI(TAG, "%lu writes, %lu bytes, %lu evicted", (unsigned long)capture.records,
+            (unsigned long)capture.bytes, (unsigned long)capture.evicted);
+        recorder_set_recording(true);
+    }
+}
+
+void recorder_init(void) {
+    uint8_t *data = heap_caps_malloc(CONFIG_MOTOCAST_CAPTURE_SIZE, MALLOC_CAP_SPIRAM | MALLOC_CAP_8BIT);
+    lock = xSemaphoreCreateMutex();
+    if (!data || !lock) {
+        ESP_LOGE(TAG, "no memory for capture");
+        return;
+    }
+    capture_init(&capture, data, CONFIG_MOTOCAST_CAPTURE_SIZE);
+    ESP_ERROR_CHECK(uart_driver_install(CONFIG_ESP_CONSOLE_UART_NUM, 256, 0, 0, NULL, 0));
+    if (xTaskCreate(recorder_task, "recorder", 4096, NULL, 2, NULL) != pdPASS) {
+        ESP_LOGE(TAG, "failed to create recorder task");
+        return;
+    }
+    recording = true;
+    ESP_LOGI(TAG, "capturing BLE writes, %d bytes", CONFIG_MOTOCAST_CAPTURE_SIZE);
+}
+
+#endif
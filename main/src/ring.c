@@ -0,0 +1,63 @@
+#include "ring.h"
+#include <string.h>
+
+void ring_init(struct ring *ring, uint8_t *data, uint32_t size) {
+    ring->data = data;
+    ring->size = size;
+    atomic_store(&ring->head, 0);
+    atomic_store(&ring->tail, 0);
+    ring->high_water = 0;
+    ring->dropped_writes = 0;
+    ring->dropped_bytes = 0;
+}
+
+uint32_t ring_used(const struct ring *ring) {
+    uint32_t head = atomic_load_explicit(&ring->head, memory_order_acquire);
+    uint32_t tail = atomic_load_explicit(&ring->tail, memory_order_acquire);
+    return head - tail;
+}
+
+uint32_t ring_free(const struct ring *ring) {
+    return ring->size - ring_used(ring);
+}
+
+int ring_write(struct ring *ring, const uint8_t *src, uint32_t len) {
+    uint32_t head = atomic_load_explicit(&ring->head, memory_order_relaxed);
+    uint32_t tail = atomic_load_explicit(&ring->tail, memory_order_acquire);
+    uint32_t used = head - tail;
+    if (len > ring->size - used) {
+        ++ring->dropped_writes;
+        ring->dropped_bytes += len;
+        return 0;
+    }
+
+    uint32_t offset = head & (ring->size - 1);
+    uint32_t first = ring->size - offset;
+    if (first > len)
+        first = len;
+    memcpy(ring->data + offset, src, first);
+    memcpy(ring->data, src + first, len - first);
+
+    atomic_store_explicit(&ring->head, head + len, memory_order_release);
+
+    used += len;
+    if (used > ring->high_water)
+        ring->high_water = used;
+    return 1;
+}
+
+uint32_t ring_peek(const struct ring *ring, const uint8_t **data) {
+    uint32_t head = atomic_load_explicit(&ring->head, memory_order_acquire);
+    uint32_t tail = atomic_load_explicit(&ring->tail, memory_order_relaxed);
+    uint32_t offset = tail & (ring->size - 1);
+    uint32_t len = head - tail;
+    if (len > ring->size - offset)
+        len = ring->size - offset;
+    *data = ring->data + offset;
+    return len;
+}
+
+void ring_consume(struct ring *ring, uint32_t len) {
+    uint32_t tail = atomic_load_explicit(&ring->tail, memory_order_relaxed);
+    atomic_store_explicit(&ring->tail, tail + len, memory_order_release);
+}
@@ -0,0 +1,273 @@
+#include "scaler.h"
+#include "color_convert.h"
+#include <stdbool.h>
+#include <stddef.h>
+#include <string.h>
+
+#define MIN(a, b) ((a) < (b)? (a): (b))
+
+void rgb565_double_row_c(const uint16_t *src, uint16_t *dst0, uint16_t *dst1, uint32_t width) {
+    for(uint32_t x = 0; x != width; ++x) {
+        uint16_t p = src[x];
+        dst0[2 * x] = dst0[2 * x + 1] = p;
+        dst1[2 * x] = dst1[2 * x + 1] = p;
+    }
+}
+
+// w in 0..32, fields are spread apart so both products fit without overlapping
+static inline uint16_t rgb565_lerp(uint16_t a, uint16_t b, unsigned w) {
+    uint32_t A = (a | ((uint32_t)a << 16)) & 0x07e0f81fu;
+    uint32_t B = (b | ((uint32_t)b << 16)) & 0x07e0f81fu;
+    uint32_t r = ((A * (32 - w) + B * w) >> 5) & 0x07e0f81fu;
+    return (uint16_t)(r | (r >> 16));
+}
+
+// source position of output coordinate i in 1/32 pixel units, pixel centres aligned
+static uint32_t scaler_source_pos(uint32_t i, uint32_t src, uint32_t dst) {
+    int32_t pos = (int32_t)(((2 * i + 1) * src * 32) / (2 * dst)) - 16;
+    return pos < 0? 0: pos;
+}
+
+int scaler_init(struct scaler *s, uint32_t src_w, uint32_t src_h, uint32_t out_w, uint32_t out_h,
+    enum scaler_filter filter, enum scaler_fit fit) {
+    if (!src_w || !src_h || src_w > SCALER_MAX_WIDTH || out_w > SCALER_MAX_WIDTH)
+        return 0;
+
+    s->src_w = src_w;
+    s->src_h = src_h;
+    s->pic_w = src_w;
+    s->pic_h = src_h;
+    s->src_x = s->src_y = 0;
+    s->out_w = out_w;
+    s->out_h = out_h;
+    s->factor = 1;
+    if (filter == SCALER_INTEGER) {
+        s->factor = MIN(out_w / src_w, out_h / src_h);
+        if (!s->factor) {
+            // doesn't fit even at 1:1, downscale instead
+            filter = SCALER_NEAREST;
+            fit = SCALER_LETTERBOX;
+        }
+    }
+    s->filter = filter;
+
+    if (filter == SCALER_INTEGER) {
+        s->dst_w = src_w * s->factor;
+        s->dst_h = src_h * s->factor;
+    } else if (fit == SCALER_FILL) {
+        s->dst_w = out_w;
+        s->dst_h = out_h;
+    } else if (out_w * src_h <= out_h * src_w) {
+        s->dst_w = out_w;
+        s->dst_h = MIN(out_h, out_w * src_h / src_w);
+    } else {
+        s->dst_w = MIN(out_w, out_h * src_w / src_h);
+        s->dst_h = out_h;
+    }
+    // keep output rows 16-byte aligned for the SIMD stores
+    s->dst_x = ((out_w - s->dst_w) / 2) & ~7u;
+    s->dst_y = (out_h - s->dst_h) / 2;
+
+    for(uint32_t x = 0; x != s->dst_w; ++x) {
+        if (filter == SCALER_BILINEAR) {
+            uint32_t pos = scaler_source_pos(x, src_w, s->dst_w);
+            uint32_t index = pos >> 5;
+            s->x_index[x] = MIN(index, src_w - 1);
+            s->x_weight[x] = index < src_w - 1? pos & 31: 0;
+        } else {
+            s->x_index[x] = x * src_w / s->dst_w;
+            s->x_weight[x] = 0;
+        }
+    }
+
+    // bilinear output also depends on the source column right of its tap
+    uint32_t tiles = (src_w + SCALER_TILE - 1) / SCALER_TILE, x = 0, shift = filter == SCALER_BILINEAR;
+    for(uint32_t c = 0; c != tiles; ++c) {
+        while(x != s->dst_w && s->x_index[x] + shift < c * SCALER_TILE)
+            ++x;
+        s->tile_dst_start[c] = x;
+    }
+    x = 0;
+    for(uint32_t c = 0; c != tiles; ++c) {
+        while(x != s->dst_w && s->x_index[x] < c * SCALER_TILE)
+            ++x;
+        s->tile_dst_end[c] = x;
+    }
+    s->tile_dst_start[tiles] = s->tile_dst_end[tiles] = s->dst_w;
+    s->work.cached_pair[0] = s->work.cached_pair[1] = -1;
+    s->work.next_slot = 0;
+    s->work.portable = false;
+    return 1;
+}
+
+int scaler_set_crop(struct scaler *s, uint32_t pic_w, uint32_t pic_h, uint32_t x, uint32_t y) {
+    if (x % 2 || y % 2 || x + s->src_w > pic_w || y + s->src_h > pic_h)
+        return 0;
+    s->pic_w = pic_w;
+    s->pic_h = pic_h;
+    s->src_x = x;
+    s->src_y = y;
+    return 1;
+}
+
+static bool scaler_cached(const struct scaler_lines *l, unsigned slot, uint32_t pair, uint32_t x0, uint32_t x1) {
+    return l->cached_pair[slot] == (int32_t)pair && l->cached_x0[slot] <= x0 && l->cached_x1[slot] >= x1;
+}
+
+// returns converted source row with at least columns [x0, x1) valid, keeping the last two
+// converted row pairs around. x0 has to be even.
+static const uint16_t *scaler_row(const struct scaler *s, struct scaler_lines *l, i420_to_rgb565_row2_t kernel,
+    const uint8_t *yuv, uint32_t row, uint32_t x0, uint32_t x1) {
+    uint32_t pair = row / 2;
+    unsigned slot;
+    if (scaler_cached(l, 0, pair, x0, x1)) {
+        slot = 0;
+    } else if (scaler_cached(l, 1, pair, x0, x1)) {
+        slot = 1;
+    } else {
+        slot = l->cached_pair[1] == (int32_t)pair? 1: l->cached_pair[0] == (int32_t)pair? 0: l->next_slot;
+        const uint32_t w = s->pic_w, h = s->pic_h, cw = (w + 1) / 2;
+        const uint32_t x = s->src_x + x0, cy = s->src_y / 2 + pair;
+        const uint8_t *Y = yuv + (s->src_y + 2 * pair) * w + x;
+        const uint8_t *U = yuv + w * h + cy * cw + x / 2;
+        const uint8_t *V = yuv + w * h + cw * ((h + 1) / 2) + cy * cw + x / 2;
+        uint32_t next = 2 * pair + 1 < s->src_h? w: 0;
+        kernel(Y, Y + next, U, V, l->lines[slot][0] + x0, l->lines[slot][1] + x0, x1 - x0, x0, 2 * pair);
+        l->cached_pair[slot] = pair;
+        l->cached_x0[slot] = x0;
+        l->cached_x1[slot] = x1;
+    }
+    // never evict the pair handed out last, bilinear holds on to it
+    l->next_slot = slot ^ 1;
+    return l->lines[slot][row & 1];
+}
+
+// columns of source row that need redrawing, all of them without spans
+static struct scaler_span scaler_row_span(const struct scaler *s, const struct scaler_span *spans, uint32_t row) {
+    if (!spans)
+        return (struct scaler_span){0, s->src_w};
+    struct scaler_span span = spans[row / SCALER_TILE];
+    span.x1 = MIN(span.x1, s->src_w);
+    return span;
+}
+
+static struct scaler_span scaler_span_union(struct scaler_span a, struct scaler_span b) {
+    if (a.x0 >= a.x1)
+        return b;
+    if (b.x0 >= b.x1)
+        return a;
+    return (struct scaler_span){MIN(a.x0, b.x0), a.x1 > b.x1? a.x1: b.x1};
+}
+
+// out points at output row y0, either end of the range may split a doubled source row
+static uint32_t scaler_run_double(const struct scaler *s, struct scaler_lines *l, i420_to_rgb565_row2_t kernel,
+    const uint8_t *yuv, uint16_t *out, uint32_t stride, const struct scaler_span *spans, uint32_t y0, uint32_t y1) {
+    rgb565_double_row_t row_double = rgb565_double_row_c;
+#ifdef HAVE_ESP32S3
+    if (!l->portable && s->src_w % 8 == 0 && stride % 8 == 0 && (uintptr_t)out % 16 == 0)
+        row_double = rgb565_double_row_esp32s3;
+#endif
+    uint32_t written = 0;
+    for(uint32_t y = y0 & ~1u; y < y1; y += 2) {
+        struct scaler_span span = scaler_row_span(s, spans, y / 2);
+        if (span.x0 >= span.x1)
+            continue;
+        uint16_t *dst0 = out + (y >= y0? y - y0: y + 1 - y0) * stride;
+        uint16_t *dst1 = y + 1 < y1? out + (y + 1 - y0) * stride: dst0;
+        const uint16_t *line = scaler_row(s, l, kernel, yuv, y / 2, span.x0, span.x1);
+        row_double(line + span.x0, dst0 + 2 * span.x0, dst1 + 2 * span.x0, span.x1 - span.x0);
+        written += (dst0 == dst1? 2: 4) * (span.x1 - span.x0);
+    }
+    return written;
+}
+
+// output rows [y0, y1) of the picture, out points at row y0 of it
+static uint32_t scaler_rows(const struct scaler *s, struct scaler_lines *l, const uint8_t *yuv, uint16_t *out,
+    uint32_t stride, const struct scaler_span *spans, uint32_t y0, uint32_t y1) {
+    // the SIMD kernel's alignment needs whole vectors from the start of the picture's rows on
+    i420_to_rgb565_row2_t kernel = l->portable || s->src_x % 16 || s->src_w % 16? i420_to_rgb565_portable_kernel():
+        i420_to_rgb565_kernel(yuv, s->pic_w, s->pic_h, l->lines[0][0], SCALER_MAX_WIDTH);
+    l->cached_pair[0] = l->cached_pair[1] = -1;
+
+    if (s->filter == SCALER_INTEGER && s->factor == 2)
+        return scaler_run_double(s, l, kernel, yuv, out, stride, spans, y0, y1);
+
+    uint32_t written = 0;
+    for(uint32_t y = y0; y != y1; ++y, out += stride) {
+        uint32_t row, pos = 0;
+        unsigned wy = 0;
+        if (s->filter != SCALER_BILINEAR) {
+            row = y * s->src_h / s->dst_h;
+        } else {
+            pos = scaler_source_pos(y, s->src_h, s->dst_h);
+            row = pos >> 5;
+            wy = row < s->src_h - 1? pos & 31: 0;
+            if (row > s->src_h - 1)
+                row = s->src_h - 1;
+        }
+        struct scaler_span span = scaler_row_span(s, spans, row);
+        if (wy)
+            span = scaler_span_union(span, scaler_row_span(s, spans, row + 1));
+        if (span.x0 >= span.x1)
+            continue;
+        uint32_t dx0 = s->tile_dst_start[span.x0 / SCALER_TILE];
+        uint32_t dx1 = s->tile_dst_end[(span.x1 + SCALER_TILE - 1) / SCALER_TILE];
+        written += dx1 - dx0;
+
+        if (s->filter != SCALER_BILINEAR) {
+            const uint16_t *line = scaler_row(s, l, kernel, yuv, row, span.x0, span.x1);
+            for(uint32_t x = dx0; x != dx1; ++x)
+                out[x] = line[s->x_index[x]];
+            continue;
+        }
+
+        // taps reach one column to either side of the span
+        uint32_t x0 = span.x0 >= SCALER_TILE? span.x0 - SCALER_TILE: 0;
+        uint32_t x1 = MIN((uint32_t)span.x1 + SCALER_TILE, s->src_w);
+        const uint16_t *a = scaler_row(s, l, kernel, yuv, row, x0, x1);
+        const uint16_t *b = wy? scaler_row(s, l, kernel, yuv, row + 1, x0, x1): a;
+        for(uint32_t x = x0; x != x1; ++x)
+            l->blend[x] = rgb565_lerp(a[x], b[x], wy);
+        for(uint32_t x = dx0; x != dx1; ++x) {
+            uint32_t i = s->x_index[x];
+            unsigned wx = s->x_weight[x];
+            out[x] = wx? rgb565_lerp(l->blend[i], l->blend[i + 1], wx): l->blend[i];
+        }
+    }
+    return written;
+}
+
+void scaler_run(struct scaler *s, const uint8_t *yuv, uint16_t *fb, uint32_t fb_stride) {
+    scaler_run_slice(s, &s->work, yuv, fb, fb_stride, NULL, 0, s->dst_h);
+}
+
+uint32_t scaler_run_spans(struct scaler *s, const uint8_t *yuv, uint16_t *fb, uint32_t fb_stride,
+    const struct scaler_span *spans) {
+    return scaler_run_slice(s, &s->work, yuv, fb, fb_stride, spans, 0, s->dst_h);
+}
+
+uint32_t scaler_run_slice(const struct scaler *s, struct scaler_lines *l, const uint8_t *yuv, uint16_t *fb,
+    uint32_t fb_stride, const struct scaler_span *spans, uint32_t y0, uint32_t y1) {
+    return scaler_rows(s, l, yuv, fb + (s->dst_y + y0) * fb_stride + s->dst_x, fb_stride, spans, y0, y1);
+}
+
+void scaler_run_lines(const struct scaler *s, struct scaler_lines *l, const uint8_t *yuv, uint16_t *dst,
+    uint32_t row, uint32_t rows) {
+    const uint32_t w = s->out_w, end = row + rows;
+    uint32_t y0 = row > s->dst_y? row: s->dst_y;
+    uint32_t y1 = MIN(end, s->dst_y + s->dst_h);
+    if (y0 >= y1) {
+        memset(dst, 0, rows * w * sizeof(uint16_t));
+        return;
+    }
+    memset(dst, 0, (y0 - row) * w * sizeof(uint16_t));
+    memset(dst + (y1 - row) * w, 0, (end - y1) * w * sizeof(uint16_t));
+    if (s->dst_w != w) {
+        for(uint32_t y = y0; y != y1; ++y) {
+            uint16_t *line = dst + (y - row) * w;
+            memset(line, 0, s->dst_x * sizeof(uint16_t));
+            memset(line + s->dst_x + s->dst_w, 0, (w - s->dst_x - s->dst_w) * sizeof(uint16_t));
+        }
+    }
+    scaler_rows(s, l, yuv, dst + (y0 - row) * w + s->dst_x, w, NULL, y0 - s->dst_y, y1 - s->dst_y);
+}
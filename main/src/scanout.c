@@ -0,0 +1,26 @@
+#include "scanout.h"
+#include "board.h"
+#include "platform.h"
+
+uint32_t scanout_budget_us(void) {
+    return (uint32_t)((uint64_t)BOARD_LCD_BOUNCE_ROWS * (BOARD_LCD_H_RES + BOARD_LCD_H_BLANK) * 1000000 /
+        BOARD_LCD_PCLK_HZ);
+}
+
+uint32_t scanout_measure(const struct scaler *s, struct scaler_lines *l, const uint8_t *yuv, uint16_t *dst) {
+    uint32_t slowest = 0;
+    for(uint32_t row = 0; row < BOARD_LCD_V_RES; row += BOARD_LCD_BOUNCE_ROWS) {
+        // the faster of two runs, the measuring task may be preempted where the interrupt wouldn't be
+        uint32_t best = UINT32_MAX;
+        for(unsigned run = 0; run != 2; ++run) {
+            int64_t start = platform_time_us();
+            scaler_run_lines(s, l, yuv, dst, row, BOARD_LCD_BOUNCE_ROWS);
+            uint32_t took = platform_time_us() - start;
+            if (took < best)
+                best = took;
+        }
+        if (best > slowest)
+            slowest = best;
+    }
+    return slowest;
+}
@@ -0,0 +1,39 @@
+#include "telemetry.h"
+
+static void write_le16(uint8_t *dst, uint32_t value) {
+    if (value > 0xffff)
+        value = 0xffff;
+    dst[0] = value;
+    dst[1] = value >> 8;
+}
+
+uint32_t telemetry_build(uint8_t dst[TELEMETRY_SIZE], const struct telemetry_window *window) {
+    dst[0] = TELEMETRY_VERSION;
+    dst[1] = LATENCY_COUNT;
+    dst[2] = LATENCY_BUCKETS;
+    dst[3] = 0;
+    write_le16(dst + 4, window->duration_ms);
+    write_le16(dst + 6, window->presented);
+    write_le16(dst + 8, window->dropped);
+    write_le16(dst + 10, window->lost);
+    dst[12] = window->bytes;
+    dst[13] = window->bytes >> 8;
+    dst[14] = window->bytes >> 16;
+    dst[15] = window->bytes >> 24;
+    write_le16(dst + 16, window->mtu);
+    write_le16(dst + 18, window->rx_octets);
+    write_le16(dst + 20, window->interval);
+    dst[22] = window->rx_phy;
+    dst[23] = window->tx_phy;
+    write_le16(dst + 24, window->writes);
+    write_le16(dst + 26, window->wakeups);
+
+    uint8_t *p = dst + TELEMETRY_HEADER_SIZE;
+    for(unsigned stage = 0; stage != LATENCY_COUNT; ++stage) {
+        uint32_t counts[LATENCY_BUCKETS];
+        latency_take(stage, counts);
+        for(unsigned i = 0; i != LATENCY_BUCKETS; ++i, p += 2)
+            write_le16(p, counts[i]);
+    }
+    return TELEMETRY_SIZE;
+}
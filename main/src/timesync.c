@@ -0,0 +1,94 @@
+#include "timesync.h"
+#include <string.h>
+
+// exchanges older than this, about half an hour, are left out, which keeps scaled ages within 64 bits
+#define TIMESYNC_MAX_AGE (1LL << 31)
+
+void timesync_init(struct timesync *ts) {
+    memset(ts, 0, sizeof(*ts));
+}
+
+// drift accumulated by the remote clock between two local times
+static int64_t timesync_drift(const struct timesync *ts, int64_t from, int64_t to) {
+    return (to - from) * ts->drift_ppb / 1000000000;
+}
+
+// Intersection of the bounds of the newest n samples moved to the newest one with the given drift.
+// Ages are the time before the newest sample scaled by 2^32 / 10^9, so a drift in ppb moves the
+// bounds by (age * ppb) >> 32, without a 64-bit division per step of the drift search.
+static int64_t timesync_bounds(const struct timesync *ts, uint32_t n, int32_t ppb, int64_t *high) {
+    int64_t low = INT64_MIN;
+    *high = INT64_MAX;
+    for(uint32_t i = 0; i != n; ++i) {
+        uint32_t index = (ts->count - 1 - i) % TIMESYNC_SAMPLES;
+        int64_t drift = (ts->ages[index] * ppb) >> 32;
+        if (ts->samples[index].low + drift > low)
+            low = ts->samples[index].low + drift;
+        if (ts->samples[index].high + drift < *high)
+            *high = ts->samples[index].high + drift;
+    }
+    return low;
+}
+
+// how far apart the bounds stay, negative when they cross
+static int64_t timesync_gap(const struct timesync *ts, uint32_t n, int32_t ppb) {
+    int64_t high, low = timesync_bounds(ts, n, ppb, &high);
+    return high - low;
+}
+
+void timesync_update(struct timesync *ts, int64_t t1, int64_t t2, int64_t t3, int64_t t4) {
+    // the reply can't arrive before it was sent, nor the request before it left
+    struct timesync_sample sample = {
+        .time = t4,
+        .low = t3 - t4,
+        .high = t2 - t1,
+    };
+    ts->samples[ts->count++ % TIMESYNC_SAMPLES] = sample;
+
+    uint32_t n = 0;
+    for(; n != ts->count && n != TIMESYNC_SAMPLES; ++n) {
+        uint32_t index = (ts->count - 1 - n) % TIMESYNC_SAMPLES;
+        int64_t age = sample.time - ts->samples[index].time;
+        if (age > TIMESYNC_MAX_AGE)
+            break;
+        ts->ages[index] = (age << 32) / 1000000000;
+    }
+
+    // The gap is the minimum of upper minus the maximum of lower bounds, each linear in the drift,
+    // so it has a single maximum: ternary search, keeping both points while they tie on a plateau.
+    int32_t lo = -TIMESYNC_MAX_DRIFT_PPB, hi = TIMESYNC_MAX_DRIFT_PPB;
+    while(hi - lo > 2) {
+        int32_t m1 = lo + (hi - lo) / 3, m2 = hi - (hi - lo) / 3;
+        int64_t g1 = timesync_gap(ts, n, m1), g2 = timesync_gap(ts, n, m2);
+        if (g1 < g2)
+            lo = m1 + 1;
+        else if (g1 > g2)
+            hi = m2 - 1;
+        else if (m2 - m1 > 1)
+            lo = m1, hi = m2;
+        else
+            break;
+    }
+    ts->drift_ppb = lo + (hi - lo) / 2;
+
+    // bounds which cross each other come from delays that weren't as assumed or a drift estimate
+    // that's slightly off, their middle is still the best guess
+    int64_t high, low = timesync_bounds(ts, n < TIMESYNC_OFFSET_SAMPLES? n: TIMESYNC_OFFSET_SAMPLES,
+        ts->drift_ppb, &high);
+    ts->time = sample.time;
+    ts->offset = low + (high - low) / 2;
+    ts->error = high > low? (high - low) / 2: (low - high) / 2;
+}
+
+bool timesync_valid(const struct timesync *ts) {
+    return ts->count >= TIMESYNC_MIN_SAMPLES;
+}
+
+int64_t timesync_offset(const struct timesync *ts, int64_t now) {
+    return ts->offset + timesync_drift(ts, ts->time, now);
+}
+
+int64_t timesync_to_local(const struct timesync *ts, int64_t remote) {
+    // close enough for the drift term, offsets change by far less than the time to correct for
+    return remote - timesync_offset(ts, remote - ts->offset);
+}
@@ -0,0 +1,80 @@
+#include "transport.h"
+#include "platform.h"
+#include <stdatomic.h>
+
+const char *const transport_names[TRANSPORT_COUNT] = {"gatt", "gatt-long"};
+
+static transport_sink_fn sink;
+static struct transport_stats stats[TRANSPORT_COUNT];
+// sequentially consistent: either the writer sees the pause or the pausing task sees the writer
+static _Atomic bool paused;
+static _Atomic uint32_t in_sink;
+
+void transport_init(transport_sink_fn fn) {
+    sink = fn;
+}
+
+void transport_write(enum transport transport, const uint8_t *data, uint32_t len) {
+    atomic_fetch_add(&in_sink, 1);
+    if (atomic_load(&paused)) {
+        atomic_fetch_sub(&in_sink, 1);
+        ++stats[transport].refused;
+        return;
+    }
+#if CONFIG_MOTOCAST_TRANSPORT_COMPARE
+    int64_t start = platform_time_us();
+    sink(data, len);
+    stats[transport].sink_us += (uint32_t)(platform_time_us() - start);
+#else
+    sink(data, len);
+#endif
+    atomic_fetch_sub(&in_sink, 1);
+    stats[transport].bytes += len;
+    ++stats[transport].writes;
+}
+
+void transport_pause(bool pause) {
+    atomic_store(&paused, pause);
+}
+
+bool transport_busy(void) {
+    return atomic_load(&in_sink) != 0;
+}
+
+void transport_get_stats(enum transport transport, struct transport_stats *dst) {
+    *dst = stats[transport];
+}
+
+#if CONFIG_MOTOCAST_TRANSPORT_COMPARE
+
+static const char *TAG = "transport";
+
+void transport_report(void) {
+    static struct transport_stats last[TRANSPORT_COUNT];
+    static int64_t last_report;
+
+    int64_t now = platform_time_us();
+    uint32_t elapsed = (uint32_t)(now - last_report);
+    last_report = now;
+    if (!elapsed)
+        return;
+    for(unsigned i = 0; i != TRANSPORT_COUNT; ++i) {
+        struct transport_stats current = stats[i];
+        uint32_t bytes = current.bytes - last[i].bytes;
+        uint32_t writes = current.writes - last[i].writes;
+        uint32_t sink_us = current.sink_us - last[i].sink_us;
+        last[i] = current;
+        if (!writes)
+            continue;
+        PLATFORM_LOGI(TAG, "%-9s %7.1f kbps, %5lu writes/s, avg %lu bytes, %5.2f%% in the sink, avg %lu us",
+            transport_names[i], bytes * 8000.0f / elapsed, (unsigned long)((uint64_t)writes * 1000000 / elapsed),
+            (unsigned long)(bytes / writes), sink_us * 100.0f / elapsed, (unsigned long)(sink_us / writes));
+    }
+}
+
+#else
+
+void transport_report(void) {
+}
+
+#endif
@@ -1,126 +1,181 @@
 #include "video.h"
-#include "esp_lcd_panel_ops.h"
-#include "esp_lcd_panel_rgb.h"
+#include "packet_pool.h"
+#include "pipeline.h"
+#include "ring.h"
+#include "video_stream.h"
+#include "esp_heap_caps.h"
 #include "esp_log.h"
-#include "esp_h264_dec_sw.h"
+#include "esp_attr.h"
+#include "esp_timer.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include <stdbool.h>
 
 static const char * TAG = "video";
 
-extern esp_lcd_panel_handle_t panel_handle;
+static struct ring ingest_ring;
+static struct packet_pool pool;
+static TaskHandle_t decode_task_handle;
+
+// Writes are grouped into batches, opened by the first write after the previous batch closed and
+// closed, waking the decode task, by the write that completes a framed packet. A timer closes the
+// batch MOTOCAST_INGEST_BATCH_US after it opened if no packet completes. Writes in between only
+// copy into the ring.
+static esp_timer_handle_t batch_timer;
+static _Atomic bool batch_open;
+static struct video_frame_tracker tracker;
+static uint32_t ingest_writes, ingest_batches, decode_wakeups;
+
+// arrival time of recent batches, keyed by the ring position of their first byte
+#define ARRIVALS 64
+static struct {
+    uint32_t start;
+    int64_t time;
+} arrivals[ARRIVALS];
+static _Atomic uint32_t arrivals_head, arrivals_tail;
+
+_Static_assert((CONFIG_MOTOCAST_RING_SIZE & (CONFIG_MOTOCAST_RING_SIZE - 1)) == 0,
+    "MOTOCAST_RING_SIZE must be a power of two");
+
+// decode task side of the arrival queue: time of the batch the byte before offset arrived with.
+// Offsets only ever grow, the batch found stays queued as later data may still belong to it.
+static int64_t video_arrival(uint32_t offset) {
+    uint32_t tail = atomic_load_explicit(&arrivals_tail, memory_order_relaxed);
+    uint32_t head = atomic_load_explicit(&arrivals_head, memory_order_acquire);
+    while(head - tail > 1 && (int32_t)(arrivals[(tail + 1) % ARRIVALS].start - offset) < 0)
+        ++tail;
+    atomic_store_explicit(&arrivals_tail, tail, memory_order_release);
+    return tail != head && (int32_t)(arrivals[tail % ARRIVALS].start - offset) < 0? arrivals[tail % ARRIVALS].time: 0;
+}
 
-esp_h264_dec_cfg_sw_t h264_config = {
-    .pic_type = ESP_H264_RAW_FMT_I420
-};
-static esp_h264_dec_handle_t h264_handle = NULL;
+static uint32_t video_backlog(void) {
+    return ring_used(&ingest_ring);
+}
 
-static uint16_t *fb_rgb;
+static void video_decode_task(void *arg) {
+    for(;;) {
+        ulTaskNotifyTake(pdTRUE, portMAX_DELAY);
+        ++decode_wakeups;
+        const uint8_t *data;
+        uint32_t len;
+        while((len = ring_peek(&ingest_ring, &data)) != 0) {
+            video_decode(data, len);
+            ring_consume(&ingest_ring, len);
+        }
+    }
+}
 
-static const unsigned W = 320, H = 240;
+// The write that made the previous check of batch_open see it set is in the ring before the store
+// below, so the decode task picks it up after the wakeup.
+static void IRAM_ATTR video_batch_close(void *arg) {
+    atomic_store(&batch_open, false);
+#if CONFIG_ESP_TIMER_SUPPORTS_ISR_DISPATCH_METHOD
+    BaseType_t woken = pdFALSE;
+    vTaskNotifyGiveFromISR(decode_task_handle, &woken);
+    if (woken)
+        esp_timer_isr_dispatch_need_yield();
+#else
+    xTaskNotifyGive(decode_task_handle);
+#endif
+}
 
-void video_init() {
-    ESP_LOGI(TAG, "initialising video decoder...");
-    ESP_ERROR_CHECK(esp_h264_dec_sw_new(&h264_config, &h264_handle));
-    ESP_ERROR_CHECK(esp_h264_dec_open(h264_handle));
-    ESP_LOGI(TAG, "initialised video decoder.");
-    fb_rgb = (uint16_t*)malloc(W * H * 2);
-    if (!fb_rgb) {
-        ESP_LOGE(TAG, "no memory for RGB framebuffer");
-        abort();
+// BLE task: starts a batch with the write at ring position offset, closed right away if that
+// write completes a packet
+static void video_batch_open(uint32_t offset, int complete) {
+    int64_t now = esp_timer_get_time();
+    uint32_t head = atomic_load_explicit(&arrivals_head, memory_order_relaxed);
+    // when the queue is full the bytes are attributed to an earlier batch
+    if (head - atomic_load_explicit(&arrivals_tail, memory_order_acquire) != ARRIVALS) {
+        arrivals[head % ARRIVALS].start = offset;
+        arrivals[head % ARRIVALS].time = now;
+        atomic_store_explicit(&arrivals_head, head + 1, memory_order_release);
+    }
+    ++ingest_batches;
+    if (CONFIG_MOTOCAST_INGEST_BATCH_US && !complete) {
+        atomic_store(&batch_open, true);
+        if (esp_timer_start_once(batch_timer, CONFIG_MOTOCAST_INGEST_BATCH_US) == ESP_OK)
+            return;
+        atomic_store(&batch_open, false);
     }
+    xTaskNotifyGive(decode_task_handle);
 }
 
-struct video_packet pkt = {};
-
-esp_h264_dec_out_frame_t out_frame = {};
-
-void video_present_frame(const uint8_t *yuv420) {
-    static const unsigned W2 = W / 2, H2 = H / 2;
-    static const unsigned LSIZE = W * H;
-    static const unsigned CSIZE = W2 * H2;
-    const uint8_t * Y = yuv420;
-    const uint8_t * U = Y + LSIZE;
-    const uint8_t * V = U + CSIZE;
-    uint16_t *dst = fb_rgb;
-    for(unsigned i = 0; i != H; ++i) {
-        for(unsigned j = 0; j != W; ++j) {
-            int16_t t_y = Y[((i * W) + j)];
-            int16_t t_u = U[(((i / 2) * W2) + (j / 2))] - 128;
-            int16_t t_v = V[(((i / 2) * W2) + (j / 2))] - 128;
-            t_y = t_y < 16 ? 0 : t_y - 16;
-
-            int16_t r = (298 * t_y + 409 * t_v + 128) >> 8;
-            int16_t g = (298 * t_y - 100 * t_u - 208 * t_v + 128) >> 8;
-            int16_t b = (298 * t_y + 516 * t_u + 128) >> 8;
-            r >>= 3;
-            g >>= 2;
-            b >>= 3;
-            *dst++ = (r << 11) | (g << 5) | b;
-        }
-    }
-    ESP_ERROR_CHECK_WITHOUT_ABORT(esp_lcd_panel_draw_bitmap(panel_handle, 0, 0, W, H, fb_rgb));
+// BLE task: the write completed a packet, the decode task needn't wait for the timer. Should the
+// timer fire anyway in between, the decode task just wakes once more.
+static void video_batch_flush(void) {
+    esp_timer_stop(batch_timer);
+    atomic_store(&batch_open, false);
+    xTaskNotifyGive(decode_task_handle);
 }
 
-void video_packet_free(struct video_packet *pkt) {
-    free(pkt->data);
-    pkt->data = 0;
-    pkt->data_len = pkt->data_written = 0;
-    pkt->header_read = 0;
+void video_init() {
+    uint8_t *ring_data = (uint8_t*)heap_caps_malloc(CONFIG_MOTOCAST_RING_SIZE, MALLOC_CAP_INTERNAL | MALLOC_CAP_8BIT);
+    if (!ring_data) {
+        ESP_LOGE(TAG, "no memory for ingest ring");
+        abort();
+    }
+    ring_init(&ingest_ring, ring_data, CONFIG_MOTOCAST_RING_SIZE);
+
+    uint8_t *pool_data = (uint8_t*)heap_caps_malloc(CONFIG_MOTOCAST_MAX_AU_SIZE * CONFIG_MOTOCAST_PACKET_POOL_SIZE, MALLOC_CAP_SPIRAM | MALLOC_CAP_8BIT);
+    if (!pool_data) {
+        ESP_LOGE(TAG, "no memory for packet pool");
+        abort();
+    }
+    packet_pool_init(&pool, pool_data, CONFIG_MOTOCAST_MAX_AU_SIZE, CONFIG_MOTOCAST_PACKET_POOL_SIZE);
+    video_stream_init(&pool, video_arrival, video_backlog);
+    video_frame_tracker_init(&tracker, CONFIG_MOTOCAST_MAX_AU_SIZE);
+
+    const esp_timer_create_args_t batch_timer_args = {
+        .callback = video_batch_close,
+#if CONFIG_ESP_TIMER_SUPPORTS_ISR_DISPATCH_METHOD
+        .dispatch_method = ESP_TIMER_ISR,
+#endif
+        .name = "ingest_batch",
+    };
+    ESP_ERROR_CHECK(esp_timer_create(&batch_timer_args, &batch_timer));
+
+    pipeline_init();
+    if (xTaskCreatePinnedToCore(video_decode_task, "video_decode", CONFIG_MOTOCAST_DECODE_TASK_STACK_SIZE, NULL,
+            CONFIG_MOTOCAST_DECODE_TASK_PRIORITY, &decode_task_handle, CONFIG_MOTOCAST_DECODE_TASK_CORE) != pdPASS) {
+        ESP_LOGE(TAG, "failed to create decode task");
+        abort();
+    }
 }
 
-int video_packet_finished(struct video_packet *pkt) {
-    return pkt->data_written >= pkt->data_len;
+void video_write(const uint8_t *buffer, uint32_t buffer_len) {
+    int64_t start = pipeline_begin();
+    uint32_t offset = atomic_load_explicit(&ingest_ring.head, memory_order_relaxed);
+    // dropped writes are accounted in the ring, framing recovers on the decode side
+    int complete = ring_write(&ingest_ring, buffer, buffer_len) && video_frame_track(&tracker, buffer, buffer_len);
+    ++ingest_writes;
+    if (!atomic_load(&batch_open))
+        video_batch_open(offset, complete);
+    else if (complete)
+        video_batch_flush();
+    pipeline_end(PIPELINE_INGEST, start);
 }
 
-#define MIN(a, b) ((a) < (b)? (a): (b))
-
-esp_h264_err_t video_decode(uint8_t *buffer, uint32_t buffer_len) {
-    uint32_t src_offset = 0;
-    while(src_offset < buffer_len) {
-        src_offset += video_packet_process(&pkt, buffer + src_offset, buffer_len - src_offset);
-        if (!video_packet_finished(&pkt))
-            return ESP_H264_ERR_OK;
-
-        esp_h264_dec_in_frame_t in_frame = {.raw_data = { pkt.data, pkt.data_len }};
-        while (in_frame.raw_data.len)  {
-            int ret = esp_h264_dec_process(h264_handle, &in_frame, &out_frame);
-            if (ret != ESP_H264_ERR_OK) {
-                ESP_LOGI(TAG, "esp_h264_dec_process error: %d", ret);
-            } else {
-                if (out_frame.outbuf)
-                    video_present_frame(out_frame.outbuf);
-            }
-            in_frame.raw_data.buffer += in_frame.consume;
-            in_frame.raw_data.len -= in_frame.consume;
-        }
-        video_packet_free(&pkt);
-    }
-    return ESP_H264_ERR_OK;
+uint32_t video_ring_free(void) {
+    return ring_free(&ingest_ring);
 }
 
-uint32_t video_packet_process(struct video_packet *pkt, const uint8_t *buffer, uint32_t buffer_len) {
-    uint32_t src_offset = 0;
-    if (!pkt->data) {
-        while(pkt->header_read < 4 && src_offset < buffer_len) {
-            pkt->data_len  |=  (uint32_t)buffer[pkt->header_read] << (pkt->header_read * 8);
-            ++pkt->header_read;
-            ++src_offset;
-        }
-        if (pkt->header_read < 4)
-            return src_offset;
-        pkt->data_written = 0;
-        pkt->data = (uint8_t*)malloc(pkt->data_len);
-        if (!pkt->data) {
-            ESP_LOGE(TAG, "malloc failed");
-            abort();
-        }
-    }
-    uint32_t to_write = pkt->data_len - pkt->data_written;
-    uint32_t to_read = buffer_len - src_offset;
-    uint8_t *dst = pkt->data + pkt->data_written;
-    const uint8_t *src = buffer + src_offset;
-    if (to_read > to_write)
-        to_read = to_write;
-    memcpy(dst, src, to_read);
-    pkt->data_written += to_read;
-    return to_read + src_offset;
+void video_get_stats(struct video_stats *stats) {
+    stats->ring_size = ingest_ring.size;
+    stats->ring_consumed = atomic_load_explicit(&ingest_ring.tail, memory_order_acquire);
+    stats->ring_accepted = atomic_load_explicit(&ingest_ring.head, memory_order_acquire);
+    stats->ring_used = stats->ring_accepted - stats->ring_consumed;
+    stats->ring_high_water = ingest_ring.high_water;
+    stats->ring_dropped_writes = ingest_ring.dropped_writes;
+    stats->ring_dropped_bytes = ingest_ring.dropped_bytes;
+    stats->ingest_writes = ingest_writes;
+    stats->ingest_batches = ingest_batches;
+    stats->decode_wakeups = decode_wakeups;
+
+    stats->pool_count = pool.count;
+    stats->pool_in_use = pool.in_use;
+    stats->pool_peak_in_use = pool.peak_in_use;
+    stats->pool_exhausted = pool.exhausted;
+    stats->pool_oversized = pool.oversized;
+
+    video_stream_get_stats(stats);
 }
@@ -0,0 +1,233 @@
+#include "video_packet.h"
+#include "crc32.h"
+#include <string.h>
+
+#define MIN(a, b) ((a) < (b)? (a): (b))
+
+static uint32_t read_le32(const uint8_t *src) {
+    return (uint32_t)src[0] | ((uint32_t)src[1] << 8) | ((uint32_t)src[2] << 16) | ((uint32_t)src[3] << 24);
+}
+
+static uint64_t read_le64(const uint8_t *src) {
+    return read_le32(src) | ((uint64_t)read_le32(src + 4) << 32);
+}
+
+static uint16_t read_le16(const uint8_t *src) {
+    return (uint16_t)(src[0] | (src[1] << 8));
+}
+
+void video_packet_init(struct video_packet *pkt, struct packet_pool *pool) {
+    memset(pkt, 0, sizeof(*pkt));
+    pkt->pool = pool;
+}
+
+int video_packet_finished(const struct video_packet *pkt) {
+    return pkt->payload != 0;
+}
+
+static void video_packet_reset(struct video_packet *pkt) {
+    pkt->payload = 0;
+    pkt->payload_len = 0;
+    pkt->timestamp = 0;
+    pkt->data = 0;
+    pkt->data_len = pkt->data_written = 0;
+    pkt->header_read = 0;
+    pkt->skip = 0;
+}
+
+void video_packet_free(struct video_packet *pkt) {
+    packet_pool_release(pkt->pool, pkt->data);
+    video_packet_reset(pkt);
+}
+
+// drops the first header byte and everything up to the next sync byte, returns the bytes dropped
+static uint8_t video_header_resync(uint8_t *header, uint8_t *header_read) {
+    uint8_t i = 1;
+    while(i < *header_read && header[i] != VIDEO_FRAME_SYNC0)
+        ++i;
+    memmove(header, header + i, *header_read - i);
+    *header_read -= i;
+    return i;
+}
+
+static void video_packet_resync(struct video_packet *pkt) {
+    pkt->stats.resync_bytes += video_header_resync(pkt->header, &pkt->header_read);
+}
+
+// validates as much of the header as has been read so far
+static int video_header_valid(const uint8_t *header, uint8_t header_read) {
+    if (header_read >= 2 && header[1] != VIDEO_FRAME_SYNC1)
+        return 0;
+    if (header_read >= 3 && header[2] != VIDEO_FRAME_VERSION)
+        return 0;
+    if (header_read >= 8 && read_le16(header + 6) != 0)
+        return 0;
+    return 1;
+}
+
+static void video_packet_start_payload(struct video_packet *pkt, const uint8_t *src, uint32_t available) {
+    const uint8_t *header = pkt->header;
+    pkt->flags = header[3];
+    pkt->seq = read_le16(header + 4);
+    pkt->data_len = read_le32(header + 8);
+    pkt->data_written = 0;
+    pkt->crc = crc32_update(0, header, VIDEO_FRAME_CRC_OFFSET);
+
+    // anything older than expected is a repeat, but an IDR restarts the numbering, as after a
+    // sender restart
+    if (pkt->have_seq && (int16_t)(pkt->seq - pkt->next_seq) < 0 && !(pkt->flags & VIDEO_FRAME_FLAG_IDR)) {
+        ++pkt->stats.duplicate;
+        pkt->skip = 1;
+        return;
+    }
+    if (pkt->data_len <= available) {
+        // whole payload is already contiguous in the input, decode it from there
+        pkt->payload = src;
+        ++pkt->stats.fast_path;
+        return;
+    }
+    ++pkt->stats.slow_path;
+    pkt->data = packet_pool_acquire(pkt->pool, pkt->data_len);
+    if (!pkt->data) {
+        ++pkt->stats.rejected;
+        pkt->skip = 1;
+    }
+}
+
+uint32_t video_packet_process(struct video_packet *pkt, const uint8_t *buffer, uint32_t buffer_len) {
+    uint32_t src_offset = 0;
+    for(;;) {
+        if (!pkt->payload && !pkt->data && !pkt->skip) {
+            if (pkt->header_read == 0) {
+                if (src_offset == buffer_len)
+                    return src_offset;
+                const uint8_t *src = buffer + src_offset;
+                const uint8_t *sync = (const uint8_t *)memchr(src, VIDEO_FRAME_SYNC0, buffer_len - src_offset);
+                if (!sync) {
+                    pkt->stats.resync_bytes += buffer_len - src_offset;
+                    return buffer_len;
+                }
+                pkt->stats.resync_bytes += sync - src;
+                src_offset += sync - src;
+            }
+            uint32_t to_read = MIN((uint32_t)VIDEO_FRAME_HEADER_SIZE - pkt->header_read, buffer_len - src_offset);
+            memcpy(pkt->header + pkt->header_read, buffer + src_offset, to_read);
+            pkt->header_read += to_read;
+            src_offset += to_read;
+
+            if (!video_header_valid(pkt->header, pkt->header_read)) {
+                if (pkt->header_read == VIDEO_FRAME_HEADER_SIZE)
+                    ++pkt->stats.bad_headers;
+                video_packet_resync(pkt);
+                continue;
+            }
+            if (pkt->header_read < VIDEO_FRAME_HEADER_SIZE)
+                return src_offset;
+            if (read_le32(pkt->header + 8) > pkt->pool->buffer_size) {
+                // can't tell an oversized frame from a corrupted length, scan for the next header
+                ++pkt->stats.rejected;
+                ++pkt->pool->oversized;
+                video_packet_resync(pkt);
+                continue;
+            }
+            video_packet_start_payload(pkt, buffer + src_offset, buffer_len - src_offset);
+        }
+
+        uint32_t to_read = MIN(pkt->data_len - pkt->data_written, buffer_len - src_offset);
+        if (!pkt->skip) {
+            const uint8_t *src = buffer + src_offset;
+            if (pkt->data)
+                memcpy(pkt->data + pkt->data_written, src, to_read);
+            pkt->crc = crc32_update(pkt->crc, src, to_read);
+        }
+        pkt->data_written += to_read;
+        src_offset += to_read;
+        if (pkt->data_written < pkt->data_len)
+            return src_offset;
+
+        if (pkt->skip) {
+            video_packet_reset(pkt);
+            continue;
+        }
+        if (pkt->crc != read_le32(pkt->header + VIDEO_FRAME_CRC_OFFSET)) {
+            // A corrupted length may have swallowed the next headers: rescan from the header's
+            // second byte while the payload is still in the input. Of a payload that started in
+            // an earlier input only this input's part is left to rescan.
+            ++pkt->stats.corrupt;
+            uint32_t gone = pkt->data_len - to_read;
+            video_packet_free(pkt);
+            src_offset -= to_read;
+            if (gone) {
+                pkt->stats.resync_bytes += VIDEO_FRAME_HEADER_SIZE + gone;
+            } else {
+                pkt->header_read = VIDEO_FRAME_HEADER_SIZE;
+                video_packet_resync(pkt);
+            }
+            continue;
+        }
+        int16_t ahead = (int16_t)(pkt->seq - pkt->next_seq);
+        if (pkt->have_seq && ahead > 0)
+            pkt->stats.lost += ahead;
+        pkt->next_seq = pkt->seq + 1;
+        pkt->have_seq = 1;
+        ++pkt->stats.frames;
+        if (pkt->data)
+            pkt->payload = pkt->data;
+        pkt->payload_len = pkt->data_len;
+        if ((pkt->flags & VIDEO_FRAME_FLAG_TIMESTAMP) && pkt->payload_len >= VIDEO_FRAME_TIMESTAMP_SIZE) {
+            pkt->timestamp = (int64_t)read_le64(pkt->payload);
+            pkt->payload += VIDEO_FRAME_TIMESTAMP_SIZE;
+            pkt->payload_len -= VIDEO_FRAME_TIMESTAMP_SIZE;
+        }
+        return src_offset;
+    }
+}
+
+void video_frame_tracker_init(struct video_frame_tracker *t, uint32_t max_len) {
+    memset(t, 0, sizeof(*t));
+    t->max_len = max_len;
+}
+
+int video_frame_track(struct video_frame_tracker *t, const uint8_t *buffer, uint32_t buffer_len) {
+    int complete = 0;
+    uint32_t src_offset = 0;
+    while(src_offset < buffer_len) {
+        if (t->in_payload) {
+            uint32_t to_skip = MIN(t->remaining, buffer_len - src_offset);
+            t->remaining -= to_skip;
+            src_offset += to_skip;
+            if (!t->remaining) {
+                t->in_payload = 0;
+                complete = 1;
+            }
+            continue;
+        }
+        if (t->header_read == 0) {
+            const uint8_t *src = buffer + src_offset;
+            const uint8_t *sync = (const uint8_t *)memchr(src, VIDEO_FRAME_SYNC0, buffer_len - src_offset);
+            if (!sync)
+                break;
+            src_offset += sync - src;
+        }
+        uint32_t to_read = MIN((uint32_t)VIDEO_FRAME_HEADER_SIZE - t->header_read, buffer_len - src_offset);
+        memcpy(t->header + t->header_read, buffer + src_offset, to_read);
+        t->header_read += to_read;
+        src_offset += to_read;
+        if (!video_header_valid(t->header, t->header_read)) {
+            video_header_resync(t->header, &t->header_read);
+            continue;
+        }
+        if (t->header_read < VIDEO_FRAME_HEADER_SIZE)
+            break;
+        // the same as the parser rejects
+        if (read_le32(t->header + 8) > t->max_len) {
+            video_header_resync(t->header, &t->header_read);
+            continue;
+        }
+        t->remaining = read_le32(t->header + 8);
+        t->header_read = 0;
+        t->in_payload = t->remaining != 0;
+        complete |= !t->in_payload;
+    }
+    return complete;
+}
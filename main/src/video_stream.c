@@ -0,0 +1,447 @@
+#include "video_stream.h"
+#include "board.h"
+#include "color_convert.h"
+#include "dirty.h"
+#include "display.h"
+#include "glass.h"
+#include "h264_nal.h"
+#include "latency.h"
+#include "pipeline.h"
+#include "platform.h"
+#include "scaler.h"
+#include "esp_h264_dec_sw.h"
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+
+static const char * TAG = "video";
+
+static esp_h264_dec_cfg_sw_t h264_config = {
+    .pic_type = ESP_H264_RAW_FMT_I420
+};
+static esp_h264_dec_handle_t h264_handle = NULL;
+static esp_h264_dec_param_sw_handle_t h264_param = NULL;
+
+// stream resolution the scaler is configured for, 0x0 until the first picture: the visible
+// video_width x video_height at video_x, video_y of the pic_width x pic_height decoded picture
+static uint32_t video_width, video_height;
+static uint32_t video_x, video_y, pic_width, pic_height;
+// frame cropping of the last SPS, for decoded pictures of its size
+static struct h264_sps crop_sps;
+static bool video_supported;
+static uint32_t resolution_changes;
+
+static struct video_packet pkt;
+
+static video_arrival_fn arrival_fn;
+static video_backlog_fn backlog_fn;
+// bytes passed to video_decode() so far and where the next access unit starts
+static uint32_t stream_offset, frame_offset;
+
+// catching up: see MOTOCAST_DROP_* in Kconfig
+#define VIDEO_MAX_SKIPPED 3     // pictures in a row decoded without being shown
+static bool behind;
+static uint32_t backlog;        // bytes queued behind the current access unit
+static uint32_t skipped_in_row;
+static uint32_t late_dropped, late_skipped;
+
+// decoder health, reported to the sender through video_get_stats()
+static uint32_t pictures, decode_us, convert_us, decode_errors, keyframes;
+static uint32_t convert_full, convert_full_us, convert_partial, convert_partial_us, pixels_drawn, pixels_total;
+static enum video_keyframe_reason keyframe_reason = VIDEO_KEYFRAME_START;
+static uint32_t packet_errors, resync_errors;
+
+static struct scaler scaler;
+#if !CONFIG_MOTOCAST_YUV_SCANOUT
+// what each framebuffer shows for the current scaler geometry: the serial of the picture drawn into
+// it, 0 while only its letterbox bars have been cleared
+static struct {
+    uint16_t *fb;
+    uint32_t serial;
+} fb_state[BOARD_LCD_NUM_FBS];
+#if CONFIG_MOTOCAST_DIRTY_TILES
+static struct dirty_map dirty;
+static bool dirty_supported;
+static bool dirty_refresh;      // an IDR arrived, the next converted picture redraws every tile
+#endif
+static struct scaler_span dirty_spans_buf[SCALER_MAX_BANDS];
+
+// the picture being converted, in slices of SCALER_SLICE_ROWS output rows
+static struct {
+    const uint8_t *yuv;
+    uint16_t *fb;
+    const struct scaler_span *spans;
+    uint32_t written[2];        // per worker
+} convert_job;
+static struct scaler_lines helper_lines;
+#endif
+static uint32_t convert_slices, convert_helper_slices;
+
+#if CONFIG_MOTOCAST_SCALE_NEAREST
+static const enum scaler_filter scale_filter = SCALER_NEAREST;
+#elif CONFIG_MOTOCAST_SCALE_BILINEAR
+static const enum scaler_filter scale_filter = SCALER_BILINEAR;
+#else
+static const enum scaler_filter scale_filter = SCALER_INTEGER;
+#endif
+
+#if CONFIG_MOTOCAST_SCALE_FILL
+static const enum scaler_fit scale_fit = SCALER_FILL;
+#else
+static const enum scaler_fit scale_fit = SCALER_LETTERBOX;
+#endif
+
+void video_stream_init(struct packet_pool *pool, video_arrival_fn arrival, video_backlog_fn backlog) {
+    PLATFORM_LOGI(TAG, "initialising video decoder...");
+    if (esp_h264_dec_sw_new(&h264_config, &h264_handle) != ESP_H264_ERR_OK ||
+            esp_h264_dec_open(h264_handle) != ESP_H264_ERR_OK ||
+            esp_h264_dec_sw_get_param_hd(h264_handle, &h264_param) != ESP_H264_ERR_OK) {
+        PLATFORM_LOGE(TAG, "failed to create decoder");
+        abort();
+    }
+    PLATFORM_LOGI(TAG, "initialised video decoder.");
+    color_convert_init();
+#if CONFIG_MOTOCAST_COLOR_SELFTEST
+    color_convert_selftest();
+#endif
+#if CONFIG_MOTOCAST_PIPELINE_BENCHMARK
+    color_convert_benchmark();
+#endif
+    video_packet_init(&pkt, pool);
+    arrival_fn = arrival;
+    backlog_fn = backlog;
+}
+
+void video_stream_get_stats(struct video_stats *stats) {
+    stats->packets = pkt.stats;
+
+    stats->width = video_width;
+    stats->height = video_height;
+    stats->resolution_changes = resolution_changes;
+    stats->late_dropped = late_dropped;
+    stats->late_skipped = late_skipped;
+    stats->behind = behind;
+    stats->pictures = pictures;
+    stats->decode_us = decode_us;
+    stats->convert_us = convert_us;
+    stats->convert_full = convert_full;
+    stats->convert_full_us = convert_full_us;
+    stats->convert_partial = convert_partial;
+    stats->convert_partial_us = convert_partial_us;
+    stats->pixels_drawn = pixels_drawn;
+    stats->pixels_total = pixels_total;
+    stats->convert_slices = convert_slices;
+    stats->convert_helper_slices = convert_helper_slices;
+    stats->decode_errors = decode_errors;
+    stats->keyframes = keyframes;
+    stats->keyframe_reason = keyframe_reason;
+    stats->last_seq = (uint16_t)(pkt.next_seq - 1);
+}
+
+static esp_h264_dec_out_frame_t out_frame = {};
+
+#if !CONFIG_MOTOCAST_YUV_SCANOUT
+
+// returns the serial of the picture fb shows, clearing its letterbox bars the first time it's seen
+static uint32_t *video_fb_serial(uint16_t *fb) {
+    for(unsigned i = 0; i != BOARD_LCD_NUM_FBS; ++i) {
+        if (fb_state[i].fb == fb)
+            return &fb_state[i].serial;
+        if (!fb_state[i].fb) {
+            memset(fb, 0, BOARD_LCD_H_RES * BOARD_LCD_V_RES * sizeof(uint16_t));
+            fb_state[i].fb = fb;
+            fb_state[i].serial = 0;
+            return &fb_state[i].serial;
+        }
+    }
+    // more framebuffers than expected, always draw this one in full
+    static uint32_t unknown;
+    memset(fb, 0, BOARD_LCD_H_RES * BOARD_LCD_V_RES * sizeof(uint16_t));
+    unknown = 0;
+    return &unknown;
+}
+
+#endif
+
+// reconfigures scaling when the stream resolution changes, returns false if the picture can't be shown
+static bool video_update_resolution(const uint8_t *picture, uint32_t out_size) {
+    esp_h264_resolution_t res;
+    if (esp_h264_dec_get_resolution(h264_param, &res) != ESP_H264_ERR_OK)
+        return false;
+    // the decoder outputs whole macroblocks, the SPS says which part of them is the picture
+    uint32_t x = 0, y = 0, w = res.width, h = res.height;
+    if (crop_sps.width == res.width && crop_sps.height == res.height) {
+        x = crop_sps.crop_x;
+        y = crop_sps.crop_y;
+        w = crop_sps.crop_w;
+        h = crop_sps.crop_h;
+    }
+    if (res.width == pic_width && res.height == pic_height && x == video_x && y == video_y &&
+            w == video_width && h == video_height)
+        return video_supported;
+
+    ++resolution_changes;
+    pic_width = res.width;
+    pic_height = res.height;
+    video_x = x;
+    video_y = y;
+    video_width = w;
+    video_height = h;
+    video_supported = (uint32_t)res.width * res.height * 3 / 2 == out_size &&
+        scaler_init(&scaler, w, h, BOARD_LCD_H_RES, BOARD_LCD_V_RES, scale_filter, scale_fit) &&
+        scaler_set_crop(&scaler, res.width, res.height, x, y);
+#if CONFIG_MOTOCAST_YUV_SCANOUT
+    // logs why it refused
+    video_supported = video_supported && display_yuv_configure(&scaler, picture);
+#else
+    memset(fb_state, 0, sizeof(fb_state));
+#if CONFIG_MOTOCAST_DIRTY_TILES
+    // tiles are tracked on the decoded picture, its columns and rows have to be the source's
+    dirty_supported = video_supported && !x && !y && dirty_init(&dirty, res.width, res.height);
+#endif
+#endif
+
+    if (video_supported)
+        PLATFORM_LOGI(TAG, "video %lux%lu, output %lux%lu at %lu,%lu", (unsigned long)w, (unsigned long)h,
+            (unsigned long)scaler.dst_w, (unsigned long)scaler.dst_h,
+            (unsigned long)scaler.dst_x, (unsigned long)scaler.dst_y);
+    else
+        PLATFORM_LOGE(TAG, "unsupported video size %lux%lu", (unsigned long)w, (unsigned long)h);
+    return video_supported;
+}
+
+// Takes the frame cropping of an SPS in the access unit, and with MOTOCAST_COLOR_MATRIX_AUTO switches
+// to the colour matrix it describes, before its picture is converted. Everything but BT.709,
+// unspecified included, is taken as BT.601.
+static void video_parse_sps(const uint8_t *data, uint32_t len) {
+    const uint8_t *pos = data, *end = data + len;
+    struct h264_nal nal;
+    struct h264_sps sps;
+    while(h264_next_nal(&pos, end, &nal)) {
+        if (nal.type != H264_NAL_SPS || !h264_parse_sps(nal.data + 3, nal.len - 3, &sps))
+            continue;
+        crop_sps = sps;
+#if CONFIG_MOTOCAST_COLOR_MATRIX_AUTO
+        enum color_matrix matrix = sps.matrix == H264_MATRIX_BT709?
+            (sps.full_range? COLOR_BT709_FULL: COLOR_BT709_LIMITED):
+            (sps.full_range? COLOR_BT601_FULL: COLOR_BT601_LIMITED);
+        if (matrix == color_convert_matrix())
+            continue;
+        color_convert_set_matrix(matrix);
+#if !CONFIG_MOTOCAST_YUV_SCANOUT
+        // unchanged tiles would keep the old colours
+        memset(fb_state, 0, sizeof(fb_state));
+#endif
+        PLATFORM_LOGI(TAG, "colour matrix %s", color_matrix_name(matrix));
+#endif
+    }
+}
+
+#if CONFIG_MOTOCAST_YUV_SCANOUT
+
+// the picture is converted while it's scanned out, it only needs to outlive the decoder's buffer
+static uint32_t video_present_frame(const uint8_t *yuv420, int64_t decoded) {
+    uint8_t *picture = display_acquire_yuv();
+    if (!picture)
+        return 0;
+    int64_t start = platform_time_us();
+    memcpy(picture, yuv420, pic_width * pic_height * 3 / 2);
+    pipeline_end(PIPELINE_CONVERT, start);
+    convert_us += platform_time_us() - start;
+    latency_add(LATENCY_CONVERT, platform_time_us() - decoded);
+    return display_submit_yuv(picture);
+}
+
+#else
+
+static void video_convert_slice(void *arg, uint32_t index, unsigned worker) {
+    uint32_t y0 = index * SCALER_SLICE_ROWS;
+    uint32_t y1 = y0 + SCALER_SLICE_ROWS < scaler.dst_h? y0 + SCALER_SLICE_ROWS: scaler.dst_h;
+    convert_job.written[worker] += scaler_run_slice(&scaler, worker? &helper_lines: &scaler.work,
+        convert_job.yuv, convert_job.fb, BOARD_LCD_H_RES, convert_job.spans, y0, y1);
+}
+
+// converts into fb on both cores, returns the pixels written
+static uint32_t video_convert(const uint8_t *yuv420, uint16_t *fb, const struct scaler_span *spans) {
+    convert_job.yuv = yuv420;
+    convert_job.fb = fb;
+    convert_job.spans = spans;
+    convert_job.written[0] = convert_job.written[1] = 0;
+    uint32_t slices = (scaler.dst_h + SCALER_SLICE_ROWS - 1) / SCALER_SLICE_ROWS;
+    convert_slices += slices;
+    convert_helper_slices += pipeline_parallel(slices, video_convert_slice, NULL);
+    return convert_job.written[0] + convert_job.written[1];
+}
+
+// returns the display frame number, 0 if the picture was dropped
+static uint32_t video_present_frame(const uint8_t *yuv420, int64_t decoded) {
+    uint16_t *fb = display_acquire();
+    if (!fb)
+        return 0;
+    int64_t start = platform_time_us();
+    uint32_t *drawn = video_fb_serial(fb);
+    uint32_t serial = 1;
+    bool partial = false;
+#if CONFIG_MOTOCAST_DIRTY_TILES
+    if (dirty_supported) {
+        // The framebuffer only needs the tiles changed since the picture it shows. A hash
+        // collision would leave a tile stale, IDRs and every MOTOCAST_DIRTY_REFRESH pictures
+        // redraw all of them.
+        bool refresh = dirty_refresh || (CONFIG_MOTOCAST_DIRTY_REFRESH &&
+            dirty.serial + 1 - dirty.refreshed >= CONFIG_MOTOCAST_DIRTY_REFRESH);
+        dirty_refresh = false;
+        serial = dirty_update(&dirty, yuv420, refresh);
+        partial = *drawn && dirty_spans(&dirty, *drawn, dirty_spans_buf) != dirty.cols * dirty.rows;
+    }
+#endif
+    uint32_t written = video_convert(yuv420, fb, partial? dirty_spans_buf: NULL);
+    *drawn = serial;
+    pipeline_end(PIPELINE_CONVERT, start);
+    uint32_t elapsed = platform_time_us() - start;
+    convert_us += elapsed;
+    if (partial) {
+        ++convert_partial;
+        convert_partial_us += elapsed;
+    } else {
+        ++convert_full;
+        convert_full_us += elapsed;
+    }
+    pixels_drawn += written;
+    pixels_total += scaler.dst_w * scaler.dst_h;
+    latency_add(LATENCY_CONVERT, platform_time_us() - decoded);
+    return display_submit(fb);
+}
+
+#endif
+
+static void video_request_keyframe(enum video_keyframe_reason reason) {
+    if (keyframe_reason == VIDEO_KEYFRAME_NONE)
+        keyframe_reason = reason;
+}
+
+// reference pictures are unusable after any framing problem
+static void video_check_packet_errors(void) {
+    uint32_t errors = pkt.stats.lost + pkt.stats.corrupt + pkt.stats.rejected;
+    if (errors != packet_errors) {
+        packet_errors = errors;
+        video_request_keyframe(VIDEO_KEYFRAME_LOST);
+    }
+    errors = pkt.stats.bad_headers + pkt.stats.resync_bytes;
+    if (errors != resync_errors) {
+        resync_errors = errors;
+        video_request_keyframe(VIDEO_KEYFRAME_RESYNC);
+    }
+}
+
+// tracks whether decoding is behind the stream, with hysteresis
+static void video_update_behind(int64_t lag_us, uint32_t backlog) {
+    bool late = (CONFIG_MOTOCAST_DROP_LAG_MS && lag_us > CONFIG_MOTOCAST_DROP_LAG_MS * 1000LL) ||
+        (CONFIG_MOTOCAST_DROP_BACKLOG && backlog > CONFIG_MOTOCAST_DROP_BACKLOG);
+    bool caught_up = (!CONFIG_MOTOCAST_DROP_LAG_MS || lag_us < CONFIG_MOTOCAST_DROP_LAG_MS * 500LL) &&
+        (!CONFIG_MOTOCAST_DROP_BACKLOG || backlog < CONFIG_MOTOCAST_DROP_BACKLOG / 2);
+    if (late && !behind)
+        PLATFORM_LOGI(TAG, "decoding behind, lag %lld ms, %lu bytes queued", (long long)(lag_us / 1000), (unsigned long)backlog);
+    if (late)
+        behind = true;
+    else if (caught_up)
+        behind = false;
+}
+
+static void video_picture_decoded(const uint8_t *yuv420, int64_t complete) {
+    int64_t decoded = platform_time_us();
+    latency_add(LATENCY_DECODE, decoded - complete);
+    ++pictures;
+#if CONFIG_MOTOCAST_DROP_SKIP_CONVERT
+    // a newer picture is already queued, don't spend the conversion on this one
+    if (behind && backlog && skipped_in_row < VIDEO_MAX_SKIPPED) {
+        ++skipped_in_row;
+        ++late_skipped;
+        return;
+    }
+    skipped_in_row = 0;
+#endif
+    uint32_t frame = video_present_frame(yuv420, decoded);
+    if (frame && pkt.timestamp)
+        glass_frame(pkt.seq, pkt.timestamp, decoded, frame);
+}
+
+static void video_decode_data(const uint8_t *data, uint32_t len, int64_t complete) {
+    // decoder doesn't modify the stream, data may point straight into the ingest ring
+    esp_h264_dec_in_frame_t in_frame = {.raw_data = { (uint8_t *)data, len }};
+    while (in_frame.raw_data.len)  {
+        int64_t start = platform_time_us();
+        int ret = esp_h264_dec_process(h264_handle, &in_frame, &out_frame);
+        pipeline_end(PIPELINE_DECODE, start);
+        decode_us += platform_time_us() - start;
+        if (ret != ESP_H264_ERR_OK) {
+            PLATFORM_LOGI(TAG, "esp_h264_dec_process error: %d", ret);
+            ++decode_errors;
+            video_request_keyframe(VIDEO_KEYFRAME_DECODE);
+        } else {
+            if (out_frame.out_size && video_update_resolution(out_frame.outbuf, out_frame.out_size))
+                video_picture_decoded(out_frame.outbuf, complete);
+        }
+        // a decoder stuck on the same input would spin here forever, give up on the rest instead
+        if (!in_frame.consume || in_frame.consume > in_frame.raw_data.len)
+            break;
+        in_frame.raw_data.buffer += in_frame.consume;
+        in_frame.raw_data.len -= in_frame.consume;
+    }
+}
+
+// decodes the access unit without its non-reference NAL units, nothing else depends on them
+static void video_decode_references(const uint8_t *data, uint32_t len, int64_t complete) {
+    const uint8_t *pos = data, *end = data + len;
+    bool dropped = false;
+    struct h264_nal nal;
+    while(h264_next_nal(&pos, end, &nal)) {
+        if (nal.ref_idc) {
+            video_decode_data(nal.data, nal.len, complete);
+        } else if (h264_nal_is_slice(&nal)) {
+            dropped = true;
+        }
+    }
+    if (dropped)
+        ++late_dropped;
+}
+
+esp_h264_err_t video_decode(const uint8_t *buffer, uint32_t buffer_len) {
+    uint32_t base = stream_offset;
+    stream_offset += buffer_len;
+    uint32_t src_offset = 0;
+    while(src_offset < buffer_len) {
+        int64_t start = pipeline_begin();
+        src_offset += video_packet_process(&pkt, buffer + src_offset, buffer_len - src_offset);
+        pipeline_end(PIPELINE_PARSE, start);
+        video_check_packet_errors();
+        if (!video_packet_finished(&pkt))
+            return ESP_H264_ERR_OK;
+
+        int64_t complete = platform_time_us();
+        int64_t arrived = arrival_fn? arrival_fn(frame_offset): 0;
+        if (arrived)
+            latency_add(LATENCY_ARRIVAL, complete - arrived);
+        frame_offset = base + src_offset;
+
+        uint32_t queued = backlog_fn? backlog_fn(): 0;
+        backlog = queued > src_offset? queued - src_offset: 0;
+        video_update_behind(arrived? complete - arrived: 0, backlog);
+
+        // an IDR picture makes the decoder independent of everything before it
+        if (pkt.flags & VIDEO_FRAME_FLAG_IDR) {
+            keyframe_reason = VIDEO_KEYFRAME_NONE;
+            ++keyframes;
+#if CONFIG_MOTOCAST_DIRTY_TILES
+            dirty_refresh = true;
+#endif
+        }
+        if (pkt.flags & (VIDEO_FRAME_FLAG_CONFIG | VIDEO_FRAME_FLAG_IDR))
+            video_parse_sps(pkt.payload, pkt.payload_len);
+        if (behind)
+            video_decode_references(pkt.payload, pkt.payload_len, complete);
+        else
+            video_decode_data(pkt.payload, pkt.payload_len, complete);
+        video_packet_free(&pkt);
+    }
+    return ESP_H264_ERR_OK;
+}